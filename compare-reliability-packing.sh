@@ -0,0 +1,116 @@
+#!/bin/bash
+set -euo pipefail
+
+# Streams a video over each bandwidth trace twice, once with reliable and
+# unreliable stream data in separate packets (default) and once mixed
+# (--mix_reliability), and compares what the server retransmitted.
+#
+# The traces are replayed with tc on the loopback interface, which requires
+# root. The server prints one [connection] line per connection when it is
+# started with --connection_stats; once ready, it writes stderr to
+# srv.err.log in the working directory, which is kept per run.
+
+if [ $# -lt 3 ]
+then
+    echo "usage: $0 <path/to/video/dir> <MPD> <trace> [<trace>...]"
+    exit 1
+fi
+
+readonly HOST=127.0.0.1
+readonly PORT=6121
+readonly CERT_DIR=chrome/src/net/tools/quic/certs/out
+readonly BUF_SIZE_MS=8000
+readonly ABR=bpp
+readonly DEV=lo
+readonly OUT_DIR=reliability-packing
+CACHE_DIR="${1%/}"
+MPD="$2"
+shift 2
+
+mkdir -p "$OUT_DIR"
+
+replay_trace() {
+    local trace="$1"
+    tc qdisc replace dev "$DEV" root tbf rate 10mbit burst 32kbit latency 400ms
+    while read -r _ bytes
+    do
+        # Each line holds the bytes of one second.
+        tc qdisc change dev "$DEV" root tbf rate "$((bytes * 8 > 8000 ? bytes * 8 : 8000))bit" \
+            burst 32kbit latency 400ms
+        sleep 1
+    done < "$trace"
+}
+
+run() {
+    local name="$1"
+    local trace="$2"
+    shift 2
+
+    ./chrome/src/out/Release/quic_server \
+        --certificate_file="$CERT_DIR/leaf_cert.pem" \
+        --key_file="$CERT_DIR/leaf_cert.pkcs8" \
+        --port="$PORT" \
+        --quic_response_cache_dir="$CACHE_DIR" \
+        --connection_stats \
+        "$@" \
+        > "$OUT_DIR/$name.server.log" 2>&1 &
+    local server=$!
+    until grep -q "Server Ready" "$OUT_DIR/$name.server.log" 2> /dev/null
+    do
+        sleep 1
+    done
+
+    replay_trace "$trace" &
+    local shaper=$!
+
+    ./chrome/src/out/Release/quic_client \
+        -q \
+        --host="$HOST" \
+        --port="$PORT" \
+        --abr_buf="$BUF_SIZE_MS" \
+        --abr="$ABR" \
+        "https://www.example.org/$MPD" \
+        1> /dev/null \
+        2> "$OUT_DIR/$name.client.log" || true
+
+    kill "$shaper" 2> /dev/null || true
+    wait "$shaper" 2> /dev/null || true
+    tc qdisc del dev "$DEV" root 2> /dev/null || true
+    # The connection prints its counters once the client has closed it.
+    sleep 2
+    kill "$server" 2> /dev/null || true
+    wait "$server" 2> /dev/null || true
+    mv srv.err.log "$OUT_DIR/$name.server.err.log"
+    rm -f srv.out.log
+}
+
+# Sums the counters of all [connection] lines of a server error log.
+summarize() {
+    awk '/^\[connection\]/ {
+        for (i = 2; i <= NF; ++i) {
+            split($i, kv, ":");
+            sum[kv[1]] += kv[2];
+        }
+    }
+    END {
+        printf "%d %d %d %d %d\n", sum["bytes_sent"], sum["bytes_retransmitted"],
+            sum["mixed_retransmitted"], sum["unreliable_bytes_in_retransmitted"],
+            sum["packets_split"];
+    }' "$1"
+}
+
+printf "%-40s %-10s %12s %14s %8s %16s %8s\n" \
+    trace packing bytes_sent bytes_retrans mixed unrel_in_retrans split
+for trace in "$@"
+do
+    name=$(basename "$trace" .sum)
+    run "$name.segregated" "$trace"
+    run "$name.mixed" "$trace" --mix_reliability
+    for packing in segregated mixed
+    do
+        read -r sent retrans mixed unrel split \
+            < <(summarize "$OUT_DIR/$name.$packing.server.err.log")
+        printf "%-40s %-10s %12d %14d %8d %16d %8d\n" \
+            "$name" "$packing" "$sent" "$retrans" "$mixed" "$unrel" "$split"
+    done
+done
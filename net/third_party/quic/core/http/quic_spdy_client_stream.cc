@@ -6,6 +6,8 @@
 
 #include "net/third_party/quic/core/http/quic_spdy_client_stream.h"
 
+#include <algorithm>
+#include <cstring>
 #include <utility>
 #include <iostream>
 #include <thread>
@@ -14,6 +16,7 @@
 #include "net/third_party/quic/core/http/quic_spdy_client_session.h"
 #include "net/third_party/quic/core/http/spdy_utils.h"
 #include "net/third_party/quic/core/quic_alarm.h"
+#include "net/third_party/quic/platform/api/quic_bug_tracker.h"
 #include "net/third_party/quic/platform/api/quic_logging.h"
 #include "net/third_party/spdy/core/spdy_protocol.h"
 
@@ -27,6 +30,14 @@ QuicSpdyClientStream::QuicSpdyClientStream(QuicStreamId id,
     : QuicSpdyStream(id, session),
       content_length_(-1),
       response_code_(0),
+      body_destination_(nullptr),
+      body_destination_length_(0),
+      body_scatter_(nullptr),
+      body_scatter_index_(0),
+      body_size_(0),
+      received_step_listener_(nullptr),
+      received_step_(0),
+      next_received_step_(0),
       header_bytes_read_(0),
       header_bytes_written_(0),
       session_(session),
@@ -36,10 +47,75 @@ QuicSpdyClientStream::~QuicSpdyClientStream() = default;
 
 
 
-std::map < QuicStreamOffset, FrameTiming >& QuicSpdyClientStream::get_frame_timings() {
+const std::map<QuicStreamOffset, FrameTiming>& QuicSpdyClientStream::get_frame_timings() {
   return sequencer()->get_frame_timings();
 }
 
+void QuicSpdyClientStream::SetBodyDestination(
+    char* destination,
+    size_t destination_length,
+    const std::vector<BodyScatter>* scatter) {
+  body_destination_ = destination;
+  body_destination_length_ = destination_length;
+  body_scatter_ = scatter;
+  body_scatter_index_ = 0;
+  if (!data_.empty()) {
+    ScatterBody(data_.data(), data_.size(), 0, *body_scatter_,
+                &body_scatter_index_, body_destination_,
+                body_destination_length_);
+    data_.clear();
+    data_.shrink_to_fit();
+  }
+}
+
+void QuicSpdyClientStream::SetReceivedStepListener(
+    size_t step,
+    ReceivedStepListener* listener) {
+  received_step_listener_ = listener;
+  received_step_ = step;
+  if (step > 0) {
+    const size_t received = GetReceived(/*lossy=*/false);
+    next_received_step_ = received - received % step + step;
+  }
+}
+
+// static
+void QuicSpdyClientStream::ScatterBody(const char* data,
+                                       size_t length,
+                                       size_t offset,
+                                       const std::vector<BodyScatter>& scatter,
+                                       size_t* index,
+                                       char* destination,
+                                       size_t destination_length) {
+  const size_t start = offset;
+  const size_t end = offset + length;
+  while (*index < scatter.size() && offset < end) {
+    const BodyScatter& entry = scatter[*index];
+    // Entries are checked by whoever builds them; one that does not fit is
+    // dropped rather than written past the end.
+    if (entry.to > destination_length ||
+        entry.length > destination_length - entry.to) {
+      QUIC_BUG << "Body scatter entry to:" << entry.to
+               << " length:" << entry.length << " past "
+               << destination_length << " bytes";
+      ++*index;
+      continue;
+    }
+    if (entry.from + entry.length <= offset) {
+      ++*index;
+      continue;
+    }
+    if (entry.from >= end) {
+      break;
+    }
+    size_t from = std::max(offset, entry.from);
+    size_t to = std::min(end, entry.from + entry.length);
+    memcpy(destination + entry.to + (from - entry.from),
+           data + (from - start), to - from);
+    offset = to;
+  }
+}
+
 void QuicSpdyClientStream::OnInitialHeadersComplete(
     bool fin,
     bool unreliable,
@@ -160,7 +236,14 @@ void QuicSpdyClientStream::OnDataAvailable() {
       std::cout <<  "\n" << data_.length() << " | " << iov.iov_len <<  std::endl; 
       #endif
  
-      data_.append(static_cast<char*>(iov.iov_base), iov.iov_len);
+      if (body_destination_ != nullptr) {
+        ScatterBody(static_cast<char*>(iov.iov_base), iov.iov_len, body_size_,
+                    *body_scatter_, &body_scatter_index_, body_destination_,
+                    body_destination_length_);
+      } else {
+        data_.append(static_cast<char*>(iov.iov_base), iov.iov_len);
+      }
+      body_size_ += iov.iov_len;
     }
     else
     {
@@ -170,9 +253,9 @@ void QuicSpdyClientStream::OnDataAvailable() {
     }
 
     if (content_length_ >= 0 &&
-        data_.size() > static_cast<uint64_t>(content_length_)) {
+        body_size_ > static_cast<uint64_t>(content_length_)) {
       QUIC_DLOG(ERROR) << "Invalid content length (" << content_length_
-                       << ") with data of size " << data_.size();
+                       << ") with data of size " << body_size_;
       Reset(QUIC_BAD_APPLICATION_PAYLOAD);
       return;
     }
@@ -180,6 +263,14 @@ void QuicSpdyClientStream::OnDataAvailable() {
   }
   //std::cout << "A qscs-OnDataAvailable: seq: " << sequencer()->IsClosed() << std::endl;
 
+  if (received_step_listener_ != nullptr && received_step_ > 0) {
+    const size_t received = GetReceived(/*lossy=*/false);
+    if (received >= next_received_step_) {
+      next_received_step_ = received - received % received_step_ + received_step_;
+      received_step_listener_->OnReceivedStep(id());
+    }
+  }
+
   if (sequencer()->IsClosed()) {
     #ifdef SLST_DEBUG 
     std::cout << "B qscs-OnDataAvailable: seq: " << sequencer()->IsClosed() << std::endl;
@@ -6,6 +6,7 @@
 #define NET_THIRD_PARTY_QUIC_CORE_HTTP_QUIC_SPDY_CLIENT_STREAM_H_
 
 #include <cstddef>
+#include <vector>
 
 #include "base/macros.h"
 #include "net/third_party/quic/core/http/quic_spdy_stream.h"
@@ -18,10 +19,26 @@ namespace quic {
 
 class QuicSpdyClientSession;
 
+// Places response body bytes [from, from + length) at |to| in the buffer
+// passed to QuicSpdyClientStream::SetBodyDestination().
+struct BodyScatter {
+  size_t to;
+  size_t from;
+  size_t length;
+};
+
 // All this does right now is send an SPDY request, and aggregate the
 // SPDY response.
 class QuicSpdyClientStream : public QuicSpdyStream {
  public:
+  // Told whenever the data received on a stream grows by another step, see
+  // SetReceivedStepListener().
+  class ReceivedStepListener {
+   public:
+    virtual ~ReceivedStepListener() {}
+    virtual void OnReceivedStep(QuicStreamId id) = 0;
+  };
+
   QuicSpdyClientStream(QuicStreamId id, QuicSpdyClientSession* session);
   QuicSpdyClientStream(const QuicSpdyClientStream&) = delete;
   QuicSpdyClientStream& operator=(const QuicSpdyClientStream&) = delete;
@@ -53,9 +70,38 @@ class QuicSpdyClientStream : public QuicSpdyStream {
                      QuicStringPiece body,
                      bool fin);
 
-  // Returns the response data.
+  // Returns the response data. Empty for body written to a destination.
   const QuicString& data() { return data_; }
 
+  // Writes the response body straight from the sequencer into the
+  // |destination_length| bytes at |destination|, laid out by |scatter|
+  // (sorted by |from|), instead of collecting it in data(). Body bytes no
+  // entry covers, or that would land past the end, are dropped. Body that
+  // arrived before is moved over. Neither is owned, both must outlive the
+  // stream.
+  void SetBodyDestination(char* destination,
+                          size_t destination_length,
+                          const std::vector<BodyScatter>* scatter);
+
+  // Response body bytes received so far, wherever they were written.
+  size_t body_size() const { return body_size_; }
+
+  // Calls |listener| each time GetReceived(false) crosses another multiple
+  // of |step| bytes. |listener| is not owned, null stops the calls.
+  void SetReceivedStepListener(size_t step, ReceivedStepListener* listener);
+
+  // Copies |length| body bytes at body offset |offset| to their place in
+  // |destination|, clamped to its |destination_length| bytes. |index| is the
+  // first |scatter| entry that may still apply and is advanced, so
+  // sequential calls stay linear.
+  static void ScatterBody(const char* data,
+                          size_t length,
+                          size_t offset,
+                          const std::vector<BodyScatter>& scatter,
+                          size_t* index,
+                          char* destination,
+                          size_t destination_length);
+
   // Returns whatever headers have been received for this stream.
   const spdy::SpdyHeaderBlock& response_headers() { return response_headers_; }
 
@@ -69,9 +115,9 @@ class QuicSpdyClientStream : public QuicSpdyStream {
 
   int response_code() const { return response_code_; }
 
-  std::map < QuicStreamOffset, FrameTiming >& get_frame_timings();
+  const std::map<QuicStreamOffset, FrameTiming>& get_frame_timings();
 
-  uint32_t GetTime() { return sequencer()->GetTime(); }
+  QuicTime::Delta GetTime() { return sequencer()->GetTime(); }
   double GetThroughput() { return sequencer()->GetThroughput(); }
   size_t GetReceived(bool lossy) { return sequencer()->GetReceived(lossy); }
   void ResetReceived() { sequencer()->ResetReceived(); }
@@ -90,6 +136,16 @@ class QuicSpdyClientStream : public QuicSpdyStream {
   int64_t content_length_;
   int response_code_;
   QuicString data_;
+  // Set by SetBodyDestination().
+  char* body_destination_;
+  size_t body_destination_length_;
+  const std::vector<BodyScatter>* body_scatter_;
+  size_t body_scatter_index_;
+  size_t body_size_;
+  // Set by SetReceivedStepListener().
+  ReceivedStepListener* received_step_listener_;
+  size_t received_step_;
+  size_t next_received_step_;
   size_t header_bytes_read_;
   size_t header_bytes_written_;
 
@@ -1592,6 +1592,9 @@ const QuicConnectionStats& QuicConnection::GetStats() {
   stats_.estimated_bandwidth = sent_packet_manager_.BandwidthEstimate();
   stats_.max_packet_size = packet_generator_.GetCurrentMaxPacketLength();
   stats_.max_received_packet_size = largest_received_packet_size_;
+  stats_.packets_split_by_reliability =
+      packet_generator_.packets_split_by_reliability();
+  stats_.unreliable_bytes_split = packet_generator_.unreliable_bytes_split();
   return stats_;
 }
 
@@ -3240,6 +3243,12 @@ void QuicConnection::SetTransmissionType(TransmissionType type) {
   packet_generator_.SetTransmissionType(type);
 }
 
+void QuicConnection::SetFrameBoundaries(
+    QuicStreamId id,
+    const std::vector<QuicStreamOffset>* frame_boundaries) {
+  packet_generator_.SetFrameBoundaries(id, frame_boundaries);
+}
+
 void QuicConnection::SetLongHeaderType(QuicLongHeaderType type) {
   packet_generator_.SetLongHeaderType(type);
 }
@@ -714,6 +714,11 @@ class QUIC_EXPORT_PRIVATE QuicConnection
   // Set long header type of next sending packets.
   void SetLongHeaderType(QuicLongHeaderType type);
 
+  // Set video frame boundaries of the stream data sent next.
+  void SetFrameBoundaries(
+      QuicStreamId id,
+      const std::vector<QuicStreamOffset>* frame_boundaries);
+
   // Return the id of the cipher of the primary decrypter of the framer.
   uint32_t cipher_id() const { return framer_.decrypter()->cipher_id(); }
 
@@ -26,9 +26,24 @@
 
 // If true, enforce that QUIC CHLOs fit in one packet.
 bool FLAGS_quic_enforce_single_packet_chlo = true;
+// If true, reliable and unreliable stream data go into separate packets.
+bool FLAGS_quic_segregate_unreliable_frames = true;
+// Most bytes a packet may leave unused to end at a video frame boundary, 0
+// turns the alignment off.
+int32_t FLAGS_quic_max_frame_alignment_padding = 200;
 
 namespace quic {
 
+namespace {
+
+// Unreliable stream frames lose their fin, and with it their unreliability,
+// on the last frame of the stream.
+bool IsUnreliableStreamFrame(const QuicStreamFrame& frame) {
+  return frame.unreliable && !frame.fin;
+}
+
+}  // namespace
+
 #define ENDPOINT \
   (framer_->perspective() == Perspective::IS_SERVER ? "Server: " : "Client: ")
 
@@ -48,7 +63,11 @@ QuicPacketCreator::QuicPacketCreator(QuicConnectionId connection_id,
       long_header_type_(HANDSHAKE),
       pending_padding_bytes_(0),
       needs_full_padding_(false),
-      can_set_transmission_type_(false) {
+      can_set_transmission_type_(false),
+      packets_split_by_reliability_(0),
+      unreliable_bytes_split_(0),
+      frame_boundaries_stream_id_(0),
+      frame_boundaries_(nullptr) {
   SetMaxPacketLength(kDefaultMaxPacketSize);
 }
 
@@ -129,11 +148,39 @@ bool QuicPacketCreator::ConsumeData(QuicStreamId id,
                                     bool unreliable,
                                     bool needs_full_padding,
                                     QuicFrame* frame) {
+  if (!packet_.unreliable_frames.empty() && IsFrameBoundary(id, offset) &&
+      BytesFree() <= static_cast<size_t>(FLAGS_quic_max_frame_alignment_padding)) {
+    // Only the tail of the previous video frame is in this packet, start the
+    // next one in a packet of its own.
+    Flush();
+  }
   if (!HasRoomForStreamFrame(id, offset, write_length - iov_offset)) {
     return false;
   }
 
   CreateStreamFrame(id, write_length, iov_offset, offset, fin, unreliable, frame);
+  if (FLAGS_quic_segregate_unreliable_frames &&
+      HasPendingStreamFramesOfOtherReliability(*frame->stream_frame)) {
+    // A lost packet with reliable data is retransmitted, and counts as
+    // reliable in loss detection and fake acking, so unreliable data must not
+    // share it. Small reliable tails, like the fin of an unreliable stream,
+    // coalesce with the reliable frames that follow instead.
+    if (IsUnreliableStreamFrame(*frame->stream_frame)) {
+      unreliable_bytes_split_ += frame->stream_frame->data_length;
+    } else {
+      for (const QuicFrame& pending : packet_.unreliable_frames) {
+        if (pending.type == STREAM_FRAME) {
+          unreliable_bytes_split_ += pending.stream_frame->data_length;
+        }
+      }
+    }
+    ++packets_split_by_reliability_;
+    delete frame->stream_frame;
+    Flush();
+    // The new packet has more room, the frame may grow.
+    CreateStreamFrame(id, write_length, iov_offset, offset, fin, unreliable,
+                      frame);
+  }
   // Explicitly disallow multi-packet CHLOs.
   if (FLAGS_quic_enforce_single_packet_chlo &&
       StreamFrameStartsWithChlo(*frame->stream_frame) &&
@@ -242,8 +289,10 @@ void QuicPacketCreator::CreateStreamFrame(QuicStreamId id,
   size_t min_frame_size = QuicFramer::GetMinStreamFrameSize(
       framer_->transport_version(), id, offset,
       /* last_frame_in_packet= */ true, data_size);
-  size_t bytes_consumed =
-      std::min<size_t>(BytesFree() - min_frame_size, data_size);
+  const size_t available_size = BytesFree() - min_frame_size;
+  const size_t bytes_consumed = BytesUpToFrameBoundary(
+      id, offset, available_size,
+      std::min<size_t>(available_size, data_size));
 
   bool set_fin = fin && bytes_consumed == data_size;  // Last frame.
   
@@ -318,6 +367,13 @@ void QuicPacketCreator::OnSerializedPacket() {
     return;
   }
 
+  if (packet_.unreliable_frames.empty()) {
+    packet_.reliability = RELIABLE_PACKET;
+  } else if (packet_.retransmittable_frames.empty()) {
+    packet_.reliability = UNRELIABLE_PACKET;
+  } else {
+    packet_.reliability = MIXED_RELIABILITY_PACKET;
+  }
   SerializedPacket packet(std::move(packet_));
   ClearPacket();
   delegate_->OnSerializedPacket(&packet);
@@ -337,10 +393,9 @@ void QuicPacketCreator::ClearPacket() {
   DCHECK(packet_.retransmittable_frames.empty());
   packet_.largest_acked = 0;
   needs_full_padding_ = false;
-  packet_.set_to_reliable = false;
-  packet_.unreliable = false;
   DCHECK(packet_.unreliable_frames.empty());
   packet_.fake_acked = false;
+  packet_.reliability = RELIABLE_PACKET;
 }
 
 void QuicPacketCreator::CreateAndSerializeStreamFrame(
@@ -385,8 +440,9 @@ void QuicPacketCreator::CreateAndSerializeStreamFrame(
       /* last_frame_in_packet= */ true, remaining_data_size);
   const size_t available_size =
       max_plaintext_size_ - writer.length() - min_frame_size;
-  const size_t bytes_consumed =
-      std::min<size_t>(available_size, remaining_data_size);
+  const size_t bytes_consumed = BytesUpToFrameBoundary(
+      id, stream_offset, available_size,
+      std::min<size_t>(available_size, remaining_data_size));
 
   const bool set_fin = fin && (bytes_consumed == remaining_data_size);
 
@@ -433,10 +489,8 @@ void QuicPacketCreator::CreateAndSerializeStreamFrame(
     std::cerr << "  Marking frame as retransmittable.\n";
 #endif
     packet_.retransmittable_frames.push_back(QuicFrame(frame.release()));
-    packet_.unreliable = false;
   } else {
     packet_.unreliable_frames.push_back(QuicFrame(frame.release()));
-    packet_.unreliable = true;
   }
 #ifdef SLST_DBG
   std::cerr << std::endl;
@@ -461,6 +515,19 @@ bool QuicPacketCreator::HasPendingStreamFramesOfStream(QuicStreamId id) const {
   return false;
 }
 
+bool QuicPacketCreator::HasPendingStreamFramesOfOtherReliability(
+    const QuicStreamFrame& frame) const {
+  if (!IsUnreliableStreamFrame(frame)) {
+    return !packet_.unreliable_frames.empty();
+  }
+  for (const auto& pending : packet_.retransmittable_frames) {
+    if (pending.type == STREAM_FRAME) {
+      return true;
+    }
+  }
+  return false;
+}
+
 size_t QuicPacketCreator::ExpansionOnNewFrame() const {
   // If the last frame in the packet is a stream frame, then it will expand to
   // include the stream_length field when a new frame is added.
@@ -680,7 +747,7 @@ bool QuicPacketCreator::ShouldRetransmit(const QuicFrame& frame) {
 bool QuicPacketCreator::AddFrame(const QuicFrame& frame,
                                  bool save_retransmittable_frames) {
 
-  bool is_unreliable = (frame.type == STREAM_FRAME) ? (frame.stream_frame->unreliable && !frame.stream_frame->fin) : false;
+  bool is_unreliable = (frame.type == STREAM_FRAME) ? IsUnreliableStreamFrame(*frame.stream_frame) : false;
 
 #ifdef SLST_DBG
   std::cerr << "AddFrame: frame:" << frame;
@@ -765,15 +832,6 @@ bool QuicPacketCreator::AddFrame(const QuicFrame& frame,
   std::cerr << std::endl;
 #endif
 
-  // Do not change the packet if it was explicitly set to reliable once.
-  if (!packet_.set_to_reliable) {
-    if (!is_unreliable) {
-      // First time seeing a reliable frame.
-      packet_.set_to_reliable = true;
-    }
-    packet_.unreliable = is_unreliable;
-  }
-
   if (frame.type == ACK_FRAME) {
     packet_.has_ack = true;
     packet_.largest_acked = LargestAcked(*frame.ack_frame);
@@ -863,6 +921,44 @@ void QuicPacketCreator::SetLongHeaderType(QuicLongHeaderType type) {
   long_header_type_ = type;
 }
 
+void QuicPacketCreator::SetFrameBoundaries(
+    QuicStreamId id,
+    const std::vector<QuicStreamOffset>* frame_boundaries) {
+  frame_boundaries_stream_id_ = id;
+  frame_boundaries_ = frame_boundaries;
+}
+
+bool QuicPacketCreator::IsFrameBoundary(QuicStreamId id,
+                                        QuicStreamOffset offset) const {
+  if (frame_boundaries_ == nullptr || id != frame_boundaries_stream_id_) {
+    return false;
+  }
+  return std::binary_search(frame_boundaries_->begin(),
+                            frame_boundaries_->end(), offset);
+}
+
+size_t QuicPacketCreator::BytesUpToFrameBoundary(QuicStreamId id,
+                                                 QuicStreamOffset offset,
+                                                 size_t available_size,
+                                                 size_t bytes_consumed) const {
+  if (frame_boundaries_ == nullptr || id != frame_boundaries_stream_id_) {
+    return bytes_consumed;
+  }
+  auto next = std::upper_bound(frame_boundaries_->begin(),
+                               frame_boundaries_->end(), offset);
+  if (next == frame_boundaries_->end() || *next >= offset + bytes_consumed) {
+    return bytes_consumed;
+  }
+  // Ending the packet at the boundary leaves the rest of it unused, so one
+  // lost packet only ever hits one video frame.
+  const size_t to_boundary = *next - offset;
+  if (available_size - to_boundary >
+      static_cast<size_t>(FLAGS_quic_max_frame_alignment_padding)) {
+    return bytes_consumed;
+  }
+  return to_boundary;
+}
+
 bool QuicPacketCreator::HasIetfLongHeader() const {
   return framer_->transport_version() > QUIC_VERSION_43 &&
          packet_.encryption_level < ENCRYPTION_FORWARD_SECURE;
@@ -20,6 +20,9 @@
 #include "net/third_party/quic/core/quic_pending_retransmission.h"
 #include "net/third_party/quic/platform/api/quic_export.h"
 
+extern bool FLAGS_quic_segregate_unreliable_frames;
+extern int32_t FLAGS_quic_max_frame_alignment_padding;
+
 namespace quic {
 namespace test {
 class QuicPacketCreatorPeer;
@@ -217,6 +220,14 @@ class QUIC_EXPORT_PRIVATE QuicPacketCreator {
   // Sets long header type of next constructed packets.
   void SetLongHeaderType(QuicLongHeaderType type);
 
+  // Sets the stream offsets, ascending, at which video frames of stream |id|
+  // start. Packets are ended at these if that leaves at most
+  // FLAGS_quic_max_frame_alignment_padding bytes unused. Not owned, the
+  // caller resets it to nullptr once the stream's data is consumed.
+  void SetFrameBoundaries(
+      QuicStreamId id,
+      const std::vector<QuicStreamOffset>* frame_boundaries);
+
   void set_debug_delegate(DebugDelegate* debug_delegate) {
     debug_delegate_ = debug_delegate;
   }
@@ -227,6 +238,16 @@ class QUIC_EXPORT_PRIVATE QuicPacketCreator {
 
   QuicByteCount pending_padding_bytes() const { return pending_padding_bytes_; }
 
+  // Packets which were flushed early to keep reliable and unreliable stream
+  // data apart, and the unreliable bytes that would otherwise have shared a
+  // packet with reliable data.
+  QuicPacketCount packets_split_by_reliability() const {
+    return packets_split_by_reliability_;
+  }
+  QuicByteCount unreliable_bytes_split() const {
+    return unreliable_bytes_split_;
+  }
+
  private:
   friend class test::QuicPacketCreatorPeer;
 
@@ -245,6 +266,22 @@ class QUIC_EXPORT_PRIVATE QuicPacketCreator {
 
   void FillPacketHeader(QuicPacketHeader* header);
 
+  // Returns true if a video frame of stream |id| starts at |offset|.
+  bool IsFrameBoundary(QuicStreamId id, QuicStreamOffset offset) const;
+
+  // Returns |bytes_consumed|, or fewer if a stream frame at |offset| should
+  // end at a video frame boundary. |available_size| is the room for data in
+  // the packet.
+  size_t BytesUpToFrameBoundary(QuicStreamId id,
+                                QuicStreamOffset offset,
+                                size_t available_size,
+                                size_t bytes_consumed) const;
+
+  // Returns true if the open packet has stream data whose reliability differs
+  // from |frame|'s.
+  bool HasPendingStreamFramesOfOtherReliability(
+      const QuicStreamFrame& frame) const;
+
   // Adds a |frame| if there is space and returns false and flushes all pending
   // frames if there isn't room. If |save_retransmittable_frames| is true,
   // saves the |frame| in the next SerializedPacket.
@@ -333,6 +370,14 @@ class QUIC_EXPORT_PRIVATE QuicPacketCreator {
   // If true, packet_'s transmission type is only set by
   // SetPacketTransmissionType and does not get cleared in ClearPacket.
   bool can_set_transmission_type_;
+
+  QuicPacketCount packets_split_by_reliability_;
+  QuicByteCount unreliable_bytes_split_;
+
+  // Video frame boundaries of the stream being written, see
+  // SetFrameBoundaries.
+  QuicStreamId frame_boundaries_stream_id_;
+  const std::vector<QuicStreamOffset>* frame_boundaries_;
 };
 
 }  // namespace quic
@@ -384,6 +384,12 @@ void QuicPacketGenerator::SetTransmissionType(TransmissionType type) {
   packet_creator_.SetTransmissionType(type);
 }
 
+void QuicPacketGenerator::SetFrameBoundaries(
+    QuicStreamId id,
+    const std::vector<QuicStreamOffset>* frame_boundaries) {
+  packet_creator_.SetFrameBoundaries(id, frame_boundaries);
+}
+
 void QuicPacketGenerator::SetLongHeaderType(QuicLongHeaderType type) {
   packet_creator_.SetLongHeaderType(type);
 }
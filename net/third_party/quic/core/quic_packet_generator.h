@@ -193,6 +193,11 @@ class QUIC_EXPORT_PRIVATE QuicPacketGenerator {
   // Set long header type of next constructed packets.
   void SetLongHeaderType(QuicLongHeaderType type);
 
+  // Set video frame boundaries of the stream data consumed next.
+  void SetFrameBoundaries(
+      QuicStreamId id,
+      const std::vector<QuicStreamOffset>* frame_boundaries);
+
   // Allow/Disallow setting transmission type of next constructed packets.
   void SetCanSetTransmissionType(bool can_set_transmission_type);
 
@@ -200,6 +205,13 @@ class QUIC_EXPORT_PRIVATE QuicPacketGenerator {
     packet_creator_.set_debug_delegate(debug_delegate);
   }
 
+  QuicPacketCount packets_split_by_reliability() const {
+    return packet_creator_.packets_split_by_reliability();
+  }
+  QuicByteCount unreliable_bytes_split() const {
+    return packet_creator_.unreliable_bytes_split();
+  }
+
  private:
   friend class test::QuicPacketGeneratorPeer;
 
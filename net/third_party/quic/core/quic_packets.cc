@@ -254,9 +254,8 @@ SerializedPacket::SerializedPacket(QuicPacketNumber packet_number,
       transmission_type(NOT_RETRANSMISSION),
       original_packet_number(0),
       largest_acked(0),
-      set_to_reliable(false),
-      unreliable(false),
-      fake_acked(false) {}
+      fake_acked(false),
+      reliability(RELIABLE_PACKET) {}
 
 SerializedPacket::SerializedPacket(const SerializedPacket& other) = default;
 
@@ -276,9 +275,8 @@ SerializedPacket::SerializedPacket(SerializedPacket&& other)
       transmission_type(other.transmission_type),
       original_packet_number(other.original_packet_number),
       largest_acked(other.largest_acked),
-      set_to_reliable(other.set_to_reliable),
-      unreliable(other.unreliable),
-      fake_acked(other.fake_acked) {
+      fake_acked(other.fake_acked),
+      reliability(other.reliability) {
   retransmittable_frames.swap(other.retransmittable_frames);
   unreliable_frames.swap(other.unreliable_frames);
 }
@@ -292,12 +290,11 @@ void ClearSerializedPacket(SerializedPacket* serialized_packet) {
   serialized_packet->encrypted_buffer = nullptr;
   serialized_packet->encrypted_length = 0;
   serialized_packet->largest_acked = 0;
-  serialized_packet->set_to_reliable = false;
-  serialized_packet->unreliable = false;
   if (!serialized_packet->unreliable_frames.empty()) {
     DeleteFrames(&serialized_packet->unreliable_frames);
   }
   serialized_packet->fake_acked = false;
+  serialized_packet->reliability = RELIABLE_PACKET;
 }
 
 char* CopyBuffer(const SerializedPacket& packet) {
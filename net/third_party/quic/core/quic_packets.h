@@ -232,6 +232,18 @@ class QUIC_EXPORT_PRIVATE QuicReceivedPacket : public QuicEncryptedPacket {
   int ttl_;
 };
 
+// What has to be done if a packet is lost, decided once when it is
+// serialized.
+enum PacketReliability : uint8_t {
+  // No unreliable stream data.
+  RELIABLE_PACKET,
+  // Unreliable stream data next to retransmittable frames.
+  MIXED_RELIABILITY_PACKET,
+  // Only unreliable stream data (and frames which are never retransmitted),
+  // nothing to retransmit.
+  UNRELIABLE_PACKET,
+};
+
 struct QUIC_EXPORT_PRIVATE SerializedPacket {
   SerializedPacket(QuicPacketNumber packet_number,
                    QuicPacketNumberLength packet_number_length,
@@ -263,10 +275,9 @@ struct QUIC_EXPORT_PRIVATE SerializedPacket {
   // The largest acked of the AckFrame in this packet if has_ack is true,
   // 0 otherwise.
   QuicPacketNumber largest_acked;
-  bool set_to_reliable;
-  bool unreliable;
   QuicFrames unreliable_frames;
   bool fake_acked;
+  PacketReliability reliability;
 };
 
 // Deletes and clears all the frames and the packet from serialized packet.
@@ -371,11 +371,21 @@ void QuicSentPacketManager::NeuterUnencryptedPackets() {
 void QuicSentPacketManager::MarkForRetransmission(
     QuicPacketNumber packet_number,
     TransmissionType transmission_type) {
-  bool found = false;
-  bool pure = true;
-
   QuicTransmissionInfo* transmission_info =
       unacked_packets_.GetMutableTransmissionInfo(packet_number);
+  // Nothing in a pure unreliable packet is retransmitted, it only leaves the
+  // flight.
+  const bool pure = transmission_info->reliability == UNRELIABLE_PACKET;
+  if (transmission_info->reliability == MIXED_RELIABILITY_PACKET) {
+    // What mixing reliable and unreliable data into one packet costs.
+    ++stats_->mixed_packets_retransmitted;
+    for (const QuicFrame& frame : transmission_info->unreliable_frames) {
+      if (frame.type == STREAM_FRAME) {
+        stats_->unreliable_bytes_in_retransmitted_packets +=
+            frame.stream_frame->data_length;
+      }
+    }
+  }
 
 	#ifdef SLST_DEBUG 
  std::cout  << " potentially! mark for retrans: " << packet_number <<  std::endl; 
@@ -384,33 +394,13 @@ void QuicSentPacketManager::MarkForRetransmission(
 #ifdef SLST_DBG
   std::cerr << "MarkForRetransmission: packet_number:" << packet_number << " transmission_type:"
             << QuicUtils::TransmissionTypeToString(transmission_type) << std::endl;
-  std::cerr << "  Retransmittable frames in packet:\n";
-#endif
-  for (const QuicFrame& frame : transmission_info->retransmittable_frames) {
-#ifdef SLST_DBG
-    std::cerr << "    " << frame;
-#endif
-    if (frame.type == STREAM_FRAME){
-      found = true;
-      if (!frame.stream_frame->unreliable || frame.stream_frame->fin) {
-#ifdef SLST_DBG
-          std::cerr << "      Found RELIABLE frame! Breaking.\n";
+  std::cerr << "  Reliability: " << static_cast<int>(transmission_info->reliability) << std::endl;
 #endif
-          pure = false;
-          #ifdef SLST_DEBUG 
- std::cout  << "packet not pure... DO mark!" <<  std::endl; 
- #endif
-          break;
-      }
-    }
-  }
-
-  if (!found)
-    pure = false;
 
   // When session decides what to write, a previous RTO retransmission may cause
   // connection close.
-  QUIC_BUG_IF(!unacked_packets_.HasRetransmittableFrames(*transmission_info) &&
+  QUIC_BUG_IF(!pure &&
+              !unacked_packets_.HasRetransmittableFrames(*transmission_info) &&
               (!session_decides_what_to_write() ||
                transmission_type != RTO_RETRANSMISSION))
       << "transmission_type: "
@@ -650,7 +640,7 @@ bool QuicSentPacketManager::OnPacketSent(
 
   bool in_flight = has_retransmittable_data == HAS_RETRANSMITTABLE_DATA;
   bool actually_in_flight = in_flight;
-  if (!in_flight && serialized_packet->unreliable) {
+  if (!in_flight && serialized_packet->reliability == UNRELIABLE_PACKET) {
     // Fake this so that the pacer and send algorithm account for the in-flight data.
     has_retransmittable_data = HAS_RETRANSMITTABLE_DATA;
     // Do NOT change the original in_flight bool, because we do not want to reset the retransmission timer for
@@ -861,7 +851,9 @@ void QuicSentPacketManager::InvokeLossDetection(QuicTime time) {
     }
 
     // TODO(ianswett): This could be optimized.
-    if (unacked_packets_.HasRetransmittableFrames(packet.packet_number)) {
+    if (unacked_packets_.GetTransmissionInfo(packet.packet_number)
+                .reliability != UNRELIABLE_PACKET &&
+        unacked_packets_.HasRetransmittableFrames(packet.packet_number)) {
       MarkForRetransmission(packet.packet_number, LOSS_RETRANSMISSION);
     } else {
       // Since we will not retransmit this, we need to remove it from
@@ -1098,6 +1090,10 @@ void QuicSentPacketManager::OnAckRange(QuicPacketNumber start,
   std::cerr << "QuicSentPacketManager::OnAckRange: start:" << start << " end:" << end << std::endl;
   std::cerr << "  packets_acked_ size: " << packets_acked_.size() << std::endl;
 #endif
+  // Ranges arrive in descending order, so every packet up to the largest
+  // acked of an earlier range, of this or a previous ack frame, was already
+  // either acked or considered for a fake ack.
+  const QuicPacketNumber first_unconsidered = last_ack_frame_.largest_acked + 1;
   if (end > last_ack_frame_.largest_acked + 1) {
 #ifdef SLST_DBG
     std::cerr << "  Increasing last_ack_frame.largest_acked from " << last_ack_frame_.largest_acked << " to " << end -1 << std::endl;
@@ -1115,47 +1111,22 @@ void QuicSentPacketManager::OnAckRange(QuicPacketNumber start,
     return;
   }
 
-
-  for(QuicPacketNumber curr = start - 1; curr >= least_unacked; curr--) {
-#ifdef SLST_DBG
-    std::cerr << "  fake_acc for " << curr << "? ";
-#endif
-    auto insert_position = packets_acked_.begin();
-    bool already_acked = false;
-    for(; insert_position != packets_acked_.end(); insert_position++) {
-      if ((*insert_position).packet_number == curr) {
-        already_acked = true;
-        break;
-      } else if ((*insert_position).packet_number < curr) {
-        break;
-      }
-    }
-    if (already_acked) {
-#ifdef SLST_DBG
-      std::cerr << "already acked" << std::endl;
-#endif
-      continue;
-    }
+  // Unreliable packets below an acked range are never retransmitted, so they
+  // are fake acked. The fake_acked flags of the unacked packet map are the
+  // set of fake acks, which keeps this proportional to the newly covered
+  // packets: only the first range of a frame walks, and only above the
+  // previous largest acked.
+  for (QuicPacketNumber curr = std::max(first_unconsidered, least_unacked);
+       curr < start; ++curr) {
     auto *transinfo = unacked_packets_.GetMutableTransmissionInfo(curr);
-    if (transinfo->unreliable && transinfo->state != ACKED) {
+    if (transinfo->reliability == UNRELIABLE_PACKET &&
+        QuicUtils::IsAckable(transinfo->state)) {
 #ifdef SLST_DBG
-      std::cerr << "yes";
+      std::cerr << "  fake_acc for " << curr << std::endl;
 #endif
       transinfo->fake_acked = true;
-      if (insert_position == packets_acked_.end()) {
-        packets_acked_.push_back(AckedPacket(curr, 0, QuicTime::Zero()));
-      } else {
-        packets_acked_.insert(insert_position, AckedPacket(curr, 0, QuicTime::Zero()));
-      }
-    } else {
-#ifdef SLST_DBG
-      std::cerr << "no";
-#endif
+      packets_acked_.push_back(AckedPacket(curr, 0, QuicTime::Zero()));
     }
-#ifdef SLST_DBG
-    std::cerr << " unrel:" << transinfo->unreliable << " state:" << QuicUtils::SentPacketStateToString(transinfo->state);
-    std::cerr << std::endl;
-#endif
   }
 
   start = std::max(start, least_unacked);
@@ -1172,38 +1143,21 @@ void QuicSentPacketManager::OnAckRange(QuicPacketNumber start,
 #endif
     for (QuicPacketNumber acked = end - 1; acked >= newly_acked_start;
          --acked) {
-      // Check if end is above the current range. If so add newly acked packets
-      // in descending order.
-      auto insert_position = packets_acked_.begin();
-      bool already_acked = false;
-      for(; insert_position != packets_acked_.end(); insert_position++) {
-        if ((*insert_position).packet_number == acked) {
-          auto *transinfo = unacked_packets_.GetMutableTransmissionInfo(acked);
+      auto *transinfo = unacked_packets_.GetMutableTransmissionInfo(acked);
+      if (transinfo->fake_acked) {
+        // Fake acked below a higher range of this frame, it is in
+        // packets_acked_ already.
 #ifdef SLST_DBG
-          std::cerr << std::endl;
-          std::cerr << "    Removing fake ack " << acked << std::endl << "    ";
+        std::cerr << std::endl;
+        std::cerr << "    Removing fake ack " << acked << std::endl << "    ";
 #endif
-          transinfo->fake_acked = false;
-          already_acked = true;
-          break;
-        } else if ((*insert_position).packet_number < acked) {
-          break;
-        }
-      }
-      if (already_acked) {
+        transinfo->fake_acked = false;
         continue;
       }
-      if (insert_position == packets_acked_.end()) {
 #ifdef SLST_DBG
-        std::cerr << " " << acked;
+      std::cerr << " " << acked;
 #endif
-        packets_acked_.push_back(AckedPacket(acked, 0, QuicTime::Zero()));
-      } else {
-#ifdef SLST_DBG
-        std::cerr << " " << acked;
-#endif
-        packets_acked_.insert(insert_position, AckedPacket(acked, 0, QuicTime::Zero()));
-      }
+      packets_acked_.push_back(AckedPacket(acked, 0, QuicTime::Zero()));
     }
 #ifdef SLST_DBG
     std::cerr << std::endl;
@@ -1235,8 +1189,12 @@ bool QuicSentPacketManager::OnAckFrameEnd(QuicTime ack_receive_time) {
   std::cerr << "  packets_acked_ size: " << packets_acked_.size() << std::endl;
 #endif
   QuicByteCount prior_bytes_in_flight = unacked_packets_.bytes_in_flight();
-  // Reverse packets_acked_ so that it is in ascending order.
-  reverse(packets_acked_.begin(), packets_acked_.end());
+  // Fake acks were appended between the ranges, sort packets_acked_ into
+  // ascending order.
+  std::sort(packets_acked_.begin(), packets_acked_.end(),
+            [](const AckedPacket& a, const AckedPacket& b) {
+              return a.packet_number < b.packet_number;
+            });
   for (AckedPacket& acked_packet : packets_acked_) {
     QuicTransmissionInfo* info =
         unacked_packets_.GetMutableTransmissionInfo(acked_packet.packet_number);
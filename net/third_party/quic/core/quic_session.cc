@@ -409,8 +409,15 @@ QuicConsumedData QuicSession::WritevData(QuicStream* stream,
   #ifdef SLST_DEBUG 
  std::cout  << "WritevData: stream is unrel: " << stream->get_unreliable() << " on: " << id << "|" << stream->id() <<  std::endl; 
  #endif
+  const bool frame_aligned = !stream->frame_boundaries().empty();
+  if (frame_aligned) {
+    connection_->SetFrameBoundaries(id, &stream->frame_boundaries());
+  }
   QuicConsumedData data =
       connection_->SendStreamData(id, write_length, offset, state, stream->get_unreliable());
+  if (frame_aligned) {
+    connection_->SetFrameBoundaries(id, nullptr);
+  }
   if (offset >= stream->stream_bytes_written()) {
     // This is new stream data.
     write_blocked_streams_.UpdateBytesForStream(id, data.bytes_consumed);
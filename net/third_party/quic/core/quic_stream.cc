@@ -4,6 +4,7 @@
 
 //#define SLST_DEBUG 1
 
+#include <algorithm>
 #include <thread>
 
 #include "net/third_party/quic/core/quic_stream.h"
@@ -308,6 +309,24 @@ void QuicStream::WriteOrBufferData(
   }
 }
 
+void QuicStream::WriteOrBufferData(
+    QuicStringPiece data,
+    bool fin,
+    QuicReferenceCountedPointer<QuicAckListenerInterface> ack_listener,
+    const std::vector<QuicByteCount>& frame_lengths) {
+  // Boundaries of data which is already sent are of no more use.
+  frame_boundaries_.erase(
+      frame_boundaries_.begin(),
+      std::lower_bound(frame_boundaries_.begin(), frame_boundaries_.end(),
+                       stream_bytes_written()));
+  QuicStreamOffset boundary = send_buffer_.stream_offset();
+  for (QuicByteCount frame_length : frame_lengths) {
+    frame_boundaries_.push_back(boundary);
+    boundary += frame_length;
+  }
+  WriteOrBufferData(data, fin, std::move(ack_listener));
+}
+
 void QuicStream::OnCanWrite() {
   if (HasPendingRetransmission()) {
     WritePendingRetransmission();
@@ -20,6 +20,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <list>
+#include <vector>
 
 #include "base/macros.h"
 #include "net/base/iovec.h"
@@ -220,6 +221,18 @@ class QUIC_EXPORT_PRIVATE QuicStream {
       QuicStringPiece data,
       bool fin,
       QuicReferenceCountedPointer<QuicAckListenerInterface> ack_listener);
+  // Same, but |data| is a sequence of video frames of |frame_lengths| bytes,
+  // which the packets are aligned to where that is cheap.
+  void WriteOrBufferData(
+      QuicStringPiece data,
+      bool fin,
+      QuicReferenceCountedPointer<QuicAckListenerInterface> ack_listener,
+      const std::vector<QuicByteCount>& frame_lengths);
+
+  // Stream offsets, ascending, at which video frames start.
+  const std::vector<QuicStreamOffset>& frame_boundaries() const {
+    return frame_boundaries_;
+  }
 
   // Adds random padding after the fin is consumed for this stream.
   void AddRandomPaddingAfterFin();
@@ -356,6 +369,9 @@ class QUIC_EXPORT_PRIVATE QuicStream {
   //defines the amount of redundancy added
   uint8_t fec_;
 
+  // See frame_boundaries().
+  std::vector<QuicStreamOffset> frame_boundaries_;
+
  private:
   friend class test::QuicStreamPeer;
   friend class QuicStreamUtils;
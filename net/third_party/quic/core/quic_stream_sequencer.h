@@ -116,11 +116,11 @@ class QUIC_EXPORT_PRIVATE QuicStreamSequencer {
   // Returns std::string describing internal state.
   const QuicString DebugString() const;
 
-  std::map < QuicStreamOffset, FrameTiming >& get_frame_timings() {
+  const std::map<QuicStreamOffset, FrameTiming>& get_frame_timings() {
     return buffered_frames_.getFtiming();
   }
 
-  uint32_t GetTime() { return buffered_frames_.GetTime(); }
+  QuicTime::Delta GetTime() { return buffered_frames_.GetTime(); }
   double GetThroughput() { return buffered_frames_.GetThroughput(); }
   size_t GetReceived(bool lossy) { return buffered_frames_.GetReceived(lossy); }
   void ResetReceived() { buffered_frames_.ResetReceived(); }
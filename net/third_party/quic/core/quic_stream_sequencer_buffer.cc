@@ -6,6 +6,7 @@
 
 #include "net/third_party/quic/core/quic_stream_sequencer_buffer.h"
 
+#include <algorithm>
 #include <iostream>
 
 #include "base/format_macros.h"
@@ -33,7 +34,107 @@ const size_t kMaxNumDataIntervalsAllowed = 2 * kMaxPacketGap;
 
 }  // namespace
 
+FrameArrivalLog::FrameArrivalLog()
+    : size_(0),
+      received_size_(0),
+      lossy_received_size_(0),
+      earliest_(QuicTime::Zero()),
+      latest_(QuicTime::Zero()),
+      indexed_(0) {}
 
+FrameArrivalLog::~FrameArrivalLog() = default;
+
+void FrameArrivalLog::Append(QuicStreamOffset offset,
+                             const FrameTiming& timing) {
+  Add(offset, timing, /*fills_hole=*/false);
+}
+
+void FrameArrivalLog::AppendHoleFill(QuicStreamOffset offset,
+                                     const FrameTiming& timing) {
+  Add(offset, timing, /*fills_hole=*/true);
+  lossy_received_size_ -= timing.length;
+}
+
+void FrameArrivalLog::Add(QuicStreamOffset offset,
+                          const FrameTiming& timing,
+                          bool fills_hole) {
+  const size_t chunk = size_ / kArrivalsPerChunk;
+  if (chunk == chunks_.size()) {
+    chunks_.emplace_back(new Chunk);
+  }
+  chunks_[chunk]->arrivals[size_ % kArrivalsPerChunk] = {
+      offset, (timing.qt - QuicTime::Zero()).ToMicroseconds(), timing.length,
+      timing.was_lost, fills_hole};
+
+  if (size_ == 0 || timing.qt < earliest_) {
+    earliest_ = timing.qt;
+  }
+  if (timing.qt > latest_) {
+    latest_ = timing.qt;
+  }
+  if (!timing.was_lost) {
+    received_size_ += timing.length;
+  }
+  lossy_received_size_ += timing.length;
+  ++size_;
+}
+
+void FrameArrivalLog::Clear() {
+  size_ = 0;
+  received_size_ = 0;
+  lossy_received_size_ = 0;
+  earliest_ = QuicTime::Zero();
+  latest_ = QuicTime::Zero();
+  by_offset_.clear();
+  indexed_ = 0;
+}
+
+const std::map<QuicStreamOffset, FrameTiming>& FrameArrivalLog::ByOffset() {
+  for (; indexed_ < size_; ++indexed_) {
+    const Arrival& arrival =
+        chunks_[indexed_ / kArrivalsPerChunk]
+            ->arrivals[indexed_ % kArrivalsPerChunk];
+    const FrameTiming timing = {
+        QuicTime::Zero() + QuicTime::Delta::FromMicroseconds(arrival.time_us),
+        arrival.length, arrival.was_lost};
+    if (arrival.fills_hole) {
+      IndexHoleFill(arrival.offset, timing);
+    } else {
+      by_offset_.insert(std::make_pair(arrival.offset, timing));
+    }
+  }
+  return by_offset_;
+}
+
+void FrameArrivalLog::IndexHoleFill(QuicStreamOffset offset,
+                                    const FrameTiming& timing) {
+  const QuicStreamOffset end = offset + timing.length;
+  auto lost = by_offset_.upper_bound(offset);
+  if (lost == by_offset_.begin()) {
+    by_offset_.insert(std::make_pair(offset, timing));
+    return;
+  }
+  --lost;
+  const QuicStreamOffset lost_start = lost->first;
+  const FrameTiming lost_timing = lost->second;
+  const QuicStreamOffset lost_end = lost_start + lost_timing.length;
+  if (!lost_timing.was_lost || lost_end < end) {
+    by_offset_.insert(std::make_pair(offset, timing));
+    return;
+  }
+  // Holes are filled piece by piece, so the lost record is cut into the lost
+  // bytes in front of the fill, the fill and the lost bytes after it.
+  if (lost_start < offset) {
+    lost->second.length = offset - lost_start;
+    by_offset_.insert(std::make_pair(offset, timing));
+  } else {
+    lost->second = timing;
+  }
+  if (end < lost_end) {
+    by_offset_.insert(std::make_pair(
+        end, FrameTiming{lost_timing.qt, lost_end - end, true}));
+  }
+}
 
 QuicStreamSequencerBuffer::QuicStreamSequencerBuffer(size_t max_capacity_bytes)
     : max_buffer_capacity_bytes_(max_capacity_bytes),
@@ -41,7 +142,6 @@ QuicStreamSequencerBuffer::QuicStreamSequencerBuffer(size_t max_capacity_bytes)
       total_bytes_read_(0),
       blocks_(nullptr) {
   Clear();
-  //std::map < QuicStreamOffset, FrameTiming > ftiming = std::map < QuicStreamOffset, FrameTiming >();
 }
 
 QuicStreamSequencerBuffer::~QuicStreamSequencerBuffer() {
@@ -59,6 +159,7 @@ void QuicStreamSequencerBuffer::Clear() {
   num_bytes_buffered_ = 0;
   bytes_received_.Clear();
   bytes_received_.Add(0, total_bytes_read_);
+  holes_.Clear();
 }
 
 bool QuicStreamSequencerBuffer::RetireBlock(size_t idx) {
@@ -112,78 +213,51 @@ QuicErrorCode QuicStreamSequencerBuffer::OnStreamData(
       // if this is more efficient than Add.
       const_cast<QuicInterval<QuicPacketNumber>*>(&(*bytes_received_.rbegin()))
           ->SetMax(starting_offset + size);
-    } else {
-      if ( unreliable && bytes_received_.Size() == 1 )
-      {
-        size_t len = starting_offset - bytes_received_.begin()->max();
+    } else if (unreliable && starting_offset > NextExpectedByte()) {
+      // Unreliable data is never retransmitted, so the reader must not wait
+      // for the gap in front of it. The gap counts as received and becomes a
+      // hole, which late data may still fill until the read cursor passes it.
+      const QuicStreamOffset hole_start = NextExpectedByte();
+      const size_t len = starting_offset - hole_start;
 #ifdef SLST_DBG
-        std::cerr << "  Filling hole in the middle of the stream\n";
-        std::cerr << "  Current bytes_received range: " << bytes_received_.begin()->min() << " " << bytes_received_.begin()->max() << "\n";
-        std::cerr << "  New starting offset: " << starting_offset << "\n";
-        std::cerr << "  Hole size: " << len << "\n";
+      std::cerr << "  Hole in the stream: " << hole_start << " - "
+                << starting_offset << " holes: " << holes_.Size() + 1 << "\n";
 #endif
-        //bytes_received_.Clear();
-        const_cast<QuicInterval<QuicPacketNumber>*>(&(*bytes_received_.rbegin()))
-        ->SetMax(starting_offset + size);
-#ifdef SLST_DBG
-        std::cerr << "  New bytes_received range: " << bytes_received_.begin()->min() << " " << bytes_received_.begin()->max() << std::endl;
-#endif
-
-        if (!CopyStreamDataZero(starting_offset - len, len, error_details)) {
-          return QUIC_STREAM_SEQUENCER_INVALID_STATE;
-        }
-        *padded += len;;
-        ftiming.insert( std::pair<QuicStreamOffset, FrameTiming>(starting_offset - len, {qt, len, true}) );
-        Calculate_Throughput();
-        *bytes_buffered += len;
-      } else if (unreliable && bytes_received_.Size() > 1) {
-        std::cerr << "UNRELIABLE STREAM BUT MORE THAN ONE BYTES RECEIVED RANGE. EXITING" << std::endl;
-        exit(-6);
+      if (!ReserveBlocks(hole_start, len, error_details)) {
+        return QUIC_STREAM_SEQUENCER_INVALID_STATE;
       }
-      else
-      {
-        if (unreliable && starting_offset > 0)
-        {
-#ifdef SLST_DBG
-          std::cerr << "  Filling hole at the beginning of the stream\n";
-          std::cerr << "  Hole size: " << starting_offset << "\n";
-#endif
-            if (!CopyStreamDataZero(0, starting_offset, error_details)) {
-              return QUIC_STREAM_SEQUENCER_INVALID_STATE;
-            }
-            *padded += starting_offset;
-            ftiming.insert( std::pair<QuicStreamOffset, FrameTiming>(0, {qt, starting_offset, true}) );
-            Calculate_Throughput();
-            *bytes_buffered += starting_offset;
-
-            bytes_received_.Add(0, starting_offset + size);
-#ifdef SLST_DBG
-          std::cerr << "  New bytes_received range: " << bytes_received_.begin()->min() << " " << bytes_received_.begin()->max() << std::endl;
-#endif
-        }
-        else {
-          bytes_received_.Add(starting_offset, starting_offset + size);
-        }
-
-        #ifdef SLST_DEBUG 
-        if (unreliable)
-          std::cerr << "OnStreamData: bytes_received_(" <<  bytes_received_.Size() << ")" << std::endl;
-        #endif
+      holes_.Add(hole_start, starting_offset);
+      bytes_received_.Add(hole_start, starting_offset + size);
+      *padded += len;
+      RecordArrival(hole_start, {qt, len, true}, /*fills_hole=*/false);
+      *bytes_buffered += len;
+
+      if (holes_.Size() > kMaxNumDataIntervalsAllowed) {
+        // Too much reordering to keep waiting for the oldest hole.
+        const QuicStreamOffset oldest_end = holes_.begin()->max();
+        ZeroFillHoles(oldest_end);
+        holes_.Difference(0, oldest_end);
       }
+    } else {
+      bytes_received_.Add(starting_offset, starting_offset + size);
+#ifdef SLST_DEBUG
+      if (unreliable)
+        std::cerr << "OnStreamData: bytes_received_(" <<  bytes_received_.Size() << ")" << std::endl;
+#endif
+    }
 
-      if (bytes_received_.Size() >= kMaxNumDataIntervalsAllowed) {
-        // This frame is going to create more intervals than allowed. Stop
-        // processing.
-        *error_details = "Too many data intervals received for this stream.";
-        return QUIC_TOO_MANY_STREAM_DATA_INTERVALS;
-      }
+    if (bytes_received_.Size() >= kMaxNumDataIntervalsAllowed) {
+      // This frame is going to create more intervals than allowed. Stop
+      // processing.
+      *error_details = "Too many data intervals received for this stream.";
+      return QUIC_TOO_MANY_STREAM_DATA_INTERVALS;
     }
     size_t bytes_copy = 0;
     if (!CopyStreamData(starting_offset, data, &bytes_copy, error_details)) {
       return QUIC_STREAM_SEQUENCER_INVALID_STATE;
     }
-    ftiming.insert( std::pair<QuicStreamOffset, FrameTiming>(starting_offset, {qt, data.size(), false}) );
-    Calculate_Throughput();
+    RecordArrival(starting_offset, {qt, data.size(), false},
+                  /*fills_hole=*/false);
     *bytes_buffered += bytes_copy;
     num_bytes_buffered_ += *bytes_buffered;
 #ifdef SLST_DBG
@@ -196,6 +270,39 @@ QuicErrorCode QuicStreamSequencerBuffer::OnStreamData(
   QuicIntervalSet<QuicStreamOffset> newly_received(starting_offset,
                                                    starting_offset + size);
   newly_received.Difference(bytes_received_);
+  if (!holes_.Empty() &&
+      !holes_.IsDisjoint(QuicInterval<QuicStreamOffset>(
+          starting_offset, starting_offset + size))) {
+    // Late data for holes the read cursor has not passed yet. Only the bytes
+    // that fall into a hole are new, the ones around them were received.
+    QuicIntervalSet<QuicStreamOffset> filled(
+        std::max(starting_offset, total_bytes_read_), starting_offset + size);
+    filled.Intersection(holes_);
+    size_t bytes_filled = 0;
+    for (const auto& interval : filled) {
+      size_t bytes_copy = 0;
+      if (!CopyStreamData(interval.min(),
+                          data.substr(interval.min() - starting_offset,
+                                      interval.max() - interval.min()),
+                          &bytes_copy, error_details)) {
+        return QUIC_STREAM_SEQUENCER_INVALID_STATE;
+      }
+      holes_.Difference(interval.min(), interval.max());
+      RecordArrival(interval.min(), {qt, bytes_copy, false},
+                    /*fills_hole=*/true);
+      bytes_filled += bytes_copy;
+#ifdef SLST_DBG
+      std::cerr << "  Filled hole: " << interval.min() << " - "
+                << interval.max() << " holes left: " << holes_.Size() << "\n";
+#endif
+    }
+    if (newly_received.Empty()) {
+      // Not a duplicate, but the hole was already counted in
+      // |num_bytes_buffered_| when it opened.
+      *bytes_buffered = bytes_filled;
+      return QUIC_NO_ERROR;
+    }
+  }
   if (newly_received.Empty()) {
     return QUIC_NO_ERROR;
   }
@@ -215,8 +322,7 @@ QuicErrorCode QuicStreamSequencerBuffer::OnStreamData(
                         &bytes_copy, error_details)) {
       return QUIC_STREAM_SEQUENCER_INVALID_STATE;
     }
-    ftiming.insert( std::pair<QuicStreamOffset, FrameTiming>(copy_offset, {qt, copy_length, false}) );
-    Calculate_Throughput();
+    RecordArrival(copy_offset, {qt, copy_length, false}, /*fills_hole=*/false);
     *bytes_buffered += bytes_copy;
   }
   num_bytes_buffered_ += *bytes_buffered;
@@ -226,56 +332,73 @@ QuicErrorCode QuicStreamSequencerBuffer::OnStreamData(
   return QUIC_NO_ERROR;
 }
 
-void QuicStreamSequencerBuffer::Calculate_Throughput() {
-  received_size_ = 0;
-  lossy_received_size_ = 0;
-  std::map < quic::QuicStreamOffset, quic::FrameTiming >::iterator quic_frame_it = ftiming.begin();
-
-  QuicTime earliest = QuicTime::Zero();
-  QuicTime latest = QuicTime::Zero();
-  bool earliest_initialized = false;
-  for (; quic_frame_it != ftiming.end(); ++quic_frame_it) {
-    received_size_ += (quic_frame_it->second.was_lost) ? 0 : quic_frame_it->second.length;
-    lossy_received_size_ += quic_frame_it->second.length;
-    if (!earliest_initialized || quic_frame_it->second.qt < earliest) {
-      earliest = quic_frame_it->second.qt;
-      earliest_initialized = true;
-    }
-    if (quic_frame_it->second.qt > latest) {
-      latest = quic_frame_it->second.qt;
-    }
+void QuicStreamSequencerBuffer::RecordArrival(QuicStreamOffset offset,
+                                               const FrameTiming& timing,
+                                               bool fills_hole) {
+  if (fills_hole) {
+    arrivals_.AppendHoleFill(offset, timing);
+  } else {
+    arrivals_.Append(offset, timing);
   }
 
-  time_ = (latest - earliest).ToMilliseconds();
-  if (time_ != 0 && ftiming.size() > 1)
-    // bits / ms === kbps / s
-    throughput_ = (received_size_ * 8) / time_;
+  const int64_t span_us = arrivals_.span().ToMicroseconds();
+  if (span_us > 0 && arrivals_.size() > 1)
+    // bits / us * 1000 === kbps
+    throughput_ = (arrivals_.received_size() * 8 * 1000.0) / span_us;
   else
     throughput_ = 0.0;
-      
- //std::cerr << "throughput: " << throughput_ << std::endl;
-
-  
 }
 
-bool QuicStreamSequencerBuffer::CopyStreamDataZero(QuicStreamOffset offset,
-                                               size_t bytes_to_copy,
-                                               QuicString* error_details) {
-  #ifdef SLST_DEBUG 
- std::cout  << "CopyStreamDataZero called with: " << offset << " length: " <<  bytes_to_copy <<  std::endl; 
- #endif
-  QuicString buf;
-  buf.insert(0, bytes_to_copy, '\0');
-  
-  size_t dummy;
-  auto ret = CopyStreamData(offset, buf, &dummy, error_details);
-  #ifdef SLST_DEBUG 
- std::cout  << "written: " << ret <<  std::endl; 
- #endif
+bool QuicStreamSequencerBuffer::ReserveBlocks(QuicStreamOffset offset,
+                                              size_t length,
+                                              QuicString* error_details) {
+  if (blocks_ == nullptr) {
+    blocks_.reset(new BufferBlock*[blocks_count_]());
+  }
+  const QuicStreamOffset end = offset + length;
+  while (offset < end) {
+    const size_t block_idx = GetBlockIndex(offset);
+    if (block_idx >= blocks_count_) {
+      *error_details = QuicStrCat(
+          "QuicStreamSequencerBuffer error: ReserveBlocks() exceed array "
+          "bounds. offset = ",
+          offset, " block_idx = ", block_idx, " blocks_count_ = ",
+          blocks_count_);
+      return false;
+    }
+    if (blocks_[block_idx] == nullptr) {
+      blocks_[block_idx] = new BufferBlock();
+    }
+    offset += GetBlockCapacity(block_idx) - GetInBlockOffset(offset);
+  }
+  return true;
+}
 
-  return ret;
+void QuicStreamSequencerBuffer::ZeroFillHoles(QuicStreamOffset end) const {
+  for (const auto& hole : holes_) {
+    if (hole.min() >= end) {
+      break;
+    }
+    QuicStreamOffset offset = std::max(hole.min(), total_bytes_read_);
+    const QuicStreamOffset zero_end = std::min(hole.max(), end);
+    while (offset < zero_end) {
+      const size_t block_idx = GetBlockIndex(offset);
+      const size_t offset_in_block = GetInBlockOffset(offset);
+      const size_t bytes_to_zero = std::min<size_t>(
+          GetBlockCapacity(block_idx) - offset_in_block, zero_end - offset);
+      // Reserved when the hole was opened.
+      DCHECK_NE(static_cast<BufferBlock*>(nullptr), blocks_[block_idx]);
+      memset(blocks_[block_idx]->buffer + offset_in_block, 0, bytes_to_zero);
+      offset += bytes_to_zero;
+    }
+  }
 }
 
+void QuicStreamSequencerBuffer::DropReadHoles() {
+  if (!holes_.Empty() && holes_.begin()->min() < total_bytes_read_) {
+    holes_.Difference(0, total_bytes_read_);
+  }
+}
 
 bool QuicStreamSequencerBuffer::CopyStreamData(QuicStreamOffset offset,
                                                QuicStringPiece data,
@@ -374,6 +497,14 @@ QuicErrorCode QuicStreamSequencerBuffer::Readv(const iovec* dest_iov,
 #endif
 
   *bytes_read = 0;
+  if (!holes_.Empty()) {
+    size_t dest_size = 0;
+    for (size_t i = 0; i < dest_count; ++i) {
+      dest_size += dest_iov[i].iov_len;
+    }
+    ZeroFillHoles(total_bytes_read_ +
+                  std::min<size_t>(ReadableBytes(), dest_size));
+  }
   for (size_t i = 0; i < dest_count && ReadableBytes() > 0; ++i) {
     char* dest = reinterpret_cast<char*>(dest_iov[i].iov_base);
     CHECK_NE(dest, nullptr);
@@ -426,6 +557,7 @@ QuicErrorCode QuicStreamSequencerBuffer::Readv(const iovec* dest_iov,
       }
     }
   }
+  DropReadHoles();
 
   return QUIC_NO_ERROR;
 }
@@ -446,6 +578,13 @@ int QuicStreamSequencerBuffer::GetReadableRegions(struct iovec* iov,
     return 0;
   }
 
+  if (!holes_.Empty()) {
+    // At most |iov_count| blocks are handed out.
+    ZeroFillHoles(std::min<QuicStreamOffset>(
+        FirstMissingByte(),
+        total_bytes_read_ - ReadOffset() + iov_count * kBlockSizeBytes));
+  }
+
   size_t start_block_idx = NextBlockToRead();
   QuicStreamOffset readable_offset_end = FirstMissingByte() - 1;
   DCHECK_GE(readable_offset_end + 1, total_bytes_read_);
@@ -535,6 +674,7 @@ bool QuicStreamSequencerBuffer::MarkConsumed(size_t bytes_used) {
       RetireBlockIfEmpty(block_idx);
     }
   }
+  DropReadHoles();
   return true;
 }
 
@@ -573,24 +713,26 @@ bool QuicStreamSequencerBuffer::FillHoles() {
  std::cout  << "FillHoles called" <<  std::endl; 
  #endif
 
+  // The first gap becomes a hole, so the data behind it can be read.
   if (bytes_received_.Size() > 1) {
     auto it = bytes_received_.begin();
-    ++it; 
-    auto max = it->max();
-    bytes_received_.Clear();
-    bytes_received_.Add(0, max);
+    const QuicStreamOffset gap_start = it->max();
+    ++it;
+    const QuicStreamOffset gap_end = it->min();
+    QuicString error_details;
+    if (!ReserveBlocks(gap_start, gap_end - gap_start, &error_details)) {
+      QUIC_BUG << error_details;
+      return false;
+    }
+    holes_.Add(gap_start, gap_end);
+    bytes_received_.Add(gap_start, gap_end);
+    num_bytes_buffered_ += gap_end - gap_start;
   }
 
   #ifdef SLST_DEBUG 
- std::cout  << " updated intervals: " <<  std::endl; 
+ std::cout  << " updated intervals: " << bytes_received_.ToString()
+            << " holes: " << holes_.ToString() <<  std::endl; 
  #endif
-    auto it = bytes_received_.begin();
-  while (it != bytes_received_.end()){
-    #ifdef SLST_DEBUG 
- std::cout  << it->min() << " - "  << it->max() <<  std::endl; 
- #endif
-    ++it;
-  }
 
   return true;
 }
@@ -14,6 +14,8 @@
 // without expensive copying (extra blocks are allocated).
 // - Data can be read from the buffer if there is no gap before it,
 // and the buffer shrinks as the data are consumed.
+// - On unreliable streams a gap does not stop reading: it becomes a hole
+//   that reads as zeros, unless its data arrives before it is read.
 // - An upper limit on the number of blocks in the buffer provides an upper
 //   bound on memory use.
 //
@@ -61,7 +63,9 @@
 #include <cstddef>
 #include <functional>
 #include <list>
+#include <map>
 #include <memory>
+#include <vector>
 
 #include "base/macros.h"
 #include "net/third_party/quic/core/quic_packets.h"
@@ -85,6 +89,70 @@ typedef struct {
   std::string print();
 } FrameTiming;
 
+// Append-only log of frame arrivals in the order they were buffered.
+//
+// Records live in fixed size chunks that are kept across Clear(), so a
+// stream allocates while its first segment arrives and then only appends.
+// The received and lossy sizes and the arrival time span are running totals,
+// updated in O(1) per frame. The offset ordered view the loss mapping needs
+// is built on demand from the records added since the last call.
+class QUIC_EXPORT_PRIVATE FrameArrivalLog {
+ public:
+  FrameArrivalLog();
+  FrameArrivalLog(const FrameArrivalLog&) = delete;
+  FrameArrivalLog& operator=(const FrameArrivalLog&) = delete;
+  ~FrameArrivalLog();
+
+  void Append(QuicStreamOffset offset, const FrameTiming& timing);
+  // Late data for bytes already logged as lost: counts as received, but not
+  // a second time in the lossy size.
+  void AppendHoleFill(QuicStreamOffset offset, const FrameTiming& timing);
+  // Forgets all records and totals, keeps the chunks.
+  void Clear();
+
+  size_t size() const { return size_; }
+  size_t received_size() const { return received_size_; }
+  size_t lossy_received_size() const { return lossy_received_size_; }
+  // Time between the earliest and the latest arrival.
+  QuicTime::Delta span() const { return latest_ - earliest_; }
+
+  // Arrivals ordered by offset. Of records with the same offset the first
+  // one is kept, except that a hole fill replaces the part of the lost
+  // record it covers.
+  const std::map<QuicStreamOffset, FrameTiming>& ByOffset();
+
+ private:
+  // QuicTime has no default constructor, arrivals are kept as plain
+  // values so chunks can be allocated uninitialized.
+  struct Arrival {
+    QuicStreamOffset offset;
+    int64_t time_us;
+    size_t length;
+    bool was_lost;
+    bool fills_hole;
+  };
+  static const size_t kArrivalsPerChunk = 512;
+  struct Chunk {
+    Arrival arrivals[kArrivalsPerChunk];
+  };
+
+  void Add(QuicStreamOffset offset, const FrameTiming& timing,
+           bool fills_hole);
+  // Puts |timing| over the lost record in |by_offset_| that covers it.
+  void IndexHoleFill(QuicStreamOffset offset, const FrameTiming& timing);
+
+  std::vector<std::unique_ptr<Chunk>> chunks_;
+  size_t size_;
+  size_t received_size_;
+  size_t lossy_received_size_;
+  QuicTime earliest_;
+  QuicTime latest_;
+
+  std::map<QuicStreamOffset, FrameTiming> by_offset_;
+  // Records already in |by_offset_|.
+  size_t indexed_;
+};
+
 
 class QUIC_EXPORT_PRIVATE QuicStreamSequencerBuffer {
  public:
@@ -100,13 +168,11 @@ class QUIC_EXPORT_PRIVATE QuicStreamSequencerBuffer {
     char buffer[kBlockSizeBytes];
   };
 
-  std::map < QuicStreamOffset, FrameTiming > ftiming;
-
-  std::map < QuicStreamOffset, FrameTiming >& getFtiming() { return ftiming; };
+  const std::map<QuicStreamOffset, FrameTiming>& getFtiming() { return arrivals_.ByOffset(); }
   double GetThroughput() { return throughput_; }
-  uint32_t GetTime()  { return time_; }
-  size_t GetReceived(bool lossy) { return (lossy ? lossy_received_size_ : received_size_); }
-  void ResetReceived() { received_size_ = 0; ftiming.clear(); }
+  QuicTime::Delta GetTime()  { return arrivals_.span(); }
+  size_t GetReceived(bool lossy) { return (lossy ? arrivals_.lossy_received_size() : arrivals_.received_size()); }
+  void ResetReceived() { arrivals_.Clear(); throughput_ = 0.0; }
 
   explicit QuicStreamSequencerBuffer(size_t max_capacity_bytes);
   QuicStreamSequencerBuffer(const QuicStreamSequencerBuffer&) = delete;
@@ -190,9 +256,20 @@ class QUIC_EXPORT_PRIVATE QuicStreamSequencerBuffer {
                       size_t* bytes_copy,
                       QuicString* error_details);
 
-  bool CopyStreamDataZero(QuicStreamOffset offset,
-                      size_t bytes_to_copy,
-                      QuicString* error_details);
+  // Allocates the blocks covering [offset, offset + length) without writing
+  // to them, so a hole can be read once the read cursor reaches it. Returns
+  // false and sets |error_details| if the range is out of bounds.
+  bool ReserveBlocks(QuicStreamOffset offset,
+                     size_t length,
+                     QuicString* error_details);
+
+  // Writes zeros into what is left of the holes below |end|. Holes stay
+  // tracked until the read cursor passes them, so data arriving in between
+  // still replaces the zeros.
+  void ZeroFillHoles(QuicStreamOffset end) const;
+
+  // Forgets the holes, or parts of them, the read cursor has passed.
+  void DropReadHoles();
 
   // Dispose the given buffer block.
   // After calling this method, blocks_[index] is set to nullptr
@@ -257,12 +334,19 @@ class QUIC_EXPORT_PRIVATE QuicStreamSequencerBuffer {
   // Currently received data.
   QuicIntervalSet<QuicStreamOffset> bytes_received_;
 
-  void Calculate_Throughput();
+  // Ranges of |bytes_received_| that were skipped on unreliable streams and
+  // have not arrived yet. They read as zeros.
+  QuicIntervalSet<QuicStreamOffset> holes_;
+
+  // Logs the frame and updates the throughput from the running totals.
+  // |fills_hole| is set for late data in a hole that was logged as lost.
+  void RecordArrival(QuicStreamOffset offset,
+                     const FrameTiming& timing,
+                     bool fills_hole);
 
+  FrameArrivalLog arrivals_;
+  // kbps over the arrival span.
   double throughput_ = 0.0;
-  uint32_t time_ = 0;
-  size_t received_size_ = 0;
-  size_t lossy_received_size_ = 0;
 
 };
 }  // namespace quic
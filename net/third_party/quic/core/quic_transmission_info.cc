@@ -18,9 +18,9 @@ QuicTransmissionInfo::QuicTransmissionInfo()
       num_padding_bytes(0),
       retransmission(0),
       largest_acked(0),
-      unreliable(false),
       fake_acked(false),
-      loss_considered(false) {}
+      loss_considered(false),
+      reliability(RELIABLE_PACKET) {}
 
 QuicTransmissionInfo::QuicTransmissionInfo(
     EncryptionLevel level,
@@ -41,9 +41,9 @@ QuicTransmissionInfo::QuicTransmissionInfo(
       num_padding_bytes(num_padding_bytes),
       retransmission(0),
       largest_acked(0),
-      unreliable(false),
       fake_acked(false),
-      loss_considered(false) {}
+      loss_considered(false),
+      reliability(RELIABLE_PACKET) {}
 
 QuicTransmissionInfo::QuicTransmissionInfo(const QuicTransmissionInfo& other) =
     default;
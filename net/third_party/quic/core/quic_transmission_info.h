@@ -9,6 +9,7 @@
 
 #include "net/third_party/quic/core/frames/quic_frame.h"
 #include "net/third_party/quic/core/quic_ack_listener_interface.h"
+#include "net/third_party/quic/core/quic_packets.h"
 #include "net/third_party/quic/core/quic_types.h"
 #include "net/third_party/quic/platform/api/quic_export.h"
 
@@ -53,10 +54,12 @@ struct QUIC_EXPORT_PRIVATE QuicTransmissionInfo {
   QuicPacketNumber retransmission;
   // The largest_acked in the ack frame, if the packet contains an ack.
   QuicPacketNumber largest_acked;
-  bool unreliable;
   QuicFrames unreliable_frames;
   bool fake_acked;
   bool loss_considered;
+  // Set by the packet creator, so that loss handling need not look at the
+  // frames.
+  PacketReliability reliability;
 };
 // TODO(ianswett): Add static_assert when size of this struct is reduced below
 // 64 bytes.
@@ -50,8 +50,8 @@ void QuicUnackedPacketMap::AddSentPacket(SerializedPacket* packet,
   QuicTransmissionInfo info(
       packet->encryption_level, packet->packet_number_length, transmission_type,
       sent_time, bytes_sent, has_crypto_handshake, packet->num_padding_bytes);
-  info.unreliable = packet->unreliable;
   info.fake_acked = packet->fake_acked;
+  info.reliability = packet->reliability;
   info.largest_acked = packet->largest_acked;
   largest_sent_largest_acked_ =
       std::max(largest_sent_largest_acked_, packet->largest_acked);
@@ -64,12 +64,12 @@ void QuicUnackedPacketMap::AddSentPacket(SerializedPacket* packet,
   if (set_in_flight) {
     bytes_in_flight_ += bytes_sent;
     info.in_flight = true;
-    if (!packet->unreliable) {
+    if (packet->reliability != UNRELIABLE_PACKET) {
       largest_sent_retransmittable_packet_ = packet_number;
     }
   }
 #ifdef SLST_DBG
-  std::cerr << "QuicUnackedPacketMap::AddSentPacket: packet: " << packet_number << " unrel: " << packet->unreliable << std::endl;
+  std::cerr << "QuicUnackedPacketMap::AddSentPacket: packet: " << packet_number << " reliability: " << static_cast<int>(packet->reliability) << std::endl;
 #endif
   unacked_packets_.push_back(info);
   // Swap the retransmittable frames to avoid allocations.
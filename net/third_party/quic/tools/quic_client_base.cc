@@ -2,13 +2,18 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
 #include <chrono>
 #include "net/third_party/quic/tools/quic_client_base.h"
 
+#include "base/location.h"
+#include "base/run_loop.h"
+#include "base/threading/thread_task_runner_handle.h"
 #include "net/third_party/quic/core/crypto/quic_random.h"
 #include "net/third_party/quic/core/http/spdy_utils.h"
 #include "net/third_party/quic/core/quic_server_id.h"
 #include "net/third_party/quic/core/tls_client_handshaker.h"
+#include "net/third_party/quic/platform/api/quic_clock.h"
 #include "net/third_party/quic/platform/api/quic_flags.h"
 #include "net/third_party/quic/platform/api/quic_logging.h"
 #include "net/third_party/quic/platform/api/quic_text_utils.h"
@@ -22,6 +27,16 @@ std::unordered_map<std::string,std::string> feature_map;
 
 namespace quic {
 
+class QuicClientBase::AbandonCheckAlarmDelegate : public QuicAlarm::Delegate {
+ public:
+  explicit AbandonCheckAlarmDelegate(QuicClientBase* client)
+      : client_(client) {}
+
+  void OnAlarm() override { client_->OnAbandonCheckAlarm(); }
+
+ private:
+  QuicClientBase* client_;
+};
 
 QuicClientBase::NetworkHelper::~NetworkHelper() = default;
 
@@ -47,7 +62,12 @@ QuicClientBase::QuicClientBase(
       num_sent_client_hellos_(0),
       connection_error_(QUIC_NO_ERROR),
       connected_or_attempting_connect_(false),
-      network_helper_(std::move(network_helper)) {}
+      network_helper_(std::move(network_helper)),
+      abandon_check_interval_(
+          QuicTime::Delta::FromMilliseconds(kAbandonCheckInterval)),
+      abandon_tick_due_(false),
+      blocking_event_loop_(false),
+      event_loop_woken_(false) {}
 
 QuicClientBase::~QuicClientBase() = default;
 
@@ -87,7 +107,7 @@ bool QuicClientBase::Connect() {
          GetNumSentClientHellos() <= QuicCryptoClientStream::kMaxClientHellos) {
     StartConnect();
     while (EncryptionBeingEstablished()) {
-      WaitForEvents(nullptr, nullptr);
+      WaitForEvents();
     }
     if (GetQuicReloadableFlag(enable_quic_stateless_reject_support) &&
         connected()) {
@@ -168,46 +188,84 @@ bool QuicClientBase::EncryptionBeingEstablished() {
          session_->connection()->connected();
 }
 
-bool QuicClientBase::WaitForEvents(QuicSpdyClientStream* stream, DownloadConfig *dc) {
-  return WaitForEvents(stream, dc, /*idle_check*/false);
-}
+bool QuicClientBase::WaitForEvents() {
+  DCHECK(connected());
 
-void QuicClientBase::Reset() {
-  remaining_time = 0;
-  remaining_size = 0;
-  lossy_remaining_size = 0;
-  rem_dl_time = 0;
-  rem_fb_time = 0;
-  target_time = 0;
-  current_throughput = 0;
-  calculated_threshold = 0;
+  network_helper_->RunEventLoop();
+
+  DCHECK(session() != nullptr);
+  if (!connected() &&
+      session()->error() == QUIC_CRYPTO_HANDSHAKE_STATELESS_REJECT) {
+    DCHECK(GetQuicReloadableFlag(enable_quic_stateless_reject_support));
+    QUIC_DLOG(INFO) << "Detected stateless reject while waiting for events.  "
+                    << "Attempting to reconnect.";
+    Connect();
+  }
+
+  return session()->num_active_requests() != 0;
+}
+
+InFlightDownload QuicClientBase::StartDownload(
+    QuicSpdyClientStream* stream,
+    DownloadConfig *dc,
+    std::chrono::steady_clock::time_point start_time) {
+  InFlightDownload download = {};
+  download.stream = stream;
+  download.id = stream->id();
+  download.dc = dc;
+  download.start_time = start_time;
+  download.idle_time = std::chrono::steady_clock::now();
+  if (dc != nullptr) {
+    download.print_helper = dc->size;
+    if (dc->body_destination != nullptr) {
+      stream->SetBodyDestination(dc->body_destination,
+                                 dc->body_destination_length, dc->body_scatter);
+    }
+    stream->SetReceivedStepListener(dc->size / kAbandonCheckSteps, this);
+    if (abandon_alarm_ == nullptr) {
+      abandon_alarm_.reset(
+          alarm_factory()->CreateAlarm(new AbandonCheckAlarmDelegate(this)));
+    }
+    if (!abandon_alarm_->IsSet()) {
+      abandon_alarm_->Set(helper()->GetClock()->Now() + abandon_check_interval_);
+    }
+  }
+  StartAbandonEvaluation(&download);
+  return download;
 }
 
 const double ABANDON_MULTIPLIER = 1.8;
+// ms
 const int GRACE_TIME_THRESHOLD = 500;
 const int MIN_LENGTH_TO_AVERAGE = 5;
 const double kBandwidthSafetyFactor = 0.9;
 
-bool QuicClientBase::bola_shouldAbandon(size_t received, int32_t time, DownloadConfig *dc) {
-  
-  if (dc->buffer_occ > 12000) {
+bool QuicClientBase::bola_shouldAbandon(InFlightDownload* download, size_t received, int64_t time_us, bool sample) {
+  DownloadConfig *dc = download->dc;
+
+  if (dc->buffer_occ_us > 12000 * 1000) {
     return false;
   }
-  bola_throughput.push_back(received * 8 / time);
+  // bits / us * 1000 === kbps
+  if (sample) {
+    download->bola_throughput_sum += received * 8 * 1000.0 / std::max<int64_t>(time_us, 1);
+    ++download->bola_throughput_count;
+  }
 
-  if (bola_throughput.size() >= MIN_LENGTH_TO_AVERAGE && time > GRACE_TIME_THRESHOLD && received < dc->size) {
+  if (download->bola_throughput_count >= MIN_LENGTH_TO_AVERAGE && time_us > GRACE_TIME_THRESHOLD * 1000 && received < dc->size) {
 
-    double totalSampledValue = accumulate(bola_throughput.begin(), bola_throughput.end(), 0);
-    double measuredBandwidthInKbps = std::round(totalSampledValue / bola_throughput.size());
+    double measuredBandwidthInKbps = std::round(download->bola_throughput_sum / download->bola_throughput_count);
     // bit / kbps = ks = ms == size * 8 / 1000 * 1000
     double estimatedTimeOfDownload = dc->size * 8 / measuredBandwidthInKbps;
     if (estimatedTimeOfDownload < dc->segment_duration * ABANDON_MULTIPLIER || dc->quality == 0 ) {
         return false;
     } else {
-        BolaAbr *bola = (BolaAbr*) (dc->abr_instance);
         size_t bytesRemaining = dc->size - received;
         // TODO-Jan25: Pass information instead of placeholder kInProgress
-        dc->ret__quality = bola->BolaE(dc->buffer_occ, measuredBandwidthInKbps * kBandwidthSafetyFactor, &(dc->ret__pause), /*retry*/0, kInProgress);
+        AbrDecision decision = dc->abr_instance->DecideInFlight(
+            download->in_flight, dc->buffer_occ_us / 1000.0, measuredBandwidthInKbps * kBandwidthSafetyFactor);
+        dc->ret__quality = decision.quality;
+        dc->ret__pause = decision.pause;
 
         size_t estimateOtherBytesTotal = dc->size * dc->bitrates[dc->ret__quality] / dc->bitrates[dc->quality];
         if (bytesRemaining > estimateOtherBytesTotal) {
@@ -219,35 +277,54 @@ bool QuicClientBase::bola_shouldAbandon(size_t received, int32_t time, DownloadC
   return false;
 }
 
-bool QuicClientBase::DeadlineRequest() {
-  return target_time <= 0;
+void QuicClientBase::StartAbandonEvaluation(InFlightDownload* download) {
+  DownloadConfig *dc = download->dc;
+  if (dc == nullptr || dc->quality == 0) {
+    return;
+  }
+  if (dc->abr == "bpp") {
+    dc->abr_instance->StartInFlight(&download->in_flight, dc->qualities, {});
+  } else if (dc->abr == "bola") {
+    segment_sizes_bits_.clear();
+    if (feature_map.find("bola_enhanced") != feature_map.end()) {
+      for (auto &bitrate : dc->bitrates) {
+        segment_sizes_bits_.push_back((*(dc->adaptationSet))[bitrate].segments[dc->segment_no].size * 8);
+      }
+    }
+    dc->abr_instance->StartInFlight(&download->in_flight, nullptr,
+                                    segment_sizes_bits_);
+  }
+}
+
+bool QuicClientBase::DeadlineRequest(InFlightDownload* download) {
+  return download->target_time_us <= 0;
 }
 
 
-bool QuicClientBase::BPPShouldAbandon(size_t received, int32_t time, DownloadConfig *dc) {
-  bpp_moving_average_.AddMeasurement(received, time);
+bool QuicClientBase::BPPShouldAbandon(InFlightDownload* download, size_t received, int64_t time_us) {
+  DownloadConfig *dc = download->dc;
+  download->bpp_moving_average.AddMeasurement(received, time_us / 1000.0);
 
-  if (time > GRACE_TIME_THRESHOLD && received < dc->size) {
-    double measuredBandwidthInKbps = bpp_moving_average_.GetThroughput();
+  if (time_us > GRACE_TIME_THRESHOLD * 1000 && received < dc->size) {
+    double measuredBandwidthInKbps = download->bpp_moving_average.GetThroughput();
     if (measuredBandwidthInKbps == 0) {
       return false;
     }
     // bit / kbps = ks = ms == size * 8 / 1000 * 1000
     double estimatedRemainingDownloadTime = (dc->size - received) * 8 / measuredBandwidthInKbps;
-    uint32_t remaining_buffer = dc->buffer_occ - time;
-    if (estimatedRemainingDownloadTime < remaining_buffer) {
+    // May be negative once the buffer ran empty.
+    double remaining_buffer = (dc->buffer_occ_us - time_us) / 1000.0;
+    if (estimatedRemainingDownloadTime < remaining_buffer - download->safety_margin) {
       return false;
     }
     if (dc->quality > 0) {
-      BolaAbr *bola = (BolaAbr*) (dc->abr_instance);
-      // TODO: replace 0.0 with SSIM - 0.0 is just "old" behavior
-      DownloadProgress dp = {true, dc->quality, 0.0, dc->size, received, dc->reliable};
-      dc->ret__ssim = bola->BolaE(remaining_buffer, measuredBandwidthInKbps * kBandwidthSafetyFactor, *(dc->ssim_map), &(dc->ret__pause), /*retry*/0, dp);
-      auto &ssim_q = (*(dc->ssim_map))[dc->ret__ssim];
-      dc->ret__quality = ssim_q.quality;
+      AbrDecision decision = dc->abr_instance->DecideInFlight(download->in_flight, remaining_buffer, measuredBandwidthInKbps * kBandwidthSafetyFactor);
+      dc->ret__option = decision.option;
+      dc->ret__quality = decision.quality;
+      dc->ret__pause = decision.pause;
       if (dc->ret__quality < dc->quality) {
         return true;
-      } else if (!dc->reliable && dc->ret__quality == dc->quality && received >= ssim_q.size) {
+      } else if (!dc->reliable && dc->ret__quality == dc->quality && received >= decision.expected_size) {
         dc->ret__kept = true;
         return true;
       }
@@ -256,64 +333,45 @@ bool QuicClientBase::BPPShouldAbandon(size_t received, int32_t time, DownloadCon
   return false;
 }
 
-bool QuicClientBase::BPPRequest(QuicSpdyClientStream* stream, DownloadConfig *dc, uint32_t time) {
-  uint32_t timer = std::chrono::duration_cast<std::chrono::milliseconds>(
-      std::chrono::system_clock::now() - bola_timer).count();
-  //if (timer >= 50 || stream->GetTime() > last_stream_time) {
-  if (timer >= 50) {
-    bola_timer = std::chrono::system_clock::now();
-    last_stream_time = stream->GetTime();
-    return BPPShouldAbandon(stream->GetReceived(/*lossy=*/false), time, dc);
-  }
-  return false;
+bool QuicClientBase::BPPRequest(InFlightDownload* download, int64_t time_us) {
+  download->last_stream_time_us = download->stream->GetTime().ToMicroseconds();
+  return BPPShouldAbandon(download, download->stream->GetReceived(/*lossy=*/false), time_us);
 }
 
-bool QuicClientBase::BolaRequest(QuicSpdyClientStream* stream, DownloadConfig *dc, uint32_t time) {
-  uint32_t timer = std::chrono::duration_cast<std::chrono::milliseconds>(
-      std::chrono::system_clock::now() - bola_timer).count();
-  if (timer >= 50) {
-    bool cancel = bola_shouldAbandon(stream->GetReceived(/*lossy=*/false), time, dc);
-    bola_timer = std::chrono::system_clock::now();
-    return cancel;
-  }
-  return false;
+bool QuicClientBase::BolaRequest(InFlightDownload* download, int64_t time_us, bool sample) {
+  return bola_shouldAbandon(download, download->stream->GetReceived(/*lossy=*/false), time_us, sample);
 }
 
-bool QuicClientBase::EnhancedBolaRequest(QuicSpdyClientStream* stream, DownloadConfig *dc, uint32_t time) {
-  uint32_t timer = std::chrono::duration_cast<std::chrono::milliseconds>(
-      std::chrono::system_clock::now() - bola_timer).count();
-  //if (timer >= 50 || stream->GetTime() > last_stream_time) {
-  if (timer >= 50) {
-    bola_timer = std::chrono::system_clock::now();
-    last_stream_time = stream->GetTime();
-    return EnhancedBolaShouldAbandon(stream->GetReceived(/*lossy=*/false), time, dc);
-  }
-  return false;
+bool QuicClientBase::EnhancedBolaRequest(InFlightDownload* download, int64_t time_us, bool sample) {
+  download->last_stream_time_us = download->stream->GetTime().ToMicroseconds();
+  return EnhancedBolaShouldAbandon(download, download->stream->GetReceived(/*lossy=*/false), time_us, sample);
 }
 
-bool QuicClientBase::EnhancedBolaShouldAbandon(size_t received, int32_t time, DownloadConfig *dc) {
+bool QuicClientBase::EnhancedBolaShouldAbandon(InFlightDownload* download, size_t received, int64_t time_us, bool sample) {
+  DownloadConfig *dc = download->dc;
 
-  bola_throughput.push_back(received * 8 / time);
+  // bits / us * 1000 === kbps
+  if (sample) {
+    download->bola_throughput_sum += received * 8 * 1000.0 / std::max<int64_t>(time_us, 1);
+    ++download->bola_throughput_count;
+  }
 
-  if (bola_throughput.size() >= MIN_LENGTH_TO_AVERAGE && time > GRACE_TIME_THRESHOLD && received < dc->size) {
+  if (download->bola_throughput_count >= MIN_LENGTH_TO_AVERAGE && time_us > GRACE_TIME_THRESHOLD * 1000 && received < dc->size) {
 
-    double totalSampledValue = accumulate(bola_throughput.begin(), bola_throughput.end(), 0);
-    double measuredBandwidthInKbps = std::round(totalSampledValue / bola_throughput.size());
+    double measuredBandwidthInKbps = std::round(download->bola_throughput_sum / download->bola_throughput_count);
     // bit / kbps = ks = ms == size * 8 / 1000 * 1000
     double estimatedTimeOfDownload = dc->size * 8 / measuredBandwidthInKbps;
     if (estimatedTimeOfDownload < dc->segment_duration * ABANDON_MULTIPLIER || dc->quality == 0 ) {
       return false;
     } else {
-      BolaAbr *bola = (BolaAbr*) (dc->abr_instance);
       size_t bytesRemaining = dc->size - received;
-      std::vector<double> segment_sizes_bits;
-      for (auto &bitrate : dc->bitrates) {
-        segment_sizes_bits.push_back((*(dc->adaptationSet))[bitrate].segments[dc->segment_no].size * 8);
-      }
-      // TODO-Jan25: Update with ssim_map
+      // TODO-Jan25: Update with the segment's quality table
       // TODO-Jan25: Pass information instead of placeholder kInProgress
-      dc->ret__quality = bola->BolaE(dc->buffer_occ - time, measuredBandwidthInKbps * kBandwidthSafetyFactor, segment_sizes_bits, &(dc->ret__pause), /*retry*/0, kInProgress);
-      size_t otherBytesTotal = (*(dc->adaptationSet))[dc->bitrates[dc->ret__quality]].segments[dc->segment_no].size;
+      AbrDecision decision = dc->abr_instance->DecideInFlight(download->in_flight, (dc->buffer_occ_us - time_us) / 1000.0, measuredBandwidthInKbps * kBandwidthSafetyFactor);
+      dc->ret__quality = decision.quality;
+      dc->ret__pause = decision.pause;
+      // The in-flight options hold this segment's size for every quality.
+      size_t otherBytesTotal = decision.expected_size;
       if (bytesRemaining > otherBytesTotal) {
         return true;
       }
@@ -323,64 +381,143 @@ bool QuicClientBase::EnhancedBolaShouldAbandon(size_t received, int32_t time, Do
   return false;
 }
 
-bool QuicClientBase::WaitForEvents(QuicSpdyClientStream* stream, DownloadConfig *dc, bool idle_check) {
-  DCHECK(connected());
+bool QuicClientBase::WaitForEvents(std::vector<InFlightDownload>* downloads, bool idle_check) {
+  if (blocking_event_loop_) {
+    BlockForEvents(QuicTime::Delta::FromMilliseconds(kMaxEventLoopBlockTime));
+  }
+  WaitForEvents();
+
+  bool outstanding = false;
+  for (auto& download : *downloads) {
+    if (!download.done) {
+      download.abandon_tick_due |= abandon_tick_due_;
+      download.abandon_check_due |= abandon_tick_due_ ||
+          received_step_streams_.count(download.id) > 0;
+      download.done = CheckDownload(&download, idle_check);
+      outstanding |= !download.done;
+    }
+  }
+  abandon_tick_due_ = false;
+  received_step_streams_.clear();
+  if (!outstanding && abandon_alarm_ != nullptr) {
+    abandon_alarm_->Cancel();
+  }
+  return outstanding;
+}
 
-  network_helper_->RunEventLoop();
+void QuicClientBase::OnReceivedStep(QuicStreamId id) {
+  received_step_streams_.insert(id);
+  WakeEventLoop();
+}
 
-  DCHECK(session() != nullptr);
-  if (!connected() &&
-      session()->error() == QUIC_CRYPTO_HANDSHAKE_STATELESS_REJECT) {
-    DCHECK(GetQuicReloadableFlag(enable_quic_stateless_reject_support));
-    QUIC_DLOG(INFO) << "Detected stateless reject while waiting for events.  "
-                    << "Attempting to reconnect.";
-    Connect();
+void QuicClientBase::OnAbandonCheckAlarm() {
+  abandon_tick_due_ = true;
+  abandon_alarm_->Set(helper()->GetClock()->Now() + abandon_check_interval_);
+  WakeEventLoop();
+}
+
+void QuicClientBase::WakeEventLoop() {
+  event_loop_woken_ = true;
+  if (!quit_event_loop_.is_null()) {
+    quit_event_loop_.Run();
+  }
+}
+
+void QuicClientBase::BlockForEvents(QuicTime::Delta timeout) {
+  if (event_loop_woken_) {
+    // Something happened while the caller was busy, do not wait for more.
+    event_loop_woken_ = false;
+    return;
+  }
+  // Packets arriving, alarms and the timeout all wake the message loop; it
+  // only returns to the caller once one of them calls WakeEventLoop().
+  base::RunLoop run_loop;
+  quit_event_loop_ = run_loop.QuitClosure();
+  base::ThreadTaskRunnerHandle::Get()->PostDelayedTask(
+      FROM_HERE, run_loop.QuitClosure(),
+      base::TimeDelta::FromMicroseconds(timeout.ToMicroseconds()));
+  run_loop.Run();
+  quit_event_loop_.Reset();
+  event_loop_woken_ = false;
+}
+
+void QuicClientBase::RunEventLoopFor(QuicTime::Delta duration) {
+  const QuicClock* clock = helper()->GetClock();
+  const QuicTime end = clock->Now() + duration;
+  for (QuicTime now = clock->Now(); now < end; now = clock->Now()) {
+    BlockForEvents(end - now);
+  }
+}
+
+void QuicClientBase::CancelDownload(InFlightDownload* download) {
+  if (!session()->IsOpenStream(download->id)) {
+    return;
   }
+  download->stream->Reset(QUIC_STREAM_NO_ERROR);
+  static_cast<QuicSpdyClientBase*>(this)->OnClose(download->stream);
+  while (session()->IsOpenStream(download->id)) {
+    network_helper_->RunEventLoop();
+  }
+}
 
+bool QuicClientBase::CheckDownload(InFlightDownload* download, bool idle_check) {
+  QuicSpdyClientStream* stream = download->stream;
+  DownloadConfig *dc = download->dc;
+  const bool evaluate = download->abandon_check_due;
+  const bool tick = download->abandon_tick_due;
+  download->abandon_check_due = false;
+  download->abandon_tick_due = false;
 
-  bool done = session()->num_active_requests() == 0;
+  // Other requests may still be in flight, so a request is done once its own
+  // stream is closed. |stream| is gone by then.
+  bool done = !session()->IsOpenStream(download->id);
 
-  uint32_t time_delta = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start_time).count();
+  const auto now = std::chrono::steady_clock::now();
+  int64_t time_delta_us = std::chrono::duration_cast<std::chrono::microseconds>(now - download->start_time).count();
 
   ////
   // IDLE CHECK - HACK
-  if (stream != nullptr && idle_check) {
-    uint32_t idle = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - idle_time).count();
+  if (!done && idle_check) {
+    int64_t idle_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - download->idle_time).count();
 
     size_t recv = stream->GetReceived(/*lossy=*/false);
 
-    if (last_received_ == recv && idle > 15000) {
-      std::cerr << "[idle] " << idle << std::endl;
-      idle_time = std::chrono::system_clock::now();
+    if (download->last_received == recv && idle_ms > 15000) {
+      std::cerr << "[idle] " << idle_ms << std::endl;
+      download->idle_time = now;
     } else {
-      last_received_ = recv;
-      idle_time = std::chrono::system_clock::now();
+      download->last_received = recv;
+      download->idle_time = now;
     }
   }
   ////
 
-  if (stream != nullptr && dc != nullptr && !done) {
-    remaining_time = dc->buffer_occ - time_delta;
-    remaining_size = dc->size - stream->GetReceived(/*lossy=*/false);
-    lossy_remaining_size = dc->size - stream->GetReceived(/*lossy=*/true);
-    current_throughput = stream->GetThroughput();
-    if (current_throughput != 0) {
-      rem_dl_time = ((lossy_remaining_size / 1000) / (current_throughput / 8)) * 1000;
-      rem_fb_time = ((dc->fallback_size / 1000) / (current_throughput / 8)) * 1000;
+  if (dc != nullptr && !done) {
+    download->remaining_time_us = dc->buffer_occ_us - time_delta_us;
+    download->remaining_size = dc->size - stream->GetReceived(/*lossy=*/false);
+    download->lossy_remaining_size = dc->size - stream->GetReceived(/*lossy=*/true);
+    download->current_throughput = stream->GetThroughput();
+    if (download->current_throughput != 0) {
+      // bit / kbps === ms
+      download->rem_dl_time = download->lossy_remaining_size * 8 / download->current_throughput;
+      download->rem_fb_time = dc->fallback_size * 8 / download->current_throughput;
     }
-    target_time = remaining_time - kSafetyMargin;
-    calculated_threshold = (dc->size - lossy_remaining_size) / (float) dc->size;
+    download->safety_margin = SafetyMargin(
+        static_cast<QuicSpdyClientBase*>(this)->GetTransportStats());
+    download->target_time_us = download->remaining_time_us - download->safety_margin * 1000;
+    download->calculated_threshold = (dc->size - download->lossy_remaining_size) / (float) dc->size;
     bool cancel = false;
-    if (dc->abr == "bpp") {
-      cancel = BPPRequest(stream, dc, time_delta);
-    } else if (dc->abr == "bola") {
+    if (evaluate && dc->abr == "bpp") {
+      cancel = BPPRequest(download, time_delta_us);
+    } else if (evaluate && dc->abr == "bola") {
       if (feature_map.find("bola_enhanced") != feature_map.end()) {
-        cancel = EnhancedBolaRequest(stream, dc, time_delta);
+        cancel = EnhancedBolaRequest(download, time_delta_us, tick);
       } else {
-        cancel = BolaRequest(stream, dc, time_delta);
+        cancel = BolaRequest(download, time_delta_us, tick);
       }
     } else if (dc->abr == "deadline") {
-      cancel = DeadlineRequest();
+      // Cheap enough to check after every event loop iteration.
+      cancel = DeadlineRequest(download);
       // We may cancel before we receive anything, so only set keep to true if we have at least something, else we might
       // not even have received headers.
       if (stream->GetReceived(/*lossy=*/false) > 0) {
@@ -388,62 +525,56 @@ bool QuicClientBase::WaitForEvents(QuicSpdyClientStream* stream, DownloadConfig
       }
     }
     if (cancel) {
-      stream->Reset(QUIC_STREAM_NO_ERROR);
-      ((QuicSpdyClientBase *) dc->client)->OnClose(stream);
-      while (session()->num_active_requests() != 0) {
-        network_helper_->RunEventLoop();
-      }
+      CancelDownload(download);
       std::cerr << "[cancel-reason]"
                 << " rel:" << dc->reliable
-                << " t:" << time_delta
-                << " rs:" << remaining_size
-                << " lrs:" << lossy_remaining_size
-                << " rt:" << rem_dl_time
-                << " rft:" << rem_fb_time
-                << " buf:" << target_time
+                << " t:" << time_delta_us / 1000.0
+                << " rs:" << download->remaining_size
+                << " lrs:" << download->lossy_remaining_size
+                << " rt:" << download->rem_dl_time
+                << " rft:" << download->rem_fb_time
+                << " buf:" << download->target_time_us / 1000.0
                 << " keep:" << dc->ret__kept
-                << " cthrsh:" << calculated_threshold
+                << " cthrsh:" << download->calculated_threshold
                 << std::endl;
-      // done = true
-      return false;
+      return true;
     }
 
-    if (print_helper >= 50000 && lossy_remaining_size < (unsigned long) (print_helper) - 50000) {
+    if (download->print_helper >= 50000 && download->lossy_remaining_size < (unsigned long) (download->print_helper) - 50000) {
       std::cerr << "[cancel-try]"
                 << " rel:" << dc->reliable
-                << " t:" << time_delta
-                << " rs:" << remaining_size
-                << " lrs:" << lossy_remaining_size
-                << " rt:" << rem_dl_time
-                << " rft:" << rem_fb_time
-                << " buf:" << target_time
+                << " t:" << time_delta_us / 1000.0
+                << " rs:" << download->remaining_size
+                << " lrs:" << download->lossy_remaining_size
+                << " rt:" << download->rem_dl_time
+                << " rft:" << download->rem_fb_time
+                << " buf:" << download->target_time_us / 1000.0
                 << " keep:" << dc->ret__kept
-                << " tp:" << current_throughput
+                << " tp:" << download->current_throughput
                 << std::endl;
-      print_helper = lossy_remaining_size;
+      download->print_helper = download->lossy_remaining_size;
     }
   }
 
-  if (stream && done) {
+  if (done) {
     if (dc != nullptr) {
       dc->ret__kept = true;
       std::cerr << "[cancel-fin]"
                 << " rel:" << dc->reliable
-                << " t:" << time_delta
-                << " rs:" << remaining_size
-                << " lrs:" << lossy_remaining_size
-                << " rt:" << rem_dl_time
-                << " rft:" << rem_fb_time
-                << " buf:" << target_time
+                << " t:" << time_delta_us / 1000.0
+                << " rs:" << download->remaining_size
+                << " lrs:" << download->lossy_remaining_size
+                << " rt:" << download->rem_dl_time
+                << " rft:" << download->rem_fb_time
+                << " buf:" << download->target_time_us / 1000.0
                 << " keep:" << dc->ret__kept
                 << std::endl;
     } else {
-      std::cerr << "[cancel-fin] t:" << time_delta << std::endl;
+      std::cerr << "[cancel-fin] t:" << time_delta_us / 1000.0 << std::endl;
     }
   }
 
-  // return false when done for callers while loop
-  return !done;
+  return done;
 }
 
 bool QuicClientBase::MigrateSocket(const QuicIpAddress& new_host) {
@@ -487,11 +618,17 @@ const QuicClientBase::NetworkHelper* QuicClientBase::network_helper() const {
   return network_helper_.get();
 }
 
+void QuicClientBase::set_network_helper(
+    std::unique_ptr<NetworkHelper> network_helper) {
+  DCHECK(!initialized_);
+  network_helper_ = std::move(network_helper);
+}
+
 void QuicClientBase::WaitForStreamToClose(QuicStreamId id) {
   DCHECK(connected());
 
   while (connected() && !session_->IsClosedStream(id)) {
-    WaitForEvents(nullptr, nullptr);
+    WaitForEvents();
   }
 }
 
@@ -499,7 +636,7 @@ bool QuicClientBase::WaitForCryptoHandshakeConfirmed() {
   DCHECK(connected());
 
   while (connected() && !session_->IsCryptoHandshakeConfirmed()) {
-    WaitForEvents(nullptr, nullptr);
+    WaitForEvents();
   }
 
   // If the handshake fails due to a timeout, the connection will be closed.
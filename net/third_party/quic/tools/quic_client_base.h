@@ -8,16 +8,22 @@
 #ifndef NET_THIRD_PARTY_QUIC_TOOLS_QUIC_CLIENT_BASE_H_
 #define NET_THIRD_PARTY_QUIC_TOOLS_QUIC_CLIENT_BASE_H_
 
+#include <chrono>
 #include <string>
 #include <numeric>
+#include <set>
+#include <vector>
 #include <math.h>
 
+#include "base/callback.h"
 #include "base/macros.h"
 #include "net/third_party/quic/core/crypto/crypto_handshake.h"
 #include "net/third_party/quic/core/http/quic_client_push_promise_index.h"
 #include "net/third_party/quic/core/http/quic_spdy_client_session.h"
 #include "net/third_party/quic/core/http/quic_spdy_client_stream.h"
+#include "net/third_party/quic/core/quic_alarm.h"
 #include "net/third_party/quic/core/quic_config.h"
+#include "net/third_party/quic/core/quic_time.h"
 #include "net/third_party/quic/platform/api/quic_socket_address.h"
 #include "net/third_party/quic/platform/api/quic_string_piece.h"
 
@@ -29,6 +35,47 @@ namespace quic {
 struct DownloadConfig_;
 typedef DownloadConfig_ DownloadConfig;
 
+// One request WaitForEvents() waits for, with what the abandonment checks of
+// its DownloadConfig have seen so far. Requests of the same segment may be in
+// flight together, so none of this is shared between them.
+struct InFlightDownload {
+  QuicSpdyClientStream* stream;
+  // |stream| may be gone once it is closed, the id is not.
+  QuicStreamId id;
+  DownloadConfig* dc;
+  std::chrono::steady_clock::time_point start_time;
+  std::chrono::steady_clock::time_point idle_time;
+  size_t last_received;
+  int print_helper;
+  // Running sum and count of the throughput samples of bola, one per alarm
+  // tick, so that they are evenly spaced in time.
+  double bola_throughput_sum;
+  size_t bola_throughput_count;
+  BPPMovingAverage bpp_moving_average;
+  // The segment's options for DecideInFlight(), captured when the download
+  // starts.
+  BolaAbandonEvaluator in_flight;
+  int64_t last_stream_time_us;
+  int64_t remaining_time_us;
+  size_t remaining_size;
+  size_t lossy_remaining_size;
+  // Estimated time (ms) to download the rest, or the fallback.
+  double rem_dl_time;
+  double rem_fb_time;
+  int64_t target_time_us;
+  double current_throughput;
+  // SafetyMargin() (ms) of the connection at the latest check.
+  double safety_margin;
+  float calculated_threshold;
+  // The ABR's abandonment checks are due, because the alarm ticked or this
+  // download's stream received another step. Cleared by CheckDownload().
+  bool abandon_check_due;
+  // The alarm ticked since the last check.
+  bool abandon_tick_due;
+  // Closed, or abandoned by its abandonment checks.
+  bool done;
+};
+
 class ProofVerifier;
 class QuicServerId;
 
@@ -38,7 +85,7 @@ class QuicServerId;
 // Subclasses derived from this class are responsible for creating the
 // actual QuicSession instance, as well as defining functions that
 // create and run the underlying network transport.
-class QuicClientBase {
+class QuicClientBase : public QuicSpdyClientStream::ReceivedStepListener {
  public:
   // An interface to various network events that the QuicClient will need to
   // interact with.
@@ -76,7 +123,7 @@ class QuicClientBase {
   QuicClientBase(const QuicClientBase&) = delete;
   QuicClientBase& operator=(const QuicClientBase&) = delete;
 
-  virtual ~QuicClientBase();
+  ~QuicClientBase() override;
 
   // Initializes the client to create a connection. Should be called exactly
   // once before calling StartConnect or Connect. Returns true if the
@@ -114,8 +161,40 @@ class QuicClientBase {
 
   // Wait up to 50ms, and handle any events which occur.
   // Returns true if there are any outstanding requests.
-  bool WaitForEvents(QuicSpdyClientStream*, DownloadConfig *dc);
-  bool WaitForEvents(QuicSpdyClientStream*, DownloadConfig *dc, bool idle_check);
+  bool WaitForEvents();
+  // Like WaitForEvents(), then checks every download in |downloads| that is
+  // not done yet. Its ABR's abandonment checks only run once the abandonment
+  // alarm fired or a stream crossed a received step since the last time.
+  // Returns true while any download is not done.
+  bool WaitForEvents(std::vector<InFlightDownload>* downloads, bool idle_check);
+
+  // Time between abandonment checks of in-flight downloads, measured on the
+  // connection's clock. Defaults to kAbandonCheckInterval.
+  void set_abandon_check_interval(QuicTime::Delta interval) {
+    abandon_check_interval_ = interval;
+  }
+
+  // If true, WaitForEvents(downloads) blocks in the message loop until a
+  // download needs attention (abandonment alarm, received step, a closed
+  // stream) instead of polling the event loop.
+  void set_blocking_event_loop(bool blocking) {
+    blocking_event_loop_ = blocking;
+  }
+
+  // Keeps running the event loop for |duration|, so that acks and alarms are
+  // serviced while the client waits, e.g. for an ABR pause.
+  void RunEventLoopFor(QuicTime::Delta duration);
+
+  // QuicSpdyClientStream::ReceivedStepListener
+  void OnReceivedStep(QuicStreamId id) override;
+
+  // Starts tracking |stream|, sent at |start_time|, for WaitForEvents().
+  // |dc| may be null for requests that are never abandoned.
+  InFlightDownload StartDownload(QuicSpdyClientStream* stream,
+                                 DownloadConfig *dc,
+                                 std::chrono::steady_clock::time_point start_time);
+  // Resets the stream of |download| and waits until it is closed.
+  void CancelDownload(InFlightDownload* download);
 
   // Migrate to a new socket (new_host) during an active connection.
   bool MigrateSocket(const QuicIpAddress& new_host);
@@ -242,6 +321,9 @@ class QuicClientBase {
 
   NetworkHelper* network_helper();
   const NetworkHelper* network_helper() const;
+  // Replaces the network helper the client was created with. Must be called
+  // before Initialize().
+  void set_network_helper(std::unique_ptr<NetworkHelper> network_helper);
 
   bool initialized() const { return initialized_; }
 
@@ -249,7 +331,7 @@ class QuicClientBase {
     crypto_config_.set_pre_shared_key(key);
   }
 
-  bool bola_shouldAbandon(size_t received, int32_t time, DownloadConfig *dc);
+  bool bola_shouldAbandon(InFlightDownload* download, size_t received, int64_t time_us, bool sample);
 
  protected:
   // TODO(rch): Move GetNumSentClientHellosFromSession and
@@ -300,16 +382,14 @@ class QuicClientBase {
   // You probably want to call this if you override CreateQuicSpdyClientSession.
   void ResetSession() { session_.reset(); }
 
-  // Reset timers, sizes etc.
-  void Reset();
+  // Prepares the in-flight abandonment checks of |download|; called once per
+  // request before waiting for the response.
+  void StartAbandonEvaluation(InFlightDownload* download);
+
+  // Ends the current, or else the next, BlockForEvents().
+  void WakeEventLoop();
 
-  int print_helper = 0;
-  std::chrono::system_clock::time_point start_time;
-  std::chrono::system_clock::time_point idle_time;
-  std::chrono::system_clock::time_point bola_timer;
-  size_t last_received_ = 0;
-  std::vector<double> bola_throughput;
-  BPPMovingAverage bpp_moving_average_;
+  std::vector<double> segment_sizes_bits_;
 
  private:
   // |server_id_| is a tuple (hostname, port, is_https) of the server.
@@ -380,44 +460,72 @@ class QuicClientBase {
   // Not owned by this class.
   std::unique_ptr<NetworkHelper> network_helper_;
 
-  bool DeadlineRequest();
-  bool BPPShouldAbandon(size_t received, int32_t time, DownloadConfig *dc);
-  bool BPPRequest(QuicSpdyClientStream* stream, DownloadConfig *dc, uint32_t time);
-  bool BolaRequest(QuicSpdyClientStream* stream, DownloadConfig *dc, uint32_t time);
-  bool EnhancedBolaRequest(QuicSpdyClientStream* stream, DownloadConfig *dc, uint32_t time);
-  bool EnhancedBolaShouldAbandon(size_t received, int32_t time, DownloadConfig *dc);
-
-  int32_t remaining_time = 0;
-  size_t remaining_size = 0;
-  size_t lossy_remaining_size = 0;
-  double rem_dl_time = 0;
-  double rem_fb_time = 0;
-  int32_t target_time = 0;
-  double current_throughput = 0;
-  float calculated_threshold = 0;
-  uint32_t last_stream_time = 0;
+  class AbandonCheckAlarmDelegate;
+
+  // Runs the checks of one download after the event loop; returns true once
+  // it is done. The ABR's abandonment checks only run if they are due on
+  // |download|.
+  bool CheckDownload(InFlightDownload* download, bool idle_check);
+  bool DeadlineRequest(InFlightDownload* download);
+  // |time_us| is the time since the request was sent.
+  bool BPPShouldAbandon(InFlightDownload* download, size_t received, int64_t time_us);
+  bool BPPRequest(InFlightDownload* download, int64_t time_us);
+  // bola only adds a throughput sample if |sample|, i.e. on alarm ticks.
+  bool BolaRequest(InFlightDownload* download, int64_t time_us, bool sample);
+  bool EnhancedBolaRequest(InFlightDownload* download, int64_t time_us, bool sample);
+  bool EnhancedBolaShouldAbandon(InFlightDownload* download, size_t received, int64_t time_us, bool sample);
+  void OnAbandonCheckAlarm();
+  // Runs the message loop until WakeEventLoop() or for at most |timeout|.
+  void BlockForEvents(QuicTime::Delta timeout);
+
+  // Fires every |abandon_check_interval_| while downloads are checked.
+  std::unique_ptr<QuicAlarm> abandon_alarm_;
+  QuicTime::Delta abandon_check_interval_;
+  // The alarm ticked, and the streams which received a step, since
+  // WaitForEvents() last handed them to its downloads.
+  bool abandon_tick_due_;
+  std::set<QuicStreamId> received_step_streams_;
+
+  bool blocking_event_loop_;
+  // Quits the message loop run by BlockForEvents(), if one is running.
+  base::Closure quit_event_loop_;
+  // WakeEventLoop() was called since the last BlockForEvents().
+  bool event_loop_woken_;
 };
 
-constexpr int32_t kSafetyMargin = 70;
+// Interval (ms) between abandonment checks of an in-flight download.
+constexpr uint32_t kAbandonCheckInterval = 50;
+// An in-flight download is also checked each time another 1/n of its size
+// has arrived.
+constexpr size_t kAbandonCheckSteps = 10;
+// Longest time (ms) a blocking WaitForEvents() waits without being woken.
+constexpr int64_t kMaxEventLoopBlockTime = 200;
 
 struct DownloadConfig_ {
   std::string abr;
   size_t size;
   size_t fallback_size;
-  uint32_t buffer_occ;
+  // Buffer level when the request was sent.
+  int64_t buffer_occ_us;
   int quality;
   std::vector<double> bitrates;
-  BaseAbr *abr_instance;
+  AbrInterface *abr_instance;
   QuicClientBase *client;
   bool reliable;
   int segment_duration;
   uint32_t segment_no;
   std::map<uint32_t,repr>* adaptationSet;
-  std::map<double, SSIMBasedQuality>* ssim_map;
+  const SegmentQualities* qualities;
   bool ret__kept;
   int ret__quality;
-  double ret__ssim;
+  int ret__option;
   double ret__pause;
+  // If set, the response body goes straight to its place in the segment
+  // (see QuicSpdyClientStream::SetBodyDestination) instead of
+  // latest_response_body().
+  char* body_destination;
+  size_t body_destination_length;
+  const std::vector<BodyScatter>* body_scatter;
 };
 
 }  // namespace quic
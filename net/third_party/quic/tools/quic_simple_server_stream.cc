@@ -257,6 +257,8 @@ void QuicSimpleServerStream::OnResponseBackendComplete(
   bool multirange = (std::string::npos != range.find("multibytes="));
 
   std::string data = "";
+  // Each range of a multibytes request is one video frame.
+  std::vector<QuicByteCount> frame_lengths;
 
   if (!range.empty()) {
 
@@ -273,6 +275,7 @@ void QuicSimpleServerStream::OnResponseBackendComplete(
         en = std::stoi( r.substr(sep+1),  nullptr, 0 )+1;
 
         base::internal::AppendToString(response->body().substr(st, en-st), &data);
+        frame_lengths.push_back(en - st);
       }
 
     } else { /* NO multirange */
@@ -287,11 +290,11 @@ void QuicSimpleServerStream::OnResponseBackendComplete(
     headers["content-length"] = std::to_string(data.length());
     
     SendHeadersAndBodyAndTrailers(std::move(headers), data,
-                                response->trailers().Clone());
+                                response->trailers().Clone(), frame_lengths);
   } else {
     //TODO //FIXME we might want to sent fec'd data without range request
     SendHeadersAndBodyAndTrailers(std::move(headers), response->body(),
-                                 response->trailers().Clone());
+                                 response->trailers().Clone(), frame_lengths);
   }
 }
 
@@ -354,13 +357,15 @@ void QuicSimpleServerStream::SendHeadersAndBody(
     spdy::SpdyHeaderBlock response_headers,
     QuicStringPiece body) {
   SendHeadersAndBodyAndTrailers(std::move(response_headers), body,
-                                spdy::SpdyHeaderBlock());
+                                spdy::SpdyHeaderBlock(),
+                                std::vector<QuicByteCount>());
 }
 
 void QuicSimpleServerStream::SendHeadersAndBodyAndTrailers(
     spdy::SpdyHeaderBlock response_headers,
     QuicStringPiece body,
-    spdy::SpdyHeaderBlock response_trailers) {
+    spdy::SpdyHeaderBlock response_trailers,
+    const std::vector<QuicByteCount>& frame_lengths) {
   // Send the headers, with a FIN if there's nothing else to send.
   bool send_fin = (body.empty() && response_trailers.empty());
   QUIC_DLOG(INFO) << "Stream " << id() << " writing headers (fin = " << send_fin
@@ -391,7 +396,9 @@ void QuicSimpleServerStream::SendHeadersAndBodyAndTrailers(
   send_fin = response_trailers.empty();
   QUIC_DLOG(INFO) << "Stream " << id() << " writing body (fin = " << send_fin
                   << ") with size: " << body.size();
-  if (!body.empty() || send_fin) {
+  if (!body.empty() && get_unreliable() && !frame_lengths.empty()) {
+    WriteOrBufferData(body, send_fin, nullptr, frame_lengths);
+  } else if (!body.empty() || send_fin) {
     WriteOrBufferData(body, send_fin, nullptr);
   }
   if (send_fin) {
@@ -87,9 +87,12 @@ class QuicSimpleServerStream : public QuicSpdyServerStreamBase,
 
   void SendHeadersAndBody(spdy::SpdyHeaderBlock response_headers,
                           QuicStringPiece body);
-  void SendHeadersAndBodyAndTrailers(spdy::SpdyHeaderBlock response_headers,
-                                     QuicStringPiece body,
-                                     spdy::SpdyHeaderBlock response_trailers);
+  // |frame_lengths| are the video frames |body| consists of, if known.
+  void SendHeadersAndBodyAndTrailers(
+      spdy::SpdyHeaderBlock response_headers,
+      QuicStringPiece body,
+      spdy::SpdyHeaderBlock response_trailers,
+      const std::vector<QuicByteCount>& frame_lengths);
 
   spdy::SpdyHeaderBlock* request_headers() { return &request_headers_; }
 
@@ -4,12 +4,15 @@
 
 //#define SLST_DEBUG 1
 
+#include <algorithm>
 #include <chrono>
 
 #include "net/third_party/quic/tools/quic_spdy_client_base.h"
 
 #include "net/third_party/quic/core/crypto/quic_random.h"
 #include "net/third_party/quic/core/http/spdy_utils.h"
+#include "net/third_party/quic/core/congestion_control/rtt_stats.h"
+#include "net/third_party/quic/core/quic_connection.h"
 #include "net/third_party/quic/core/quic_server_id.h"
 #include "net/third_party/quic/platform/api/quic_flags.h"
 #include "net/third_party/quic/platform/api/quic_logging.h"
@@ -21,59 +24,78 @@ using std::string;
 
 namespace quic {
 
+namespace {
+
+// time_us_ of |timing| without the time already counted by overlapping
+// requests; at least 1us like time_us_ itself.
+int64_t ExclusiveTime(const SubSegmentTiming& timing) {
+  int64_t exclusive = (timing.time_us_ > timing.overlap_us_) ? timing.time_us_ - timing.overlap_us_ : 0;
+  return (!exclusive)?1:exclusive;
+}
+
+int64_t ElapsedMicroseconds(std::chrono::steady_clock::time_point from,
+                            std::chrono::steady_clock::time_point to) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
+
+}  // namespace
+
 std::pair<double, double> QuicSpdyClientBase::GetSumThroughput(bool unrel) {
   if (segment_timing[unrel].empty()) {
     return {0,0};
   }
-  double tp = 0.0;
-  double time = 0.0;
-
-  for (auto &i: segment_timing[unrel]) {
-    tp += i.throughput_ * (((double) i.time_) / 1000);
-    time += ((double) i.time_) / 1000;
-  }
-  return {tp / time, time};
+  const SubSegmentTimingSums& sums = segment_timing_sums[unrel].back();
+  return {sums.bits_ / sums.time_us_, ((double) sums.time_us_) / 1000000};
 }
 
 double QuicSpdyClientBase::GetSumThroughput() {
-  auto tp_rel = GetSumThroughput(sst_rel);
-  auto tp_unrel = GetSumThroughput(sst_unrel);
-  if (tp_unrel.first > 0) {
-    return (tp_rel.first * tp_rel.second + tp_unrel.first * tp_unrel.second) / (tp_rel.second + tp_unrel.second);
-  }
-  return tp_rel.first;
+  // Reliable and unreliable requests may have been in flight together, so
+  // their bits are spread over the time the client spent on them, counted once.
+  const SubSegmentTimingSums& rel = segment_timing_sums[sst_rel].back();
+  const SubSegmentTimingSums& unrel = segment_timing_sums[sst_unrel].back();
+  double time = rel.exclusive_time_us_ + unrel.exclusive_time_us_;
+  return (time > 0) ? (rel.bits_ + unrel.bits_) / time : 0;
+}
+
+int64_t QuicSpdyClientBase::GetSumTime(bool unrel) {
+  return segment_timing_sums[unrel].back().time_us_;
 }
 
-uint32_t QuicSpdyClientBase::GetSumTime(bool unrel) {
-  uint32_t t = 0;
+int64_t QuicSpdyClientBase::GetSumTime() {
+  return segment_timing_sums[sst_rel].back().exclusive_time_us_ +
+         segment_timing_sums[sst_unrel].back().exclusive_time_us_;
+}
 
-  for (auto &i: segment_timing[unrel]) {
-    t += i.time_;
-  }
-  return t;
+SubSegmentTimingSums QuicSpdyClientBase::GetWindowSums(bool unrel, size_t n) const {
+  const std::vector<SubSegmentTimingSums>& prefix = segment_timing_sums[unrel];
+  const SubSegmentTimingSums& last = prefix.back();
+  const SubSegmentTimingSums& first = prefix[prefix.size() - 1 - std::min(n, last.count_)];
+  return {last.count_ - first.count_,
+          last.bits_ - first.bits_,
+          last.time_us_ - first.time_us_,
+          last.exclusive_time_us_ - first.exclusive_time_us_,
+          last.segment_size_ - first.segment_size_,
+          last.received_size_ - first.received_size_};
 }
 
-double QuicSpdyClientBase::GetSumSegmentSize(bool unrel) {
-  double ss = 0.0;
+int64_t QuicSpdyClientBase::GetExclusiveTime(bool unrel) {
+  return segment_timing[unrel].empty() ? 0 : ExclusiveTime(segment_timing[unrel].back());
+}
 
-  for (auto &i: segment_timing[unrel]) {
-    ss += i.segment_size_;
-  }
-  return ss;
+double QuicSpdyClientBase::GetSumSegmentSize(bool unrel) {
+  return segment_timing_sums[unrel].back().segment_size_;
 }
 
 double QuicSpdyClientBase::GetSumReceivedSize(bool unrel) {
-  double rs = 0.0;
-
-  for (auto &i: segment_timing[unrel]) {
-    rs += i.received_size_;
-  }
-  return rs;
+  return segment_timing_sums[unrel].back().received_size_;
 }
 
 void QuicSpdyClientBase::ResetAllTimings() {
-  segment_timing[sst_unrel].clear();
-  segment_timing[sst_rel].clear();
+  for (int unrel = sst_rel; unrel <= sst_unrel; ++unrel) {
+    segment_timing[unrel].clear();
+    segment_timing_sums[unrel].assign(1, {0, 0, 0, 0, 0, 0});
+  }
+  segment_arrivals_.clear();
 };
 
 void QuicSpdyClientBase::ClientQuicDataToResend::Resend() {
@@ -108,7 +130,9 @@ QuicSpdyClientBase::QuicSpdyClientBase(
                      std::move(proof_verifier)),
       store_response_(false),
       latest_response_code_(-1),
+      latest_response_body_size_(0),
       fine_(false) {
+        ResetAllTimings();
       }
 
 QuicSpdyClientBase::~QuicSpdyClientBase() {
@@ -121,6 +145,30 @@ QuicSpdyClientSession* QuicSpdyClientBase::client_session() {
   return static_cast<QuicSpdyClientSession*>(QuicClientBase::session());
 }
 
+TransportStats QuicSpdyClientBase::GetTransportStats() {
+  TransportStats stats = {};
+  if (session() == nullptr) {
+    return stats;
+  }
+  QuicConnection* connection = session()->connection();
+  const QuicSentPacketManager& manager = connection->sent_packet_manager();
+  // Not QuicConnectionStats::srtt_us, which falls back to the initial RTT.
+  const RttStats* rtt_stats = manager.GetRttStats();
+  if (!rtt_stats->smoothed_rtt().IsZero()) {
+    stats.srtt = rtt_stats->smoothed_rtt().ToMicroseconds() / 1000.0;
+    stats.rttvar = rtt_stats->mean_deviation().ToMicroseconds() / 1000.0;
+    stats.min_rtt = rtt_stats->min_rtt().ToMicroseconds() / 1000.0;
+  }
+  stats.cwnd = manager.GetCongestionWindowInBytes();
+  stats.bandwidth = manager.BandwidthEstimate().ToKBitsPerSecond();
+  const QuicConnectionStats& connection_stats = connection->GetStats();
+  stats.packets_sent = connection_stats.packets_sent;
+  stats.packets_lost = connection_stats.packets_lost;
+  stats.packets_received = connection_stats.packets_received;
+  stats.packets_reordered = connection_stats.packets_reordered;
+  return stats;
+}
+
 void QuicSpdyClientBase::InitializeSession() {
   client_session()->Initialize();
   client_session()->CryptoConnect();
@@ -129,6 +177,7 @@ void QuicSpdyClientBase::InitializeSession() {
 
 void QuicSpdyClientBase::OnClose(QuicSpdyStream* stream) {
   DCHECK(stream != nullptr);
+  WakeEventLoop();
   QuicSpdyClientStream* client_stream =
       static_cast<QuicSpdyClientStream*>(stream);
 
@@ -146,6 +195,20 @@ void QuicSpdyClientBase::OnClose(QuicSpdyStream* stream) {
                                            client_stream->data());
   }
 
+  auto prefetched = prefetched_.find(stream->id());
+  if (prefetched != prefetched_.end()) {
+    // Nobody waits for this response yet, keep it until someone does.
+    PrefetchedResponse& response = prefetched->second;
+    response.closed = true;
+    response.end = std::chrono::steady_clock::now();
+    response.header_block = response_headers.Clone();
+    response.body = client_stream->data();
+    response.body_size = client_stream->body_size();
+    response.trailers = client_stream->received_trailers().DebugString();
+    response.frame_timings = client_stream->get_frame_timings();
+    return;
+  }
+
   // Store response headers and body.
   if (store_response_) {
     auto status = response_headers.find(":status");
@@ -158,6 +221,7 @@ void QuicSpdyClientBase::OnClose(QuicSpdyStream* stream) {
         client_stream->preliminary_headers().DebugString();
     latest_response_header_block_ = response_headers.Clone();
     latest_response_body_ = client_stream->data();
+    latest_response_body_size_ = client_stream->body_size();
     latest_response_trailers_ =
         client_stream->received_trailers().DebugString();
     latest_frame_timings_ = client_stream->get_frame_timings();
@@ -216,33 +280,193 @@ void QuicSpdyClientBase::SendRequestAndWaitForResponse(
     bool unreliable,
     DownloadConfig *dc) {
 
-  std::vector<SubSegmentTiming>::iterator sstit;
-  sstit = segment_timing[unreliable].insert(segment_timing[unreliable].end(), {0,0,0,0,0});
- 
   QuicSpdyClientStream *stream = SendRequest(headers, body, fin, unreliable, /*fec*/ 0);
 
-  start_time = std::chrono::system_clock::now();
+  auto start_time = std::chrono::steady_clock::now();
 
   stream->ResetReceived();
-  Reset();
+  WaitForResponse(stream, unreliable, dc, start_time, /*overlap_us=*/0);
+}
 
-  if (dc != nullptr) {
-    print_helper = dc->size;
+QuicStreamId QuicSpdyClientBase::SendPrefetchRequest(
+    const spdy::SpdyHeaderBlock& headers,
+    bool unreliable) {
+  QuicSpdyClientStream *stream = SendRequest(headers, /*body*/"", /*fin=*/true, unreliable, /*fec*/ 0);
+  if (stream == nullptr) {
+    return 0;
   }
-  last_received_ = 0;
-  idle_time = std::chrono::system_clock::now();
-  bola_timer = std::chrono::system_clock::now();
-  bola_throughput.clear();
-  bpp_moving_average_.Reset();
+  stream->ResetReceived();
 
-  while (WaitForEvents(stream, dc, /*idle_check*/ true)) {
+  PrefetchedResponse& response = prefetched_[stream->id()];
+  response.stream = stream;
+  response.closed = false;
+  response.start = std::chrono::steady_clock::now();
+  response.overlap_us = 0;
+  response.body_size = 0;
+  response.waited = false;
+  return stream->id();
+}
+
+void QuicSpdyClientBase::WaitForPrefetchedResponse(QuicStreamId id,
+                                                   bool unreliable,
+                                                   DownloadConfig *dc) {
+  auto it = prefetched_.find(id);
+  if (it == prefetched_.end()) {
+    std::cerr << "ERROR waiting for a request that was never prefetched - stopping!" << std::endl;
+    exit(-3);
   }
+  PrefetchedResponse response = std::move(it->second);
+  prefetched_.erase(it);
 
-  uint32_t time_rough = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start_time).count();
+  if (!response.closed) {
+    // OnClose() stores it as the latest response from now on. Abandonment
+    // checks measure from when the request was sent.
+    WaitForResponse(response.stream, unreliable, dc, response.start, response.overlap_us);
+    return;
+  }
 
+  latest_response_header_block_ = std::move(response.header_block);
+  latest_response_headers_ = latest_response_header_block_.DebugString();
+  preliminary_response_headers_.clear();
+  auto status = latest_response_header_block_.find(":status");
+  if (status == latest_response_header_block_.end() ||
+      !QuicTextUtils::StringToInt(status->second, &latest_response_code_)) {
+    QUIC_LOG(ERROR) << "Invalid response headers";
+  }
+  if (dc != nullptr && dc->body_destination != nullptr && !response.body.empty()) {
+    // Completed before anyone said where it goes.
+    size_t index = 0;
+    QuicSpdyClientStream::ScatterBody(response.body.data(), response.body.size(), 0,
+                                      *dc->body_scatter, &index, dc->body_destination,
+                                      dc->body_destination_length);
+    response.body.clear();
+  }
+  latest_response_body_ = std::move(response.body);
+  latest_response_body_size_ = response.body_size;
+  latest_response_trailers_ = std::move(response.trailers);
+  latest_frame_timings_ = std::move(response.frame_timings);
+
+  int64_t time_rough_us = ElapsedMicroseconds(response.start, response.end);
+  if (dc != nullptr && !response.waited) {
+    dc->ret__kept = true;
+    std::cerr << "[cancel-fin]"
+              << " rel:" << dc->reliable
+              << " t:" << time_rough_us / 1000.0
+              << " prefetched"
+              << std::endl;
+  }
+
+  RecordSegmentTiming(unreliable, time_rough_us, response.overlap_us, dc);
+}
 
-  sstit->received_size_ = 0;
-  sstit->time_ = 0;
+void QuicSpdyClientBase::CancelPrefetchRequest(QuicStreamId id) {
+  auto it = prefetched_.find(id);
+  if (it == prefetched_.end()) {
+    return;
+  }
+  if (!it->second.closed) {
+    InFlightDownload download = {};
+    download.stream = it->second.stream;
+    download.id = id;
+    CancelDownload(&download);
+  }
+  prefetched_.erase(id);
+}
+
+void QuicSpdyClientBase::WaitForPrefetchedResponses(
+    const std::vector<QuicStreamId>& ids,
+    const std::vector<DownloadConfig*>& dcs) {
+  std::vector<InFlightDownload> downloads;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    auto it = prefetched_.find(ids[i]);
+    if (it == prefetched_.end()) {
+      std::cerr << "ERROR waiting for a request that was never prefetched - stopping!" << std::endl;
+      exit(-3);
+    }
+    PrefetchedResponse& response = it->second;
+    response.waited = true;
+    if (!response.closed) {
+      downloads.push_back(StartDownload(response.stream, dcs[i], response.start));
+    } else if (dcs[i] != nullptr) {
+      dcs[i]->ret__kept = true;
+      std::cerr << "[cancel-fin]"
+                << " rel:" << dcs[i]->reliable
+                << " t:" << ElapsedMicroseconds(response.start, response.end) / 1000.0
+                << " prefetched"
+                << std::endl;
+    }
+  }
+
+  auto wait_start = std::chrono::steady_clock::now();
+
+  bool outstanding = !downloads.empty();
+  while (outstanding) {
+    outstanding = WaitForEvents(&downloads, /*idle_check*/ true);
+    bool abandoned = false;
+    for (auto& download : downloads) {
+      abandoned |= download.done && download.dc != nullptr && !download.dc->ret__kept;
+    }
+    if (outstanding && abandoned) {
+      for (auto& download : downloads) {
+        if (!download.done) {
+          CancelDownload(&download);
+          download.done = true;
+          if (download.dc != nullptr) {
+            std::cerr << "[cancel-reason] rel:" << download.dc->reliable << " abandoned-with-segment" << std::endl;
+          }
+        }
+      }
+      outstanding = false;
+    }
+  }
+
+  auto wait_end = std::chrono::steady_clock::now();
+  AddPrefetchOverlap(wait_start, wait_end);
+
+  // In the order they finished, each request counts the time after the one
+  // before it finished; what it ran before that is overlap.
+  std::vector<PrefetchedResponse*> finished;
+  for (auto& download : downloads) {
+    finished.push_back(&prefetched_[download.id]);
+  }
+  std::sort(finished.begin(), finished.end(),
+            [](const PrefetchedResponse* a, const PrefetchedResponse* b) { return a->end < b->end; });
+  auto counted = wait_start;
+  for (PrefetchedResponse* response : finished) {
+    auto from = std::max(response->start, wait_start);
+    auto to = std::min(counted, response->end);
+    if (to > from) {
+      response->overlap_us += ElapsedMicroseconds(from, to);
+    }
+    counted = std::max(counted, response->end);
+  }
+}
+
+void QuicSpdyClientBase::WaitForResponse(QuicSpdyClientStream* stream,
+                                         bool unreliable,
+                                         DownloadConfig *dc,
+                                         std::chrono::steady_clock::time_point start,
+                                         int64_t overlap_us) {
+
+  auto wait_start = std::chrono::steady_clock::now();
+
+  std::vector<InFlightDownload> downloads;
+  downloads.push_back(StartDownload(stream, dc, start));
+  while (WaitForEvents(&downloads, /*idle_check*/ true)) {
+  }
+
+  auto wait_end = std::chrono::steady_clock::now();
+  AddPrefetchOverlap(wait_start, wait_end);
+
+  RecordSegmentTiming(unreliable, ElapsedMicroseconds(start, wait_end), overlap_us, dc);
+}
+
+void QuicSpdyClientBase::RecordSegmentTiming(bool unreliable,
+                                             int64_t time_rough_us,
+                                             int64_t overlap_us,
+                                             DownloadConfig *dc) {
+  SubSegmentTiming entry = {0,0,0,0,0,0};
+  SubSegmentTiming* timing = &entry;
   if (latest_frame_timings_.empty()) {
     if ((dc != nullptr && dc->ret__kept) || dc == nullptr) {
       std::cerr << "ERROR got no frame/segment_timings - this is not supposed to happen - stopping!" << std::endl;
@@ -254,8 +478,12 @@ void QuicSpdyClientBase::SendRequestAndWaitForResponse(
   QuicTime earliest = QuicTime::Zero();
   QuicTime latest = QuicTime::Zero();
   bool earliest_initialized = false;
+  const size_t arrivals_before = segment_arrivals_.size();
   for (; quic_frame_it != latest_frame_timings_.end(); ++quic_frame_it) {
-    sstit->received_size_ += (quic_frame_it->second.was_lost) ? 0 : quic_frame_it->second.length;
+    timing->received_size_ += (quic_frame_it->second.was_lost) ? 0 : quic_frame_it->second.length;
+    if (!quic_frame_it->second.was_lost) {
+      segment_arrivals_.push_back({quic_frame_it->second.qt, quic_frame_it->second.length});
+    }
     if (!earliest_initialized || quic_frame_it->second.qt < earliest) {
       earliest = quic_frame_it->second.qt;
       earliest_initialized = true;
@@ -264,21 +492,57 @@ void QuicSpdyClientBase::SendRequestAndWaitForResponse(
       latest = quic_frame_it->second.qt;
     }
   }
-  sstit->time_ = (latest - earliest).ToMilliseconds();
-  // if for whatever reason this time is below 1ms, round up to 1ms
-  sstit->time_rough_ = (!time_rough)?1:time_rough;
-
+  // The frames are in offset order; requests of one segment may have been in
+  // flight together, so merge them by receipt time.
+  auto by_receipt_time = [](const FrameArrival& a, const FrameArrival& b) { return a.qt < b.qt; };
+  std::sort(segment_arrivals_.begin() + arrivals_before, segment_arrivals_.end(), by_receipt_time);
+  std::inplace_merge(segment_arrivals_.begin(), segment_arrivals_.begin() + arrivals_before,
+                     segment_arrivals_.end(), by_receipt_time);
+
+  timing->time_us_ = (latest - earliest).ToMicroseconds();
+  // if for whatever reason this time is below 1us, round up to 1us
+  timing->time_rough_us_ = (time_rough_us <= 0)?1:time_rough_us;
+  timing->overlap_us_ = std::min(overlap_us, timing->time_rough_us_);
+
+  // bits / us * 1000 === kbps
   if (!fine_) {
-    sstit->time_ = time_rough;
-    sstit->throughput_ = (latest_response_body_.size() * 8) / sstit->time_;
+    timing->time_us_ = timing->time_rough_us_;
+    timing->throughput_ = (latest_response_body_size_ * 8 * 1000.0) / timing->time_us_;
   } else {
-    // Time measured was below 1 ms.
-    if (sstit->time_ == 0) {
-      sstit->time_ = 1;
+    // Only one frame arrived, or all at once.
+    if (timing->time_us_ <= 0) {
+      timing->time_us_ = 1;
+    }
+    timing->throughput_ = (timing->received_size_ * 8 * 1000.0) / timing->time_us_;
+  }
+  timing->segment_size_ = latest_response_body_size_;
+
+  segment_timing[unreliable].push_back(entry);
+  SubSegmentTimingSums sums = segment_timing_sums[unreliable].back();
+  ++sums.count_;
+  sums.bits_ += entry.throughput_ * entry.time_us_;
+  sums.time_us_ += entry.time_us_;
+  sums.exclusive_time_us_ += ExclusiveTime(entry);
+  sums.segment_size_ += entry.segment_size_;
+  sums.received_size_ += entry.received_size_;
+  segment_timing_sums[unreliable].push_back(sums);
+}
+
+void QuicSpdyClientBase::AddPrefetchOverlap(
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end) {
+  for (auto& prefetched : prefetched_) {
+    PrefetchedResponse& response = prefetched.second;
+    if (response.waited) {
+      // Its own wait already told the overlap apart.
+      continue;
+    }
+    auto from = std::max(start, response.start);
+    auto to = response.closed ? std::min(end, response.end) : end;
+    if (to > from) {
+      response.overlap_us += ElapsedMicroseconds(from, to);
     }
-    sstit->throughput_ = (sstit->received_size_ * 8) / sstit->time_;
   }
-  sstit->segment_size_ = latest_response_body_.size();
 }
 
 void QuicSpdyClientBase::SendRequestAndWaitForResponse(
@@ -437,6 +701,11 @@ const string& QuicSpdyClientBase::latest_response_body() const {
   return latest_response_body_;
 }
 
+size_t QuicSpdyClientBase::latest_response_body_size() const {
+  QUIC_BUG_IF(!store_response_) << "Response not stored!";
+  return latest_response_body_size_;
+}
+
 const std::map < QuicStreamOffset, FrameTiming >& QuicSpdyClientBase::latest_response_timings() const {
   QUIC_BUG_IF(!store_response_) << "Response not stored!";
   return latest_frame_timings_;
@@ -444,7 +713,7 @@ const std::map < QuicStreamOffset, FrameTiming >& QuicSpdyClientBase::latest_res
 
 const SubSegmentTiming QuicSpdyClientBase::latest_segment_timing(bool unrel) const {
   if (segment_timing[unrel].empty()) {
-    return {0, 0, 0, 0, 0};
+    return {0, 0, 0, 0, 0, 0};
   }
   return segment_timing[unrel].back();
 }
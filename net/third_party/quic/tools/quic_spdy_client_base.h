@@ -8,7 +8,10 @@
 #ifndef NET_THIRD_PARTY_QUIC_TOOLS_QUIC_SPDY_CLIENT_BASE_H_
 #define NET_THIRD_PARTY_QUIC_TOOLS_QUIC_SPDY_CLIENT_BASE_H_
 
+#include <chrono>
+#include <map>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "net/third_party/quic/core/crypto/crypto_handshake.h"
@@ -27,16 +30,38 @@ enum {
   sst_unrel = 1
 };
 
+// All times are in microseconds, throughput_ is in kbps.
 typedef struct {
-  uint32_t time_;
-  uint32_t time_rough_;
+  int64_t  time_us_;
+  int64_t  time_rough_us_;
   double   throughput_;
   size_t   segment_size_;
   size_t   received_size_;
+  // Part of time_rough_us_ during which the client waited for another
+  // request of the same or the next segment, already counted by that one.
+  int64_t  overlap_us_;
 } SubSegmentTiming;
 
 typedef std::vector<SubSegmentTiming> SegmentTiming;
 
+// Sums over consecutive SubSegmentTimings of one kind.
+typedef struct {
+  size_t   count_;
+  // throughput_ times time_us_.
+  double   bits_;
+  int64_t  time_us_;
+  // time_us_ without overlap_us_, at least 1us per request.
+  int64_t  exclusive_time_us_;
+  double   segment_size_;
+  double   received_size_;
+} SubSegmentTimingSums;
+
+// Receipt time and length of a frame that carried data.
+typedef struct {
+  QuicTime qt;
+  size_t   length;
+} FrameArrival;
+
 
 class ProofVerifier;
 class QuicServerId;
@@ -104,9 +129,12 @@ class QuicSpdyClientBase : public QuicClientBase,
 
 
   double GetThroughput(bool unrel)   { return segment_timing[unrel].empty() ? 0 : segment_timing[unrel].back().throughput_; };
-  uint32_t GetTime(bool unrel)       { return segment_timing[unrel].empty() ? 0 : segment_timing[unrel].back().time_; };
-  uint32_t GetTime()       { return GetTime(sst_unrel) + GetTime(sst_rel); };
-  uint32_t GetRealTime(bool unrel)   { return segment_timing[unrel].empty() ? 0 : segment_timing[unrel].back().time_rough_; };
+  // Times are in microseconds.
+  int64_t GetTime(bool unrel)       { return segment_timing[unrel].empty() ? 0 : segment_timing[unrel].back().time_us_; };
+  // Requests in flight together overlap; the time of both is counted once.
+  int64_t GetTime()       { return GetExclusiveTime(sst_unrel) + GetExclusiveTime(sst_rel); };
+  // Wall-clock time the client spent on the latest request alone.
+  int64_t GetRealTime(bool unrel)   { return segment_timing[unrel].empty() ? 0 : segment_timing[unrel].back().time_rough_us_ - segment_timing[unrel].back().overlap_us_; };
 
   double GetSegmentSize(bool unrel)  { return segment_timing[unrel].empty() ? 0 : segment_timing[unrel].back().segment_size_; };
   double GetSegmentSize()  { return GetSegmentSize(sst_unrel) + GetSegmentSize(sst_rel);};
@@ -116,8 +144,8 @@ class QuicSpdyClientBase : public QuicClientBase,
 
   std::pair<double,double>   GetSumThroughput(bool unrel);
   double   GetSumThroughput();
-  uint32_t GetSumTime(bool unrel);
-  uint32_t GetSumTime() { return GetSumTime(sst_unrel) + GetSumTime(sst_rel); };
+  int64_t  GetSumTime(bool unrel);
+  int64_t  GetSumTime();
   double   GetSumSegmentSize(bool unrel);
   double   GetSumSegmentSize() { return GetSumSegmentSize(sst_unrel) + GetSumSegmentSize(sst_rel); };
   double   GetSumReceivedSize(bool unrel);
@@ -125,6 +153,19 @@ class QuicSpdyClientBase : public QuicClientBase,
 
   void ResetAllTimings();
 
+  // What the connection's sent packet manager knows about the path, for the
+  // ABR and the safety margin of the abandonment checks. All zero before the
+  // session exists.
+  TransportStats GetTransportStats();
+
+  // Sums over the latest |n| requests of |unrel| since ResetAllTimings(), or
+  // over all of them if there are fewer. O(1), like the GetSum*() queries.
+  SubSegmentTimingSums GetWindowSums(bool unrel, size_t n) const;
+
+  // Data frames of all requests since ResetAllTimings(), ordered by receipt
+  // time. Zero-filled holes of unreliable responses are left out.
+  const std::vector<FrameArrival>& segment_arrivals() const { return segment_arrivals_; }
+
   // QuicSpdyStream::Visitor
   void OnClose(QuicSpdyStream* stream) override;
 
@@ -151,6 +192,33 @@ class QuicSpdyClientBase : public QuicClientBase,
                                      bool unreliable,
                                      DownloadConfig *dc);
 
+  // Sends an HTTP request whose response is collected later by
+  // WaitForPrefetchedResponse(), so that it downloads while the client waits
+  // for other requests. Returns 0 if the request could not be sent.
+  QuicStreamId SendPrefetchRequest(const spdy::SpdyHeaderBlock& headers,
+                                   bool unreliable);
+
+  // Like SendRequestAndWaitForResponse() for a request sent by
+  // SendPrefetchRequest(). The recorded SubSegmentTiming tells apart the time
+  // spent waiting for other requests while it was in flight, so that
+  // overlapping requests never count the same time twice.
+  void WaitForPrefetchedResponse(QuicStreamId id,
+                                 bool unreliable,
+                                 DownloadConfig *dc);
+
+  // Waits for the prefetched requests |ids| together, each abandoned on its
+  // own by |dcs| (same order, entries may be null). Abandoning one without
+  // keeping its data cancels the others, the segment is retried anyway.
+  // Collect every response with WaitForPrefetchedResponse() afterwards.
+  void WaitForPrefetchedResponses(const std::vector<QuicStreamId>& ids,
+                                  const std::vector<DownloadConfig*>& dcs);
+
+  // Resets a request sent by SendPrefetchRequest() that is no longer wanted
+  // and drops its response. Does nothing if |id| was not prefetched.
+  void CancelPrefetchRequest(QuicStreamId id);
+
+  size_t prefetched_requests() const { return prefetched_.size(); }
+
   // Sends a request simple GET for each URL in |url_list|, and then waits for
   // each to complete.
   void SendRequestsAndWaitForResponse(const std::vector<std::string>& url_list);
@@ -187,6 +255,8 @@ class QuicSpdyClientBase : public QuicClientBase,
   const SegmentTiming& all_latest_segment_timing(bool unrel) const { return segment_timing[unrel]; };
   const spdy::SpdyHeaderBlock& latest_response_header_block() const;
   const std::string& latest_response_body() const;
+  // Also counts body written to a DownloadConfig's body_destination.
+  size_t latest_response_body_size() const;
   const std::string& latest_response_trailers() const;
 
   void set_response_listener(std::unique_ptr<ResponseListener> listener) {
@@ -221,6 +291,43 @@ class QuicSpdyClientBase : public QuicClientBase,
                               uint8_t fec);
 
  private:
+  // A request sent by SendPrefetchRequest() that nobody waits for yet. Its
+  // response is kept here when it completes, instead of in latest_*.
+  struct PrefetchedResponse {
+    QuicSpdyClientStream* stream;
+    bool closed;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+    // Time (us) the client spent waiting for other requests while this one
+    // was in flight.
+    int64_t overlap_us;
+    // Its abandonment checks already ran in WaitForPrefetchedResponses().
+    bool waited;
+    spdy::SpdyHeaderBlock header_block;
+    std::string body;
+    size_t body_size;
+    std::string trailers;
+    std::map<QuicStreamOffset, FrameTiming> frame_timings;
+  };
+
+  // Waits for |stream|, sent at |start|, and records its SubSegmentTiming
+  // with |overlap_us| spent waiting for other requests.
+  void WaitForResponse(QuicSpdyClientStream* stream,
+                       bool unreliable,
+                       DownloadConfig *dc,
+                       std::chrono::steady_clock::time_point start,
+                       int64_t overlap_us);
+  // Appends the timing of the latest response to segment_timing[unreliable].
+  void RecordSegmentTiming(bool unreliable,
+                           int64_t time_rough_us,
+                           int64_t overlap_us,
+                           DownloadConfig *dc);
+  // time_us_ of the latest request of |unrel| without its overlap.
+  int64_t GetExclusiveTime(bool unrel);
+  // Charges the wait [start, end) to every prefetched request in flight.
+  void AddPrefetchOverlap(std::chrono::steady_clock::time_point start,
+                          std::chrono::steady_clock::time_point end);
+
   // Specific QuicClient class for storing data to resend.
   class ClientQuicDataToResend : public QuicDataToResend {
    public:
@@ -260,6 +367,7 @@ class QuicSpdyClientBase : public QuicClientBase,
   spdy::SpdyHeaderBlock latest_response_header_block_;
   // Body of most recent response.
   std::string latest_response_body_;
+  size_t latest_response_body_size_;
   // Quic frame-timings of most recent response
   std::map < QuicStreamOffset, FrameTiming > latest_frame_timings_;
 
@@ -276,6 +384,12 @@ class QuicSpdyClientBase : public QuicClientBase,
   std::unique_ptr<ClientQuicDataToResend> push_promise_data_to_resend_;
 
   SegmentTiming segment_timing[2];
+  // segment_timing_sums[u][k] sums the first k entries of segment_timing[u],
+  // so any window of them is one subtraction.
+  std::vector<SubSegmentTimingSums> segment_timing_sums[2];
+  std::vector<FrameArrival> segment_arrivals_;
+
+  std::map<QuicStreamId, PrefetchedResponse> prefetched_;
 
   bool fine_;
 };
@@ -1,90 +1,115 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
 #include "net/tools/quic/abr.h"
-#include "net/tools/quic/bola.h"
-#include "net/tools/quic/tput.h"
-#include "net/tools/quic/mpc.h"
 
 //#define SLST_DEBUG
 
 BaseAbr::~BaseAbr() {
 }
 
-int Dispatcher::GetPause(BolaAbr &bola) {
-  return bola.pause;
-}
-
-int Dispatcher::GetPause(MpcAbr &mpc) {
-  return mpc.pause;
+void BaseAbr::LogDecision(double buffer_level, double segment_duration,
+                          double throughput, int quality, double bitrate,
+                          double pause, int retry)
+{
+  AbrLogLine log_line;
+  if (!has_log_line_) {
+    log_line.playhead_time_ = -buffer_level;
+  } else {
+    log_line.playhead_time_ = last_log_line_.playhead_time_ + segment_duration +
+      last_log_line_.buffer_level_ - buffer_level;
+  }
+  log_line.buffer_level_ = buffer_level;
+  log_line.throughput_ = throughput;
+  log_line.quality_ = quality;
+  log_line.bitrate_ = bitrate;
+  log_line.pause_ = pause;
+  last_log_line_ = log_line;
+  has_log_line_ = true;
+
+  if (!decision_log_) {
+    return;
+  }
+  AbrLogRecord record = {};
+  record.type = kAbrLogDecision;
+  record.retry = retry;
+  record.quality = quality;
+  record.playhead_time = log_line.playhead_time_;
+  record.buffer_level = buffer_level;
+  record.throughput = throughput;
+  record.bitrate = bitrate;
+  record.pause = pause;
+  decision_log_->Append(record);
+}
+
+void BaseAbr::LogEvent(AbrLogType type, double buffer_level, double pause,
+                       double placeholder, int retry)
+{
+  AbrLogRecord record = {};
+  record.type = type;
+  record.retry = retry;
+  record.quality = -1;
+  record.buffer_level = buffer_level;
+  record.pause = pause;
+  record.placeholder = placeholder;
+  decision_log_->Append(record);
 }
 
-int Dispatcher::GetPause(ThroughputAbr &tput) {
-  return tput.pause;
+double SafetyMargin(const TransportStats& stats)
+{
+  if (stats.srtt <= 0.0) {
+    return kDefaultSafetyMargin;
+  }
+  return std::max(stats.srtt + 4 * stats.rttvar, kMinSafetyMargin);
 }
 
-int Dispatcher::GetBuffer(BolaAbr &bola) {
-  return bola.GetBuffer();
+void SegmentQualities::clear() {
+  ssim.clear();
+  size.clear();
+  reliable_size.clear();
+  quality.clear();
+  required_frames.clear();
 }
 
-int Dispatcher::GetBuffer(MpcAbr &mpc) {
-  return mpc.GetBuffer();
+void SegmentQualities::Add(double option_ssim, const SSIMBasedQuality& option) {
+  ssim.push_back(option_ssim);
+  size.push_back(option.size);
+  reliable_size.push_back(option.reliable_size);
+  quality.push_back(option.quality);
+  required_frames.push_back(option.required_frames);
 }
 
-int Dispatcher::GetBuffer(ThroughputAbr &tput) {
-  return tput.GetBuffer();
-}
+namespace {
 
-void Dispatcher::SetBuffer(BolaAbr &bola, int lvl) {
-  bola.SetBuffer(lvl);
-}
-void Dispatcher::SetBuffer(ThroughputAbr &tput, int lvl) {
-  tput.SetBuffer(lvl);
-
-}
-void Dispatcher::SetBuffer(MpcAbr &mpc, int lvl){
-  mpc.SetBuffer(lvl);
+template <typename T>
+void Permute(std::vector<T>* column, const std::vector<size_t>& order) {
+  std::vector<T> sorted(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    sorted[i] = (*column)[order[i]];
+  }
+  column->swap(sorted);
 }
 
+}  // namespace
 
-double Dispatcher::GetQuality(BolaAbr &bola, int retry, const std::map<double, SSIMBasedQuality>& ssim_map) {
-  double pause = 0.0;
-
-  double tp = transport_->AddThroughput();
-  uint32_t time = transport_->GetTime(/*unrel=*/true);
-
-  bola.PreUpdate(pause, time, retry);
-  double ssim = bola.GetQuality(tp, &pause, retry, ssim_map);
-  bola.PostUpdate(pause, time, retry);
-  
-  return ssim;
+void SegmentQualities::Sort() {
+  std::vector<size_t> order(options());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [this](size_t a, size_t b) { return ssim[a] < ssim[b]; });
+  Permute(&ssim, order);
+  Permute(&size, order);
+  Permute(&reliable_size, order);
+  Permute(&quality, order);
+  Permute(&required_frames, order);
 }
 
-double Dispatcher::GetQuality(ThroughputAbr &tput, int retry) {
-  double pause = 0.0;
-
-  double tp = transport_->AddThroughput();
-  uint32_t time = transport_->GetTime(/*unrel=*/true);
-
-  tput.PreUpdate(pause, time);
-  int q = tput.GetQuality(tp, &pause);
-  tput.PostUpdate(pause, time);
-
-  return (double)q;
+SSIMBasedQuality SegmentQualities::at(int option) const {
+  return {size.at(option), reliable_size.at(option), quality.at(option),
+          required_frames.at(option)};
 }
 
-double Dispatcher::GetQuality(MpcAbr &mpc, int retry) {
-  double pause = 0.0;
-
-  double tp = transport_->AddThroughput();
-  uint32_t time = transport_->GetTime(/*unrel=*/true);
-  double segment_size = transport_->GetSegmentSize(/*unrel=*/false) + transport_->GetSegmentSize(/*unrel=*/true);
-
-  mpc.PreUpdate(pause, time, segment_size);
-  int q = mpc.GetQuality(tp, &pause);
-  mpc.PostUpdate(pause, time);
-
-  return (double)q;
-}
-
-
 MovingAverage::MovingAverage()
     : throughput_slow_(0.0),
       throughput_fast_(0.0),
@@ -102,14 +127,39 @@ void MovingAverage::AddMeasurement(double throughput, double time)
 }
 
 double MovingAverage::GetThroughput()
+{
+  if (cumulative_time_ <= 0.0) {
+    return 0.0;
+  }
+  return std::min(GetSlow(), GetFast());
+}
+
+double MovingAverage::GetSlow()
 {
   if (cumulative_time_ <= 0.0) {
     return 0.0;
   }
   // zero factor avoids low estimates until average warms up
   double zero_factor = 1.0 - std::pow(0.5, cumulative_time_ / kHalfLifeSlow);
-  double slow = throughput_slow_ / zero_factor;
-  zero_factor = 1.0 - std::pow(0.5, cumulative_time_ / kHalfLifeFast);
-  double fast = throughput_fast_ / zero_factor;
-  return std::min(slow, fast);
+  return throughput_slow_ / zero_factor;
+}
+
+double MovingAverage::GetFast()
+{
+  if (cumulative_time_ <= 0.0) {
+    return 0.0;
+  }
+  double zero_factor = 1.0 - std::pow(0.5, cumulative_time_ / kHalfLifeFast);
+  return throughput_fast_ / zero_factor;
+}
+
+void MovingAverage::Seed(double slow, double fast)
+{
+  if (slow <= 0.0 || fast <= 0.0) {
+    return;
+  }
+  cumulative_time_ = kHalfLifeSlow;
+  // Undo the zero factor GetSlow() and GetFast() apply.
+  throughput_slow_ = slow * (1.0 - std::pow(0.5, cumulative_time_ / kHalfLifeSlow));
+  throughput_fast_ = fast * (1.0 - std::pow(0.5, cumulative_time_ / kHalfLifeFast));
 }
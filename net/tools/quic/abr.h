@@ -3,12 +3,18 @@
 
 //#include "net/tools/quic/quic_simple_client.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <memory>
 #include <vector>
 #include <map>
 #include <string>
 #include <unordered_map>
 
+#include "net/tools/quic/abr_log.h"
+#include "net/tools/quic/session_prior.h"
+
+class BolaAbandonEvaluator;
+
 typedef struct {
   size_t size; // Size in bytes
   size_t reliable_size; // Amount of total_size that is attributed to reliable headers and frames
@@ -16,6 +22,24 @@ typedef struct {
   uint32_t required_frames; // Frame count in range [0-95] (for 4s segments)
 } SSIMBasedQuality;
 
+// All download options of one segment as parallel arrays, sorted by ascending
+// ssim once after the MPD is parsed. Options are addressed by their index.
+struct SegmentQualities {
+  std::vector<double> ssim;
+  std::vector<size_t> size;
+  std::vector<size_t> reliable_size;
+  std::vector<int> quality;
+  std::vector<uint32_t> required_frames;
+
+  size_t options() const { return ssim.size(); }
+  bool empty() const { return ssim.empty(); }
+  void clear();
+  void Add(double option_ssim, const SSIMBasedQuality& option);
+  // Stable sort of all columns by ssim.
+  void Sort();
+  SSIMBasedQuality at(int option) const;
+};
+
 /*
 typedef struct {
   uint32_t frames;
@@ -39,8 +63,6 @@ typedef struct {
   std::vector<segment> segments;
 } repr;
 
-enum DP {GQ, GB, GP, SB};
-
 struct AbrLogLine {
   double playhead_time_;
   double buffer_level_;
@@ -50,54 +72,123 @@ struct AbrLogLine {
   double pause_;
 };
 
+// Connection-level state of the transport as seen by the client's
+// congestion controller. Times in ms, zero until measured.
+struct TransportStats {
+  double srtt;
+  double rttvar;
+  double min_rtt;
+  // Congestion window (bytes) and bandwidth estimate (kbps) of what the
+  // client sends, which is little more than its requests.
+  size_t cwnd;
+  double bandwidth;
+  size_t packets_sent;
+  size_t packets_lost;
+  size_t packets_received;
+  size_t packets_reordered;
+};
+
+// Time (ms) a download must leave in the buffer when it is done: a
+// retransmission timeout's worth (srtt + 4 * rttvar), so that the last
+// packets can still be recovered. kDefaultSafetyMargin until the RTT is known.
+double SafetyMargin(const TransportStats& stats);
+constexpr double kDefaultSafetyMargin = 70;
+constexpr double kMinSafetyMargin = 10;
+
 class TransportInterface {
 	public:
 		virtual double AddThroughput() = 0;
 		virtual double GetTput() = 0;
-		virtual uint32_t GetTime(bool) = 0;
-		virtual uint32_t GetTime() = 0;
-		virtual uint32_t GetRealTime(bool) = 0;
+		// Times are in microseconds.
+		virtual int64_t GetTime(bool) = 0;
+		virtual int64_t GetTime() = 0;
+		virtual int64_t GetRealTime(bool) = 0;
 		virtual double GetSegmentSize(bool) = 0;
+		// Variance (kbps^2) of the AddThroughput() estimate, 0 if the
+		// estimator does not know it.
+		virtual double GetTputVariance() { return 0; }
+		// Snapshot of the connection, all zero if there is none.
+		virtual TransportStats GetTransportStats() { return TransportStats(); }
+		// Continues from what SavePrior() kept of a previous session with the
+		// same server.
+		virtual void WarmStart(const EstimatorPrior& prior) {}
+		virtual void SavePrior(EstimatorPrior* prior) {
+			prior->throughput = GetTput();
+			prior->throughput_variance = GetTputVariance();
+		}
 };
 
-class BolaAbr;
-class ThroughputAbr;
-class MpcAbr;
-
-
-class Dispatcher {
-	public:
-		Dispatcher(TransportInterface* transport) 
-		: transport_(transport) {};
-
-		double GetQuality(BolaAbr &bola, int retry, const std::map<double, SSIMBasedQuality>& ssim_map);
-		double GetQuality(ThroughputAbr &tput, int retry);
-		double GetQuality(MpcAbr &mpc, int retry);
-
-		int GetPause(BolaAbr &bola);
-		int GetPause(ThroughputAbr &tput);
-		int GetPause(MpcAbr &mpc);
-
-		int GetBuffer(BolaAbr &bola);
-		int GetBuffer(ThroughputAbr &tput);
-		int GetBuffer(MpcAbr &mpc);
-
-		void SetBuffer(BolaAbr &bola, int lvl);
-		void SetBuffer(ThroughputAbr &tput, int lvl);
-		void SetBuffer(MpcAbr &mpc, int lvl);
+// Outcome of an ABR decision.
+struct AbrDecision {
+	// Index into the segment's SegmentQualities, -1 if the ABR chose from the
+	// bitrate ladder only.
+	int option;
+	// Index into the bitrate ladder.
+	int quality;
+	// Time (ms) to wait before requesting the segment.
+	double pause;
+	// Bytes the ABR expects to download for the choice.
+	size_t expected_size;
+};
 
-	private:
-		TransportInterface* transport_;
+// What an ABR gets from the throughput estimator for one decision.
+struct AbrInput {
+	double throughput;
+	// Variance (kbps^2) of |throughput|, 0 if unknown.
+	double throughput_variance;
+	// Download time (ms) of the latest segment, not rounded.
+	double time;
+	double segment_size;
+	TransportStats transport;
 };
 
 class BaseAbr {
 public:
-	virtual double accept(Dispatcher &dispatcher, DP type, int, const std::map<double, SSIMBasedQuality>&) = 0;
 	virtual ~BaseAbr() = 0;
+	// Decisions and buffer events go to |log| instead of std::cerr.
+	void SetDecisionLog(AbrDecisionLog* log) { decision_log_ = log; }
 
     double buffer_size_;
 protected:
   	bool startup;
+	// Keeps the playhead position of the decision taken at |buffer_level| and
+	// appends it to the decision log, if any.
+	void LogDecision(double buffer_level, double segment_duration,
+	                 double throughput, int quality, double bitrate,
+	                 double pause, int retry);
+	void LogEvent(AbrLogType type, double buffer_level, double pause,
+	              double placeholder, int retry);
+
+	AbrDecisionLog* decision_log_ = nullptr;
+	// Only the previous line is needed to place the next one on the playhead.
+	AbrLogLine last_log_line_;
+	bool has_log_line_ = false;
+};
+
+// Runtime handle of the Abr<Policy, Estimator> chosen on the command line, as
+// used by the client and by the abandonment checks of in-flight downloads.
+class AbrInterface {
+	public:
+		virtual ~AbrInterface() {}
+		virtual AbrDecision GetDecision(int retry, const SegmentQualities& qualities) = 0;
+		// Decision for the first segment, from the estimate alone, once the
+		// estimator was warm-started. Nothing was downloaded in this session
+		// yet, so the buffer does not change.
+		virtual AbrDecision GetStartupDecision(const SegmentQualities& qualities) = 0;
+		// Captures in |in_flight| what DecideInFlight() needs for the download
+		// that is about to start, either over |qualities| or, if null, over one
+		// option per quality sized by |sizes_bits| (the bitrates if empty).
+		virtual void StartInFlight(BolaAbandonEvaluator* in_flight,
+		                           const SegmentQualities* qualities,
+		                           const std::vector<double>& sizes_bits) = 0;
+		// Decision for the current segment with the download of |in_flight| in
+		// progress; does not change the ABR state.
+		virtual AbrDecision DecideInFlight(const BolaAbandonEvaluator& in_flight,
+		                                   double buffer_level, double throughput) = 0;
+		// Buffer level (ms).
+		virtual double GetBuffer() = 0;
+		virtual void SetBuffer(double lvl) = 0;
+		virtual double buffer_size() = 0;
 };
 
 enum ThroughputEstimates {
@@ -112,6 +203,12 @@ class MovingAverage {
   MovingAverage();
   void AddMeasurement(double bandwidth, double time);
   double GetThroughput();
+  // Bias corrected averages, 0 before the first measurement.
+  double GetSlow();
+  double GetFast();
+  // Continues from averages of a previous session, weighted as kHalfLifeSlow
+  // worth of measurements.
+  void Seed(double slow, double fast);
  private:
   double throughput_slow_;
   double throughput_fast_;
@@ -121,39 +218,63 @@ class MovingAverage {
 };
 
 
-class Abr {
+// Binds an ABR policy (BolaAbr, MpcAbr, ThroughputAbr) to a throughput
+// estimator (a TransportInterface implementation). Policy calls are resolved
+// at compile time; only the AbrInterface entry points are virtual.
+template <typename Policy, typename Estimator>
+class Abr final : public AbrInterface {
 	public:
-		Abr(BaseAbr* abr, TransportInterface* transport) 
-		: disp(Dispatcher(transport)),
-		  abr_(abr) {};
-		Abr() 
-		: disp(Dispatcher(nullptr)) {};
-
-	void SetAbr(BaseAbr* abr) {
-		abr_ = abr;
+		Abr(Policy* policy, Estimator* estimator)
+		: policy_(policy),
+		  estimator_(estimator) {}
+
+	AbrDecision GetDecision(int retry, const SegmentQualities& qualities) override {
+		AbrInput input;
+		input.throughput = estimator_->AddThroughput();
+		input.throughput_variance = estimator_->GetTputVariance();
+		input.time = estimator_->GetTime(/*unrel=*/true) / 1000.0;
+		input.segment_size = estimator_->GetSegmentSize(/*unrel=*/false) +
+		                     estimator_->GetSegmentSize(/*unrel=*/true);
+		input.transport = estimator_->GetTransportStats();
+		return policy_->Decide(input, retry, qualities);
+	}
+	AbrDecision GetStartupDecision(const SegmentQualities& qualities) override {
+		AbrInput input;
+		input.throughput = estimator_->GetTput();
+		input.throughput_variance = estimator_->GetTputVariance();
+		input.time = 0;
+		input.segment_size = 0;
+		input.transport = estimator_->GetTransportStats();
+		return policy_->DecideStartup(input, qualities);
+	}
+	void StartInFlight(BolaAbandonEvaluator* in_flight,
+	                   const SegmentQualities* qualities,
+	                   const std::vector<double>& sizes_bits) override {
+		policy_->StartInFlight(in_flight, qualities, sizes_bits);
 	}
-	void SetTransport(TransportInterface* transport) {
-		disp = Dispatcher(transport);
+	AbrDecision DecideInFlight(const BolaAbandonEvaluator& in_flight,
+	                           double buffer_level, double throughput) override {
+		return policy_->DecideInFlight(in_flight, buffer_level, throughput);
 	}
-	double GetQuality(int retry, const std::map<double, SSIMBasedQuality>& ssim_map) {
-		return abr_->accept(disp, GQ, retry, ssim_map);
+	double GetBuffer() override {
+		return policy_->GetBuffer();
 	}
-	int GetPause() {
-		return abr_->accept(disp, GP, 0, {});
+	void SetBuffer(double lvl) override {
+		policy_->SetBuffer(lvl);
 	}
-	int GetBuffer() {
-		return abr_->accept(disp, GB, 0, {});
+	double buffer_size() override {
+		return policy_->buffer_size_;
 	}
-	void SetBuffer(int lvl) {
-		abr_->accept(disp, SB, lvl, {});
+	Policy* policy() {
+		return policy_;
 	}
-	BaseAbr* instance() {
-		return abr_;
+	Estimator* estimator() {
+		return estimator_;
 	}
 
 private:
-	Dispatcher disp;
-	BaseAbr* abr_;
+	Policy* policy_;
+	Estimator* estimator_;
 };
 
 #endif //ABR_SCHEMES
@@ -0,0 +1,142 @@
+#include "net/tools/quic/abr_log.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+AbrDecisionLog::AbrDecisionLog()
+    : head_(0),
+      tail_(0),
+      dropped_(0),
+      running_(false),
+      seq_(0),
+      fd_(-1),
+      chunk_(nullptr),
+      chunk_index_(0),
+      chunk_used_(0),
+      written_(0)
+{
+}
+
+AbrDecisionLog::~AbrDecisionLog()
+{
+  Close();
+}
+
+bool AbrDecisionLog::Open(const std::string& path)
+{
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    std::cerr << "[abr-log] cannot create " << path << std::endl;
+    return false;
+  }
+  if (!MapChunk(0)) {
+    std::cerr << "[abr-log] cannot map " << path << std::endl;
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  // The header is rewritten with the final counts on Close().
+  chunk_used_ = sizeof(AbrLogHeader);
+
+  running_ = true;
+  flusher_ = std::thread(&AbrDecisionLog::FlushLoop, this);
+  return true;
+}
+
+void AbrDecisionLog::Close()
+{
+  if (fd_ < 0) {
+    return;
+  }
+  running_ = false;
+  if (flusher_.joinable()) {
+    flusher_.join();
+  }
+  Flush();
+  munmap(chunk_, kChunkBytes);
+  chunk_ = nullptr;
+
+  AbrLogHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "ABRL", 4);
+  header.version = kVersion;
+  header.record_size = sizeof(AbrLogRecord);
+  header.records = written_;
+  header.dropped = dropped();
+  if (pwrite(fd_, &header, sizeof(header), 0) != sizeof(header) ||
+      ftruncate(fd_, sizeof(header) + written_ * sizeof(AbrLogRecord)) != 0) {
+    std::cerr << "[abr-log] cannot finalize log" << std::endl;
+  }
+  close(fd_);
+  fd_ = -1;
+  std::cerr << "[abr-log] records:" << written_ << " dropped:" << dropped()
+            << std::endl;
+}
+
+void AbrDecisionLog::Append(AbrLogRecord record)
+{
+  const uint64_t head = head_.load(std::memory_order_relaxed);
+  if (head - tail_.load(std::memory_order_acquire) >= kCapacity) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  record.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  record.seq = seq_++;
+  ring_[head & (kCapacity - 1)] = record;
+  head_.store(head + 1, std::memory_order_release);
+}
+
+void AbrDecisionLog::FlushLoop()
+{
+  const int interval_ms = kFlushIntervalMs;
+  while (running_) {
+    Flush();
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+  }
+}
+
+void AbrDecisionLog::Flush()
+{
+  uint64_t tail = tail_.load(std::memory_order_relaxed);
+  const uint64_t head = head_.load(std::memory_order_acquire);
+  for (; tail != head; ++tail) {
+    if (chunk_used_ == kChunkBytes) {
+      munmap(chunk_, kChunkBytes);
+      chunk_ = nullptr;
+      if (!MapChunk(chunk_index_ + 1)) {
+        std::cerr << "[abr-log] cannot extend log, dropping records"
+                  << std::endl;
+        dropped_.fetch_add(head - tail, std::memory_order_relaxed);
+        tail_.store(head, std::memory_order_release);
+        return;
+      }
+      chunk_used_ = 0;
+    }
+    memcpy(chunk_ + chunk_used_, &ring_[tail & (kCapacity - 1)],
+           sizeof(AbrLogRecord));
+    chunk_used_ += sizeof(AbrLogRecord);
+    ++written_;
+  }
+  tail_.store(tail, std::memory_order_release);
+}
+
+bool AbrDecisionLog::MapChunk(size_t index)
+{
+  if (ftruncate(fd_, (index + 1) * kChunkBytes) != 0) {
+    return false;
+  }
+  void* chunk = mmap(nullptr, kChunkBytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd_, index * kChunkBytes);
+  if (chunk == MAP_FAILED) {
+    return false;
+  }
+  chunk_ = static_cast<char*>(chunk);
+  chunk_index_ = index;
+  return true;
+}
@@ -0,0 +1,97 @@
+#ifndef ABR_LOG
+#define ABR_LOG
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+// Binary log of ABR decisions and buffer events.
+//
+// The ABR appends fixed-size records to a bounded single-producer,
+// single-consumer ring buffer; a background thread drains it into a
+// memory-mapped file. Appending never blocks and never does I/O: if the
+// flusher falls behind by more than kCapacity records, records are dropped and
+// counted. Only one file chunk is mapped at a time, so memory stays constant
+// however long the stream runs. abr_log_reader converts the file to CSV.
+//
+// File layout: one AbrLogHeader followed by AbrLogRecords, all 40 bytes.
+
+enum AbrLogType : uint8_t {
+  kAbrLogDecision = 0,  // quality decision for the next segment
+  kAbrLogBuffer,        // buffer level after the decision and pause
+  kAbrLogStartup,       // startup delay (value in buffer_level)
+  kAbrLogRebuffer,      // stall (value in buffer_level)
+};
+
+struct AbrLogHeader {
+  char magic[4];  // "ABRL"
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t reserved;
+  uint64_t records;
+  uint64_t dropped;
+  uint64_t reserved2;
+};
+
+struct AbrLogRecord {
+  uint64_t time_us;  // steady clock
+  uint32_t seq;
+  uint8_t type;      // AbrLogType
+  uint8_t retry;
+  int16_t quality;
+  float playhead_time;
+  float buffer_level;
+  float throughput;
+  float bitrate;
+  float pause;
+  float placeholder;
+};
+
+static_assert(sizeof(AbrLogHeader) == sizeof(AbrLogRecord),
+              "records are laid out after a record-sized header");
+
+class AbrDecisionLog {
+ public:
+  AbrDecisionLog();
+  ~AbrDecisionLog();
+
+  // Creates |path| and starts the flusher. Returns false if the file cannot
+  // be created or mapped.
+  bool Open(const std::string& path);
+  // Drains the remaining records and finalizes the file.
+  void Close();
+  // Lock-free, called from the decision path only.
+  void Append(AbrLogRecord record);
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  static constexpr uint32_t kVersion = 1;
+  // Records in the ring buffer, a power of two.
+  static constexpr size_t kCapacity = 4096;
+  // Bytes mapped at a time: a multiple of both the page and the record size.
+  static constexpr size_t kChunkBytes = 40 * 4096 * 8;
+  static constexpr int kFlushIntervalMs = 200;
+
+ private:
+  void FlushLoop();
+  void Flush();
+  bool MapChunk(size_t index);
+
+  AbrLogRecord ring_[kCapacity];
+  std::atomic<uint64_t> head_;
+  std::atomic<uint64_t> tail_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<bool> running_;
+  std::thread flusher_;
+  uint32_t seq_;
+
+  // Owned by the flusher thread while running.
+  int fd_;
+  char* chunk_;
+  size_t chunk_index_;
+  size_t chunk_used_;
+  uint64_t written_;
+};
+
+#endif //ABR_LOG
@@ -0,0 +1,76 @@
+// Converts a binary ABR decision log written by quic_client --abr_log to CSV.
+//
+// Build with ninja -C chrome/src/out/Release abr_log_reader, then run
+//   ./abr_log_reader <log> > decisions.csv
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "net/tools/quic/abr_log.h"
+
+namespace {
+
+const char* TypeName(uint8_t type) {
+  switch (type) {
+    case kAbrLogDecision:
+      return "decision";
+    case kAbrLogBuffer:
+      return "buffer";
+    case kAbrLogStartup:
+      return "startup";
+    case kAbrLogRebuffer:
+      return "rebuffer";
+  }
+  return "unknown";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    std::cerr << "usage: " << argv[0] << " <log>" << std::endl;
+    return 1;
+  }
+  FILE* file = fopen(argv[1], "rb");
+  if (!file) {
+    std::cerr << "cannot open " << argv[1] << std::endl;
+    return 1;
+  }
+
+  AbrLogHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, "ABRL", 4) != 0 ||
+      header.version != AbrDecisionLog::kVersion ||
+      header.record_size != sizeof(AbrLogRecord)) {
+    std::cerr << "not an abr log (or written by another version)" << std::endl;
+    fclose(file);
+    return 1;
+  }
+
+  printf("seq,time_us,type,retry,quality,playhead_time,buffer_level,"
+         "throughput,bitrate,pause,placeholder\n");
+  AbrLogRecord record;
+  uint64_t records = 0;
+  while (records < header.records &&
+         fread(&record, sizeof(record), 1, file) == 1) {
+    printf("%u,%llu,%s,%u,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", record.seq,
+           (unsigned long long)record.time_us, TypeName(record.type),
+           record.retry, record.quality, record.playhead_time,
+           record.buffer_level, record.throughput, record.bitrate,
+           record.pause, record.placeholder);
+    ++records;
+  }
+  fclose(file);
+
+  if (records != header.records) {
+    std::cerr << "truncated log: " << records << " of " << header.records
+              << " records" << std::endl;
+    return 1;
+  }
+  if (header.dropped) {
+    std::cerr << header.dropped << " records were dropped while logging"
+              << std::endl;
+  }
+  return 0;
+}
@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <cassert>
 
 #include "net/tools/quic/abr.h"
 #include "net/tools/quic/bola.h"
+#include "net/tools/quic/predictor.h"
 
 const bool kVerbose = false;
 
@@ -9,24 +11,6 @@ BolaAbr::~BolaAbr() {
 
 }
 
-double BolaAbr::accept(Dispatcher &dispatcher, DP type, int value, const std::map<double, SSIMBasedQuality>& ssim_map) {
-  switch (type) {
-    case GQ:
-      return dispatcher.GetQuality(*this, value, ssim_map);
-    case GP:
-      return dispatcher.GetPause(*this);
-    case GB:
-      return dispatcher.GetBuffer(*this);
-    case SB:
-      dispatcher.SetBuffer(*this, value);
-      return 0.0;
-  default: 
-    std::cerr << "error requested method not available" << std::endl;
-    exit(-1);
-    return 0.0;
-  }
-}
-
 BolaAbr::BolaAbr(double segment_duration,
                  double buffer_size,
                  std::vector<double> bitrates,
@@ -35,9 +19,13 @@ BolaAbr::BolaAbr(double segment_duration,
       last_quality_(-1),
       placeholder_(0.0),
       segment_duration_(segment_duration),
+      ibr_safety_factor_target_(kSafetyFactor),
+      ibr_safety_factor_(1.0),
       bitrates_(bitrates),
       utilities_(bitrates.size()),
-      average_ssim_(ssims)
+      average_ssim_(ssims),
+      relative_variance_(0.0),
+      safety_margin_(kDefaultSafetyMargin)
 {
   buffer_size_ = buffer_size;
   startup = true;
@@ -95,12 +83,12 @@ int BolaAbr::GetPause()
 	return pause;
 }
 
-int BolaAbr::GetBuffer()
+double BolaAbr::GetBuffer()
 {
 	return buffer_level_;
 }
 
-void BolaAbr::SetBuffer(int lvl) {
+void BolaAbr::SetBuffer(double lvl) {
   buffer_level_ = lvl;
 }
 
@@ -130,33 +118,94 @@ int BolaAbr::GetQuality(double throughput, double* pause, int retry, const std::
 }
 */
 
-double BolaAbr::GetQuality(double throughput, double* pause, int retry, const std::map<double, SSIMBasedQuality>& ssim_map)
+int BolaAbr::GetQuality(double throughput, double* pause, int retry, const SegmentQualities& qualities)
 {
-  double ssim = BolaE(this->buffer_level_, throughput, ssim_map, pause, retry, kNewDownload);
-  int quality = ssim_map.at(ssim).quality;
+  int option = BolaE(this->buffer_level_, throughput, qualities, pause, retry, kNewDownload);
+  int quality = qualities.quality[option];
 
-  AbrLogLine log_line;
-  if (log_.empty()) {
-    log_line.playhead_time_ = -this->buffer_level_;
-  } else {
-    log_line.playhead_time_ = log_.back().playhead_time_ + segment_duration_ +
-      log_.back().buffer_level_ - this->buffer_level_;
-  }
-  log_line.buffer_level_ = this->buffer_level_;
-  log_line.throughput_ = throughput;
-  log_line.quality_ = quality;
-  log_line.bitrate_ = bitrates_[quality];
-  log_line.pause_ = *pause;
-  log_.push_back(log_line);
+  LogDecision(buffer_level_, segment_duration_, throughput, quality,
+              bitrates_[quality], *pause, retry);
 
   this->pause = *pause;
 
-  return ssim;
+  return option;
+}
+
+AbrDecision BolaAbr::Decide(const AbrInput& input, int retry,
+                            const SegmentQualities& qualities)
+{
+  double pause = 0.0;
+  const SegmentQualities* options = &qualities;
+  if (qualities.empty()) {
+    FillQualities(&ladder_, {});
+    options = &ladder_;
+  }
+
+  PreUpdate(pause, input.time, retry);
+  SetInput(input);
+  int option = GetQuality(input.throughput, &pause, retry, *options);
+  PostUpdate(pause, input.time, retry);
+
+  AbrDecision decision;
+  decision.option = qualities.empty() ? -1 : option;
+  decision.quality = options->quality[option];
+  decision.pause = pause;
+  decision.expected_size = options->size[option];
+  return decision;
+}
+
+AbrDecision BolaAbr::DecideStartup(const AbrInput& input,
+                                   const SegmentQualities& qualities)
+{
+  double pause = 0.0;
+  const SegmentQualities* options = &qualities;
+  if (qualities.empty()) {
+    FillQualities(&ladder_, {});
+    options = &ladder_;
+  }
+
+  // The first BolaE() call also sets the placeholder from the estimate.
+  SetInput(input);
+  int option = GetQuality(input.throughput, &pause, /*retry=*/0, *options);
+
+  AbrDecision decision;
+  decision.option = qualities.empty() ? -1 : option;
+  decision.quality = options->quality[option];
+  decision.pause = pause;
+  decision.expected_size = options->size[option];
+  return decision;
+}
+
+void BolaAbr::SetInput(const AbrInput& input)
+{
+  relative_variance_ = input.throughput > 0
+      ? input.throughput_variance / (input.throughput * input.throughput)
+      : 0.0;
+  safety_margin_ = SafetyMargin(input.transport);
 }
 
-const std::vector<AbrLogLine>& BolaAbr::GetLog()
+void BolaAbr::StartInFlight(BolaAbandonEvaluator* in_flight,
+                            const SegmentQualities* qualities,
+                            const std::vector<double>& sizes_bits)
 {
-  return log_;
+  if (qualities != nullptr) {
+    in_flight->Start(*this, *qualities);
+  } else {
+    in_flight->Start(*this, sizes_bits);
+  }
+}
+
+AbrDecision BolaAbr::DecideInFlight(const BolaAbandonEvaluator& in_flight,
+                                    double buffer_level, double throughput)
+{
+  int option = in_flight.Evaluate(buffer_level, throughput);
+
+  AbrDecision decision;
+  decision.option = in_flight.from_qualities() ? option : -1;
+  decision.quality = in_flight.quality(option);
+  decision.pause = 0.0;
+  decision.expected_size = in_flight.size(option);
+  return decision;
 }
 
 int BolaAbr::BolaE(double buffer_level, double throughput,
@@ -167,20 +216,11 @@ int BolaAbr::BolaE(double buffer_level, double throughput,
   return BolaE(buffer_level, throughput, empty_sizes, pause, retry, progress);
 }
 
-int BolaAbr::BolaE(double buffer_level, double throughput,
-                   const std::vector<double> &sizes_bits,
-                   double* pause, int retry,
-                   const DownloadProgress& progress)
+void BolaAbr::FillQualities(SegmentQualities* qualities,
+                            const std::vector<double> &sizes_bits)
 {
-  std::map<double, SSIMBasedQuality> ssim_map;
+  qualities->clear();
   for (unsigned q = 0; q < utilities_.size(); ++q) {
-    double ssim = utilities_[q];
-
-    // hack to make sure no duplicate ssim - should always be false
-    while (ssim_map.find(ssim) != ssim_map.end()) {
-      ssim += 0.000000001;
-    }
-
     double bits = 0.0;
     if (sizes_bits.empty()) {
       bits = bitrates_[q] * segment_duration_;
@@ -190,55 +230,36 @@ int BolaAbr::BolaE(double buffer_level, double throughput,
 
     SSIMBasedQuality sq;
     sq.size = bits / 8.0; // casted to size_t
+    sq.reliable_size = 0;
     sq.quality = q;
     sq.required_frames = 100; // placeholder with no effect
 
-    ssim_map[ssim] = sq;
+    qualities->Add(utilities_[q], sq);
   }
-
-  double ssim = BolaE(buffer_level, throughput, ssim_map, pause, retry, progress);
-  return ssim_map[ssim].quality;
+  qualities->Sort();
 }
 
-double BolaAbr::BolaE(double buffer_level, double throughput,
-                      const std::map<double, SSIMBasedQuality>& ssim_map_par,
-                      double* pause, int retry,
-                      const DownloadProgress& progress)
+int BolaAbr::BolaE(double buffer_level, double throughput,
+                   const std::vector<double> &sizes_bits,
+                   double* pause, int retry,
+                   const DownloadProgress& progress)
 {
-  std::map<double, SSIMBasedQuality> ssim_map_copy;
-  if (progress.in_progress) {
-    //                                                      _         _
-    // TODO: not the most efficient way, but works for now   \_(-_-)_/
-    ssim_map_copy = ssim_map_par;
-    for (auto ssim_entry : ssim_map_copy) {
-      if (ssim_entry.second.quality == progress.quality) {
-        //std::cerr << "pre:" << ssim_entry.second.size;
-        if (ssim_entry.first >= progress.ssim) {
-          // By not adjusting size when ssim_entry.first < progress.ssim,
-          // we avoid being too eager to abort all downloads before intended.
-          // Without this check, quitting might show a remaining size very
-          // close to zero, which brings the denominator in the Score()
-          // function very close to zero. Thus, we are tempted to always quit.
-          if (!progress.reliable) {
-            ssim_entry.second.size -= ssim_entry.second.reliable_size;
-          }
-          //std::cerr << " post:" << ssim_entry.second.size << " exp:" << progress.size << std::endl;
-          //assert(ssim_entry.second.size == progress.size);
-          // We can have already downloaded the entire part that is required for some SSIMS.
-          if (progress.downloaded >= ssim_entry.second.size) {
-            ssim_entry.second.size = 1;
-          } else {
-            ssim_entry.second.size -= progress.downloaded;
-          }
-        }
-      }
-    }
-  }
-  const std::map<double, SSIMBasedQuality>& ssim_map =
-      (progress.in_progress ? ssim_map_copy : ssim_map_par);
+  FillQualities(&ladder_, sizes_bits);
+  int option = BolaE(buffer_level, throughput, ladder_, pause, retry, progress);
+  return ladder_.quality[option];
+}
 
+int BolaAbr::BolaE(double buffer_level, double throughput,
+                   const SegmentQualities& qualities,
+                   double* pause, int retry,
+                   const DownloadProgress& progress)
+{
+  // Scores use the full option sizes also while a download is in progress.
+  // (The size adjustment for in-progress downloads used to be applied to a
+  // copy of each map entry and never took effect.)
+  const int options = qualities.options();
   int quality = 0;
-  double ssim = 0.0;
+  int option = 0;
   *pause = 0.0;
 
   // Use empty_sizes get long-term quality from throughput
@@ -265,12 +286,12 @@ double BolaAbr::BolaE(double buffer_level, double throughput,
     quality = QualityFromThroughput(kSafetyFactor * throughput, empty_sizes);
     placeholder_ = MinBufferLevelForQuality(quality);
     last_quality_ = quality;
-    for(auto it = ssim_map.rbegin(); it != ssim_map.rend(); it++) {
-      if (it->second.quality == quality) {
-        return it->first;
+    for (option = options - 1; option >= 0; --option) {
+      if (qualities.quality[option] == quality) {
+        return option;
       }
     }
-    std::cerr << "ERROR: Failed to find quality level in ssim_map?\n";
+    std::cerr << "ERROR: Failed to find quality level in quality table?\n";
     exit(1);
   }
 
@@ -280,7 +301,7 @@ double BolaAbr::BolaE(double buffer_level, double throughput,
 
   // 1. We first find a sustainable quality level. Note that we are using the
   // average over the whole video, that is bitrates_, as opposed to the sizes
-  // seen in ssim_map. This is because we want sustainability in the "long"
+  // seen in the quality table. This is because we want sustainability in the "long"
   // term and not just for this segment.
   //
   // We will find the lowest bitrate that is larger than the throughput. Note
@@ -312,22 +333,22 @@ double BolaAbr::BolaE(double buffer_level, double throughput,
   // We will favor qualities <= last_quality_. Thus, BOLA will be inclined to
   // not drop in quality level even if SSIM for lower bitrates are almost
   // equal to current bitrate.
-  ssim = QualityFromBufferLevel(buffer_level + placeholder_, ssim_map,
-                                max_quality, /*favor_quality*/ last_quality_);
-  quality = ssim_map.at(ssim).quality;
+  option = QualityFromBufferLevel(buffer_level + placeholder_, qualities,
+                                  max_quality, /*favor_quality*/ last_quality_);
+  quality = qualities.quality[option];
 
   /*
-  if (ssim_map.size() == bitrates_.size()) {
-    // If we have exactly one ssim_map entry per quality,
+  if (qualities.options() == bitrates_.size()) {
+    // If we have exactly one option per quality,
     // then we want to keep using BolaE oscillation avoidance.
-    // If we have more than one ssim_map entry per quality,
+    // If we have more than one option per quality,
     // then we do not use the oscillation avoidance algorithm.
 
 
     // Do not use sizes_bits to calculate sustainable_quality because
     // it is a long-term sustainability estimate.
-    double sustainable_ssim = QualityFromThroughput(throughput, ssim_map);
-    int sustainable_quality = ssim_map.at(sustainable_ssim).quality;
+    int sustainable_option = QualityFromThroughput(throughput, qualities);
+    int sustainable_quality = qualities.quality[sustainable_option];
     // TODO: might create some oscillations if buffer_level_
     //       is not larger than 2 * segment_duration_
 
@@ -338,21 +359,20 @@ double BolaAbr::BolaE(double buffer_level, double throughput,
       if (sustainable_quality < last_quality_) {
         quality = last_quality_;
         bool found = false;
-        for (auto it = ssim_map.begin(); it != ssim_map.end(); it++) {
-          if (it->second.quality == quality) {
-            ssim = it->first;
+        for (option = 0; option < options; ++option) {
+          if (qualities.quality[option] == quality) {
             found = true;
             break;
           }
         }
         if (!found) {
-          std::cerr << "ERROR: Failed to find quality in ssim_map." << std::endl;
+          std::cerr << "ERROR: Failed to find quality in quality table." << std::endl;
           exit(1);
         }
         //std::cout << "q=last=" << quality << std::endl;
       } else {
         quality = sustainable_quality;
-        ssim = sustainable_ssim;
+        option = sustainable_option;
         //std::cout << "q=sustainable=" << quality << std::endl;
       }
     }
@@ -360,7 +380,7 @@ double BolaAbr::BolaE(double buffer_level, double throughput,
   */
 
   // We replace InsufficientBufferRule with SafeDownloadSizeBits.
-  // Note that if there is exactly one ssim_map entry per quality, this behaves exactly like InsufficientBufferRule.
+  // Note that if there is exactly one option per quality, this behaves exactly like InsufficientBufferRule.
   // First, we find the maximum buffer level:
   double safety_buffer_level = buffer_level;
   if (safety_buffer_level > buffer_size_ - segment_duration_) {
@@ -368,17 +388,15 @@ double BolaAbr::BolaE(double buffer_level, double throughput,
   }
   size_t safe_size_bytes = SafeDownloadSizeBits(safety_buffer_level, throughput)
       / 8.0;
-  auto iter = ssim_map.find(ssim);
-  size_t cur_size = iter->second.size;
-  while (iter != ssim_map.begin() && cur_size > safe_size_bytes) {
-    --iter;
-    size_t new_size = iter->second.size;
+  size_t cur_size = qualities.size[option];
+  for (int i = option - 1; i >= 0 && cur_size > safe_size_bytes; --i) {
+    size_t new_size = qualities.size[i];
     if (new_size < cur_size) {
-      ssim = iter->first;
-      quality = iter->second.quality;
+      option = i;
       cur_size = new_size;
     }
   }
+  quality = qualities.quality[option];
 
   if (!progress.in_progress) {
 
@@ -398,7 +416,7 @@ double BolaAbr::BolaE(double buffer_level, double throughput,
     // chosen ssim value is so low (even lower than utilities_[0]) that
     // a negative buffer level is indicated.
     //double level = BufferLevelForZeroScore(std::max(utilities_[quality], ssim));
-    double level = BufferLevelForZeroScore(ssim);
+    double level = BufferLevelForZeroScore(qualities.ssim[option]);
     if (level < kBufferLow) {
       // Add a safety mechanism to avoid depleting too much buffer.
       // We should not arrive here, but if we do, we need to adjust.
@@ -424,7 +442,7 @@ double BolaAbr::BolaE(double buffer_level, double throughput,
     last_quality_ = quality;
   }
 
-  return ssim;
+  return option;
 }
 
 double BolaAbr::Score(double buffer_level, double size_bits, double util)
@@ -450,34 +468,31 @@ double BolaAbr::MinBufferLevelForQuality(int quality)
   return vp_ * (gp_ - a);
 }
 
-double BolaAbr::QualityFromBufferLevel(double buffer_level,
-                                       const std::map<double, SSIMBasedQuality>& ssim_map,
-                                       int max_quality, int favor_quality)
+int BolaAbr::QualityFromBufferLevel(double buffer_level,
+                                    const SegmentQualities& qualities,
+                                    int max_quality, int favor_quality)
 {
   // We will give an extra penalty in ssim to all qualities < favor_quality.
   // The penalty is the average drop in utility between qualities.
   double favor_ssim_penalty = ((utilities_.back() - utilities_.front()) /
                                (utilities_.size() - 1));
-  double best_ssim = 0.0;
+  const int options = qualities.options();
+  int best_option = 0;
   double score = 0.0;
-  for (auto ssim_entry: ssim_map) {
-    int quality = ssim_entry.second.quality;
-    /*if (quality > max_quality) {
+  for (int option = 0; option < options; ++option) {
+    /*if (qualities.quality[option] > max_quality) {
       continue;
     }*/
-    double ssim = ssim_entry.first;
-    double effective_ssim = ssim;
-    if (quality < favor_quality) {
-      effective_ssim -= favor_ssim_penalty;
-    }
-    double size_bits = ssim_entry.second.size * 8.0;
+    double effective_ssim = qualities.ssim[option] -
+        (qualities.quality[option] < favor_quality ? favor_ssim_penalty : 0.0);
+    double size_bits = qualities.size[option] * 8.0;
     double s = Score(buffer_level, size_bits, effective_ssim);
-    if (best_ssim == 0.0 || s > score) {
+    if (option == 0 || s > score) {
       score = s;
-      best_ssim = ssim;
+      best_option = option;
     }
   }
-  return best_ssim;
+  return best_option;
 }
 
 int BolaAbr::QualityFromThroughput(double throughput,
@@ -498,36 +513,39 @@ int BolaAbr::QualityFromThroughput(double throughput,
   return bitrates_.size() - 1;
 }
 
-double BolaAbr::QualityFromThroughput(double throughput,
-                                      const std::map<double, SSIMBasedQuality>& ssim_map)
+int BolaAbr::QualityFromThroughput(double throughput,
+                                   const SegmentQualities& qualities)
 {
-  double ssim = 0.0;
+  int best_option = 0;
   double min_rate = 0.0;
-  for (auto iter = ssim_map.rbegin(); iter != ssim_map.rend(); iter++) {
-    double rate = (8.0 * iter->second.size) / segment_duration_;
+  for (int option = qualities.options() - 1; option >= 0; --option) {
+    double rate = (8.0 * qualities.size[option]) / segment_duration_;
     if (rate <= throughput) {
       // we're done because we found the best ssim with rate <= throughput
-      return iter->first;
+      return option;
     }
     if (min_rate == 0.0 || rate < min_rate) {
-      ssim = iter->first;
+      best_option = option;
       min_rate = rate;
     }
   }
   // we did not find a small enough option, use lowest bitrate available
-  return ssim;
+  return best_option;
 }
 
 double BolaAbr::SafeDownloadSizeBits(double buffer_level, double throughput)
 {
-  return throughput * ibr_safety_factor_ * buffer_level;
+  // Lower confidence bound of the throughput, if its variance is known. The
+  // download has to be done while the safety margin is still buffered.
+  return ThroughputQuantile(throughput, relative_variance_, kThroughputQuantile)
+      * ibr_safety_factor_ * std::max(buffer_level - safety_margin_, 0.0);
 }
 
 int BolaAbr::InsufficientBufferRule(double buffer_level, double throughput,
                                     const std::vector<double> &sizes_bits)
 {
-  // If we have ssim_map, then we use SafeDownloadSizeBits() directly.
-  // We only use InsufficientBufferRule when not using ssim_map.
+  // If we have a quality table, then we use SafeDownloadSizeBits() directly.
+  // We only use InsufficientBufferRule when not using a quality table.
 
   //std::cout << "IBR(bl=" << buffer_level << ", tp=" << throughput << ") : "
   //          << (throughput * ibr_safety_factor_ * buffer_level /
@@ -549,14 +567,18 @@ int BolaAbr::InsufficientBufferRule(double buffer_level, double throughput,
 }
 
 
-void BolaAbr::PreUpdate(double pause, uint32_t walltime, int retry) {
+void BolaAbr::PreUpdate(double pause, double walltime, int retry) {
 
   if (buffer_level_ < 0.0) {
     if (buffer_level_ < -100000) {
       std::cerr << "rebuffer of more than 100s - not supposed to happen - stopping!" << std::endl;
       exit(-4);
     }
-    std::cerr << (startup ? "[startup] " : "[rebuffer] ") << (int)(-buffer_level_) << std::endl;
+    if (decision_log_) {
+      LogEvent(startup ? kAbrLogStartup : kAbrLogRebuffer, -buffer_level_, 0.0, 0.0, retry);
+    } else {
+      std::cerr << (startup ? "[startup] " : "[rebuffer] ") << (int)(-buffer_level_) << std::endl;
+    }
     buffer_level_ = 0.0;
   }
   startup = false;
@@ -565,16 +587,101 @@ void BolaAbr::PreUpdate(double pause, uint32_t walltime, int retry) {
     buffer_level_ += segment_duration_;
 }
 
-void BolaAbr::PostUpdate(double pause, uint32_t walltime, int retry) {
-  if (pause > 0.0 && !retry) {
-    std::cerr << "[pause] " << (int)(pause) << std::endl;
+void BolaAbr::PostUpdate(double pause, double walltime, int retry) {
+  bool paused = pause > 0.0 && !retry;
+  if (paused) {
     buffer_level_ -= pause;
   }
 
+  if (decision_log_) {
+    LogEvent(kAbrLogBuffer, buffer_level_, paused ? pause : 0.0, placeholder_, retry);
+    return;
+  }
+  if (paused) {
+    std::cerr << "[pause] " << (int)(pause) << std::endl;
+  }
   std::cerr << "[" << (retry ? "retry-" : "") << "buffer] " << (int)(buffer_level_) << std::endl;
   std::cerr << "[placeholder] " << (int)(placeholder_) << std::endl;
 }
 
+BolaAbandonEvaluator::BolaAbandonEvaluator()
+    : active_(false),
+      from_qualities_(false),
+      placeholder_(0.0),
+      safety_factor_(0.0),
+      max_safety_buffer_level_(0.0),
+      safety_margin_(0.0)
+{
+}
+
+void BolaAbandonEvaluator::Start(const BolaAbr& bola,
+                                 const SegmentQualities& qualities)
+{
+  // Same favor penalty as BolaAbr::QualityFromBufferLevel.
+  double favor_ssim_penalty = ((bola.utilities_.back() - bola.utilities_.front()) /
+                               (bola.utilities_.size() - 1));
+  const int options = qualities.options();
+  numerator_.resize(options);
+  size_bits_.resize(options);
+  size_.resize(options);
+  quality_.resize(options);
+  for (int option = 0; option < options; ++option) {
+    double effective_ssim = qualities.ssim[option] -
+        (qualities.quality[option] < bola.last_quality_ ? favor_ssim_penalty : 0.0);
+    numerator_[option] = bola.vp_ * (effective_ssim + bola.gp_);
+    size_bits_[option] = qualities.size[option] * 8.0;
+    size_[option] = qualities.size[option];
+    quality_[option] = qualities.quality[option];
+  }
+  placeholder_ = bola.placeholder_;
+  // As in BolaAbr::SafeDownloadSizeBits, the in-flight throughput is taken
+  // to be as uncertain as the latest estimate.
+  safety_factor_ = bola.ibr_safety_factor_ *
+      ThroughputQuantile(1.0, bola.relative_variance_, BolaAbr::kThroughputQuantile);
+  max_safety_buffer_level_ = bola.buffer_size_ - bola.segment_duration_;
+  safety_margin_ = bola.safety_margin_;
+  active_ = options > 0;
+  from_qualities_ = true;
+}
+
+void BolaAbandonEvaluator::Start(BolaAbr& bola,
+                                 const std::vector<double>& sizes_bits)
+{
+  bola.FillQualities(&ladder_, sizes_bits);
+  Start(bola, ladder_);
+  from_qualities_ = false;
+}
+
+int BolaAbandonEvaluator::Evaluate(double buffer_level, double throughput) const
+{
+  const int options = quality_.size();
+  const double level = buffer_level + placeholder_;
+  int option = 0;
+  double score = 0.0;
+  for (int o = 0; o < options; ++o) {
+    double s = (numerator_[o] - level) / size_bits_[o];
+    if (o == 0 || s > score) {
+      score = s;
+      option = o;
+    }
+  }
+
+  double safety_buffer_level = buffer_level;
+  if (safety_buffer_level > max_safety_buffer_level_) {
+    safety_buffer_level = max_safety_buffer_level_;
+  }
+  safety_buffer_level = std::max(safety_buffer_level - safety_margin_, 0.0);
+  size_t safe_size_bytes = throughput * safety_factor_ * safety_buffer_level / 8.0;
+  size_t cur_size = size_[option];
+  for (int i = option - 1; i >= 0 && cur_size > safe_size_bytes; --i) {
+    if (size_[i] < cur_size) {
+      option = i;
+      cur_size = size_[i];
+    }
+  }
+  return option;
+}
+
 BPPMovingAverage::BPPMovingAverage()
     : throughput_(0.0),
       cumulative_time_(0.0),
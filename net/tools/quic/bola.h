@@ -23,8 +23,45 @@ const DownloadProgress kNewDownload = {false, 0, 0.0, 0, 0, true};
 const DownloadProgress kInProgress = {true, -1, 0.0, 0, 0, true};
 // kInProgress avoids changing state, but does not account for current download
 
-class BaseAbr;
-class Dispatcher;
+class BolaAbr;
+
+// Evaluates BolaE for a download in flight. Everything that stays fixed while
+// the segment downloads (utilities, option sizes, placeholder and safety
+// factor) is captured when the request starts, so each abandonment check is a
+// single pass over the options without allocation.
+class BolaAbandonEvaluator {
+ public:
+  BolaAbandonEvaluator();
+  // Options of |qualities|, as used by bpp.
+  void Start(const BolaAbr& bola, const SegmentQualities& qualities);
+  // One option per quality sized by |sizes_bits| (or the bitrates if empty),
+  // as used by BolaE without a quality table.
+  void Start(BolaAbr& bola, const std::vector<double>& sizes_bits);
+  void Stop() { active_ = false; }
+  bool active() const { return active_; }
+  // True if started over a quality table, whose option indices the in-flight
+  // decisions report.
+  bool from_qualities() const { return from_qualities_; }
+
+  // Returns the option BolaE picks for an in-progress download.
+  int Evaluate(double buffer_level, double throughput) const;
+  int quality(int option) const { return quality_[option]; }
+  size_t size(int option) const { return size_[option]; }
+
+ private:
+  bool active_;
+  bool from_qualities_;
+  double placeholder_;
+  double safety_factor_;
+  double max_safety_buffer_level_;
+  double safety_margin_;
+  // vp * (effective utility + gp) per option.
+  std::vector<double> numerator_;
+  std::vector<double> size_bits_;
+  std::vector<size_t> size_;
+  std::vector<int> quality_;
+  SegmentQualities ladder_;
+};
 
 class BolaAbr: public BaseAbr {
  public:
@@ -34,14 +71,22 @@ class BolaAbr: public BaseAbr {
           std::vector<double> bitrates,
           std::vector<double> ssims);
 
-  double GetQuality(double throughput, double* pause, int retry, const std::map<double, SSIMBasedQuality>& ssim_map);
+  // Returns the index of the chosen option in |qualities|.
+  int GetQuality(double throughput, double* pause, int retry, const SegmentQualities& qualities);
   int GetPause();
-  int GetBuffer();
-  void SetBuffer(int lvl);
-  void PreUpdate(double pause, uint32_t walltime, int retry);
-  void PostUpdate(double pause, uint32_t walltime, int retry);
-  double accept(Dispatcher &dispatcher, DP type, int retry, const std::map<double, SSIMBasedQuality>& ssim_map) override;
-  const std::vector<AbrLogLine>& GetLog();
+  double GetBuffer();
+  void SetBuffer(double lvl);
+  void PreUpdate(double pause, double walltime, int retry);
+  void PostUpdate(double pause, double walltime, int retry);
+  // Policy interface of Abr<BolaAbr, Estimator>. Without a quality table BOLA
+  // chooses from the bitrate ladder.
+  AbrDecision Decide(const AbrInput& input, int retry, const SegmentQualities& qualities);
+  AbrDecision DecideStartup(const AbrInput& input, const SegmentQualities& qualities);
+  void StartInFlight(BolaAbandonEvaluator* in_flight,
+                     const SegmentQualities* qualities,
+                     const std::vector<double>& sizes_bits);
+  AbrDecision DecideInFlight(const BolaAbandonEvaluator& in_flight,
+                             double buffer_level, double throughput);
 
   int pause;
 
@@ -57,15 +102,27 @@ class BolaAbr: public BaseAbr {
     std::vector<double> bitrates_;
     std::vector<double> utilities_;
     std::vector<double> average_ssim_;
-    std::vector<AbrLogLine> log_;
+    // Variance of the latest throughput estimate over its square, 0 if the
+    // estimator gave none.
+    double relative_variance_;
+    // Buffer (ms) a download must leave when it is done, see SafetyMargin().
+    double safety_margin_;
+    // Takes the variance and the transport stats of |input|.
+    void SetInput(const AbrInput& input);
     static constexpr double kBufferLow = 10000;
     static constexpr double kMinThreshold = 2000;
     static constexpr double kSafetyFactor = 0.9;
     static constexpr double kIbrSafetyFactor = 0.5;
-    // Generate basic ssim map with one entry per quality.
-    void FillSsimMap(std::map<double, SSIMBasedQuality>& ssim_map,
-                     const std::vector<double> &sizes_bits);
-    // BolaE without ssim_map gives old quality with old utilities_ values
+    // With a variance from the estimator, the safe download size is based on
+    // the throughput that is only undershot with this probability.
+    static constexpr double kThroughputQuantile = 0.2;
+    // Options built from utilities_ for the overloads without a quality
+    // table, reused between calls.
+    SegmentQualities ladder_;
+    // Generate basic quality table with one option per quality.
+    void FillQualities(SegmentQualities* qualities,
+                       const std::vector<double> &sizes_bits);
+    // BolaE without a quality table gives old quality with old utilities_ values
     int BolaE(double buffer_level, double throughput,
               double* pause, int retry,
               const DownloadProgress& progress = kNewDownload);
@@ -73,20 +130,21 @@ class BolaAbr: public BaseAbr {
               const std::vector<double>& sizes_bits,
               double* pause, int retry,
               const DownloadProgress& progress = kNewDownload);
-    double BolaE(double buffer_level, double throughput,
-                 const std::map<double, SSIMBasedQuality>& ssim_map,
-                 double* pause, int retry,
-                 const DownloadProgress& progress = kNewDownload);
+    // Returns the index of the chosen option in |qualities|.
+    int BolaE(double buffer_level, double throughput,
+              const SegmentQualities& qualities,
+              double* pause, int retry,
+              const DownloadProgress& progress = kNewDownload);
     double Score(double buffer_level, double size_bits, double util);
     double BufferLevelForZeroScore(double utility);
     double MinBufferLevelForQuality(int quality);
-    double QualityFromBufferLevel(double buffer_level,
-                                  const std::map<double, SSIMBasedQuality>& ssim_map,
-                                  int max_quality, int favor_quality);
+    int QualityFromBufferLevel(double buffer_level,
+                               const SegmentQualities& qualities,
+                               int max_quality, int favor_quality);
     int QualityFromThroughput(double throughput,
                               const std::vector<double> &sizes_bits);
-    double QualityFromThroughput(double throughput,
-                                 const std::map<double, SSIMBasedQuality>& ssim_map);
+    int QualityFromThroughput(double throughput,
+                              const SegmentQualities& qualities);
     double SafeDownloadSizeBits(double buffer_level, double throughput);
     int InsufficientBufferRule(double buffer_level, double throughput,
                                const std::vector<double>& sizes_bits);
@@ -1,38 +1,22 @@
 #include "net/tools/quic/abr.h"
 #include "net/tools/quic/mpc.h"
+#include "net/tools/quic/mpc_table.h"
+#include "net/tools/quic/predictor.h"
 
 MpcAbr::~MpcAbr() {
 }
 
-double MpcAbr::accept(Dispatcher &dispatcher, DP type, int value, const std::map<double, SSIMBasedQuality>& ssim_map) {
-  switch (type) {
-    case GQ:
-      return dispatcher.GetQuality(*this, value);
-    case GP:
-      return dispatcher.GetPause(*this);
-    case GB:
-      return dispatcher.GetBuffer(*this);
-    case SB:
-      dispatcher.SetBuffer(*this, value);
-      return 0.0;
-  default: 
-    std::cerr << "error requested method not available" << std::endl;
-    exit(-1);
-    return 0.0;
-  }
-}
-
 int MpcAbr::GetPause()
 {
   return pause;
 }
 
-int MpcAbr::GetBuffer()
+double MpcAbr::GetBuffer()
 {
   return buffer_level_;
 }
 
-void MpcAbr::SetBuffer(int lvl) {
+void MpcAbr::SetBuffer(double lvl) {
   buffer_level_ = lvl;
 }
 
@@ -44,7 +28,10 @@ MpcAbr::MpcAbr(double segment_duration, double buffer_size,
       segment_duration_(segment_duration),
       bitrates_(bitrates),
       estimate_throughput_(0.0),
-      estimate_error_(0.0)
+      estimate_error_(0.0),
+      relative_variance_(0.0),
+      safety_margin_(kDefaultSafetyMargin),
+      search_depth_(kSearchDepth)
 {
       buffer_size_ = buffer_size;
       startup = true;
@@ -52,16 +39,13 @@ MpcAbr::MpcAbr(double segment_duration, double buffer_size,
 
 int MpcAbr::GetQuality(double throughput, double* pause)
 {
-  double best = 0.0;
-  int quality = 0;
-  double tput_e = throughput / (1.0 + estimate_error_);
+  double tput_e = ConservativeThroughput(throughput);
   //std::cerr << "Search tput_e=" << tput_e << " bl=" << buffer_level_ << "/" << buffer_size_ << std::endl;
-  for (unsigned q = 0; q < bitrates_.size(); ++q) {
-    double v = Search(kSearchDepth, tput_e, buffer_level_, last_quality_, q);
-    if (q == 0 || v > best) {
-      best = v;
-      quality = q;
-    }
+  double buffer_level = PlanningBuffer(buffer_level_);
+  int quality = table_ ? table_->Lookup(buffer_level, last_quality_, tput_e)
+                       : MpcDecisionTable::kAmbiguous;
+  if (quality == MpcDecisionTable::kAmbiguous) {
+    quality = PlanQuality(tput_e, buffer_level, last_quality_);
   }
   last_quality_ = quality;
   estimate_throughput_ = throughput;
@@ -71,53 +55,142 @@ int MpcAbr::GetQuality(double throughput, double* pause)
   } else {
     *pause = 0.0;
   }
-  AbrLogLine log_line;
-  if (log_.empty()) {
-    log_line.playhead_time_ = -this->buffer_level_;
-  } else {
-    log_line.playhead_time_ = log_.back().playhead_time_ + segment_duration_ +
-      log_.back().buffer_level_ - this->buffer_level_;
-  }
-  log_line.buffer_level_ = this->buffer_level_;
-  log_line.throughput_ = throughput;
-  log_line.quality_ = quality;
-  log_line.bitrate_ = bitrates_[quality];
-  log_line.pause_ = *pause;
-  log_.push_back(log_line);
+  LogDecision(buffer_level_, segment_duration_, throughput, quality,
+              bitrates_[quality], *pause, /*retry=*/0);
 
   this->pause = *pause;
   return quality;
 }
 
-const std::vector<AbrLogLine>& MpcAbr::GetLog()
+AbrDecision MpcAbr::Decide(const AbrInput& input, int retry,
+                           const SegmentQualities& qualities)
+{
+  double pause = 0.0;
+
+  PreUpdate(pause, input.time, input.segment_size);
+  SetInput(input);
+  int quality = GetQuality(input.throughput, &pause);
+  PostUpdate(pause, input.time);
+
+  AbrDecision decision;
+  decision.option = -1;
+  decision.quality = quality;
+  decision.pause = pause;
+  decision.expected_size = bitrates_[quality] * segment_duration_ / 8.0;
+  return decision;
+}
+
+AbrDecision MpcAbr::DecideStartup(const AbrInput& input,
+                                  const SegmentQualities& qualities)
+{
+  double pause = 0.0;
+
+  // No prediction error is known yet, the estimate is taken as it is.
+  SetInput(input);
+  int quality = GetQuality(input.throughput, &pause);
+
+  AbrDecision decision;
+  decision.option = -1;
+  decision.quality = quality;
+  decision.pause = pause;
+  decision.expected_size = bitrates_[quality] * segment_duration_ / 8.0;
+  return decision;
+}
+
+void MpcAbr::SetInput(const AbrInput& input)
+{
+  relative_variance_ = input.throughput > 0
+      ? input.throughput_variance / (input.throughput * input.throughput)
+      : 0.0;
+  safety_margin_ = SafetyMargin(input.transport);
+}
+
+AbrDecision MpcAbr::DecideInFlight(const BolaAbandonEvaluator& in_flight,
+                                   double buffer_level, double throughput)
+{
+  double tput_e = ConservativeThroughput(throughput);
+  buffer_level = PlanningBuffer(buffer_level);
+  int quality = table_ ? table_->Lookup(buffer_level, last_quality_, tput_e)
+                       : MpcDecisionTable::kAmbiguous;
+  if (quality == MpcDecisionTable::kAmbiguous) {
+    quality = PlanQuality(tput_e, buffer_level, last_quality_);
+  }
+
+  AbrDecision decision;
+  decision.option = -1;
+  decision.quality = quality;
+  decision.pause = 0.0;
+  decision.expected_size = bitrates_[quality] * segment_duration_ / 8.0;
+  return decision;
+}
+
+double MpcAbr::ConservativeThroughput(double throughput)
+{
+  if (relative_variance_ > 0.0) {
+    // In flight, |throughput| is a measurement; it is taken to be as
+    // uncertain as the latest estimate.
+    return ThroughputQuantile(throughput, relative_variance_,
+                              kPredictionQuantile);
+  }
+  return throughput / (1.0 + estimate_error_);
+}
+
+double MpcAbr::PlanningBuffer(double buffer_level)
+{
+  return std::max(buffer_level - safety_margin_, 0.0);
+}
+
+void MpcAbr::SetSearchDepth(int depth)
 {
-  return log_;
+  search_depth_ = depth < 1 ? 1 : depth;
+}
+
+bool MpcAbr::LoadTable(const std::string& path)
+{
+  std::unique_ptr<MpcDecisionTable> table(new MpcDecisionTable());
+  if (!table->Load(path)) {
+    std::cerr << "[mpc-table] cannot read " << path << ", planning online"
+              << std::endl;
+    return false;
+  }
+  if (!table->Matches(*this)) {
+    std::cerr << "[mpc-table] " << path << " does not match ladder/buffer/"
+              << "horizon, planning online" << std::endl;
+    return false;
+  }
+  std::cerr << "[mpc-table] " << path << " runs:" << table->runs() << std::endl;
+  table_ = std::move(table);
+  return true;
 }
 
 double MpcAbr::Evaluate(int prev_quality, int quality, double rebuffer)
 {
-  const double lambda = 1.0;
-  const double mu = 3.0;
   double score = bitrates_[quality];
-  score -= lambda * fabs(bitrates_[quality] - bitrates_[prev_quality]);
-  score -= mu * rebuffer;
+  score -= kLambda * fabs(bitrates_[quality] - bitrates_[prev_quality]);
+  score -= kMu * rebuffer;
   return score;
 }
 
-double MpcAbr::Search(int depth, double throughput, double buffer_level,
-                      int prev_quality, int quality)
+double MpcAbr::Step(double buffer_level, int quality, double throughput,
+                    double* rebuffer)
 {
   if (buffer_level + segment_duration_ > buffer_size_) {
     buffer_level = buffer_size_ - segment_duration_;
   }
   double time = (bitrates_[quality] * segment_duration_) / throughput;
-  double rebuffer = 0.0;
   buffer_level -= time;
   if (buffer_level < 0.0) {
-    rebuffer += -buffer_level;
+    *rebuffer += -buffer_level;
     buffer_level = 0.0;
   }
-  buffer_level += segment_duration_;
+  return buffer_level + segment_duration_;
+}
+
+double MpcAbr::Search(int depth, double throughput, double buffer_level,
+                      int prev_quality, int quality)
+{
+  double rebuffer = 0.0;
+  buffer_level = Step(buffer_level, quality, throughput, &rebuffer);
 
   double value = Evaluate(prev_quality, quality, rebuffer);
   --depth;
@@ -134,7 +207,249 @@ double MpcAbr::Search(int depth, double throughput, double buffer_level,
   return value;
 }
 
-void MpcAbr::PreUpdate(double pause, uint32_t walltime, double segment_size) {
+int MpcAbr::PlanQuality(double throughput, double buffer_level,
+                        int prev_quality)
+{
+  return UseSearch() ? SearchQuality(throughput, buffer_level, prev_quality)
+                     : Plan(throughput, buffer_level, prev_quality);
+}
+
+bool MpcAbr::UseSearch()
+{
+  // Plan() fills search_depth_ layers of the grid before it searches, while
+  // Search() visits sum_k ladder^k sequences. Per state they cost about the
+  // same (mpc_bench): with a 13-rung ladder and a 20 s buffer Search() wins
+  // up to horizon 3, with a 60 s buffer up to horizon 4.
+  const double cells = (double)search_depth_ * PlanBuckets() *
+      bitrates_.size();
+  double sequences = 0.0;
+  double level = 1.0;
+  for (int k = 0; k < search_depth_ && sequences <= cells; ++k) {
+    level *= bitrates_.size();
+    sequences += level;
+  }
+  return sequences <= cells;
+}
+
+int MpcAbr::SearchQuality(double throughput, double buffer_level,
+                          int prev_quality)
+{
+  double best = 0.0;
+  int quality = 0;
+  for (unsigned q = 0; q < bitrates_.size(); ++q) {
+    double v = Search(search_depth_, throughput, buffer_level, prev_quality, q);
+    if (q == 0 || v > best) {
+      best = v;
+      quality = q;
+    }
+  }
+  return quality;
+}
+
+// Plan() returns the same decision as SearchQuality(), but prunes the
+// download sequences that cannot beat the best one found so far. The bound is
+// a value function U(k, g, p) on a kBufferQuantum grid: the score of the
+// remaining k segments when starting at grid point g after quality p, taken
+// at the grid point at or above the buffer level.
+//
+//   U(0, g, p) = 0
+//   U(k, g, p) = max_q [ score(g, q) - kLambda * |br_q - br_p| + U(k-1, ceil(b'(g, q)), q) ]
+//
+// The score and the next buffer level only grow with the buffer, so U(k, g, p)
+// is never below the exact value of any level up to g. Since throughput is
+// fixed during one decision, the step from (g, q) and its score do not depend
+// on k and are computed once. The switching penalty is an L1 distance over the
+// (ascending) ladder, so the maximum over q for all p is found with one
+// forward and one backward pass. The grid thus costs
+// O(depth * buckets * qualities).
+//
+// PlanRoot() then walks the sequences like Search(), trying the qualities with
+// the highest bound first and skipping those whose bound is below the best
+// value. Values are summed in the same order as in Search(), so the decision,
+// ties included, is the same.
+int MpcAbr::Plan(double throughput, double buffer_level, int prev_quality)
+{
+  double value;
+  PlanValues(throughput);
+  return PlanRoot(throughput, buffer_level, prev_quality, &value);
+}
+
+void MpcAbr::PlanValues(double throughput)
+{
+  const int qualities = bitrates_.size();
+  const int buckets = PlanBuckets();
+  const size_t cells = (size_t)buckets * qualities;
+
+  // Layer k holds U(k, ., .); layer 0 stays zero.
+  plan_bound_.assign(search_depth_ * cells, 0.0);
+  plan_order_.resize(search_depth_ * qualities);
+  plan_order_bound_.resize(search_depth_ * qualities);
+  if (search_depth_ <= 1) {
+    return;
+  }
+  step_bucket_.resize(cells);
+  step_score_.resize(cells);
+  plan_base_.resize(qualities);
+
+  for (int b = 0; b < buckets; ++b) {
+    for (int q = 0; q < qualities; ++q) {
+      double rebuffer = 0.0;
+      double level = Step(b * kBufferQuantum, q, throughput, &rebuffer);
+      step_bucket_[b * qualities + q] = Bucket(level, buckets) * qualities;
+      step_score_[b * qualities + q] = bitrates_[q] - kMu * rebuffer;
+    }
+  }
+
+  for (int k = 1; k < search_depth_; ++k) {
+    const double* prev_layer = &plan_bound_[(k - 1) * cells];
+    double* layer = &plan_bound_[k * cells];
+    for (int b = 0; b < buckets; ++b) {
+      const int row = b * qualities;
+      for (int q = 0; q < qualities; ++q) {
+        plan_base_[q] = step_score_[row + q] +
+            prev_layer[step_bucket_[row + q] + q];
+      }
+      double* out = &layer[row];
+      double run = plan_base_[0];
+      out[0] = run;
+      for (int p = 1; p < qualities; ++p) {
+        run = std::max(run - kLambda * (bitrates_[p] - bitrates_[p - 1]),
+                       plan_base_[p]);
+        out[p] = run;
+      }
+      run = plan_base_[qualities - 1];
+      for (int p = qualities - 2; p >= 0; --p) {
+        run = std::max(run - kLambda * (bitrates_[p + 1] - bitrates_[p]),
+                       plan_base_[p]);
+        out[p] = std::max(out[p], run);
+      }
+    }
+  }
+}
+
+int MpcAbr::PlanRoot(double throughput, double buffer_level, int prev_quality,
+                     double* value)
+{
+  const int* order = PlanOrder(search_depth_, throughput, buffer_level,
+                               prev_quality);
+  const double* bound = &plan_order_bound_[(search_depth_ - 1) *
+                                           bitrates_.size()];
+  double best = 0.0;
+  int quality = -1;
+  for (unsigned i = 0; i < bitrates_.size(); ++i) {
+    if (quality >= 0 && Pruned(bound[i], best)) {
+      break;
+    }
+    int q = order[i];
+    double v = PlanSearch(search_depth_, throughput, buffer_level,
+                          prev_quality, q);
+    // Search() keeps the lowest quality among equal values.
+    if (quality < 0 || v > best || (v == best && q < quality)) {
+      best = v;
+      quality = q;
+    }
+  }
+  *value = best;
+  return quality;
+}
+
+bool MpcAbr::PlanBelow(double throughput, double buffer_level,
+                       int prev_quality, int quality, double threshold)
+{
+  const int* order = PlanOrder(search_depth_, throughput, buffer_level,
+                               prev_quality);
+  const double* bound = &plan_order_bound_[(search_depth_ - 1) *
+                                           bitrates_.size()];
+  for (unsigned i = 0; i < bitrates_.size(); ++i) {
+    if (Pruned(bound[i], threshold)) {
+      return true;
+    }
+    if (order[i] != quality &&
+        PlanSearch(search_depth_, throughput, buffer_level, prev_quality,
+                   order[i]) >= threshold) {
+      return false;
+    }
+  }
+  return true;
+}
+
+double MpcAbr::PlanSearch(int depth, double throughput, double buffer_level,
+                          int prev_quality, int quality)
+{
+  double rebuffer = 0.0;
+  buffer_level = Step(buffer_level, quality, throughput, &rebuffer);
+
+  double value = Evaluate(prev_quality, quality, rebuffer);
+  --depth;
+  if (depth > 0) {
+    const int* order = PlanOrder(depth, throughput, buffer_level, quality);
+    const double* bound = &plan_order_bound_[(depth - 1) * bitrates_.size()];
+    double best = 0.0;
+    for (unsigned i = 0; i < bitrates_.size(); ++i) {
+      if (i > 0 && Pruned(bound[i], best)) {
+        break;
+      }
+      double v = PlanSearch(depth, throughput, buffer_level, quality,
+                            order[i]);
+      if (i == 0 || v > best) {
+        best = v;
+      }
+    }
+    value += best;
+  }
+  return value;
+}
+
+const int* MpcAbr::PlanOrder(int depth, double throughput,
+                             double buffer_level, int prev_quality)
+{
+  const int qualities = bitrates_.size();
+  const int buckets = PlanBuckets();
+  const double* next_layer = &plan_bound_[(size_t)(depth - 1) * buckets *
+                                          qualities];
+  int* order = &plan_order_[(depth - 1) * qualities];
+  double* bound = &plan_order_bound_[(depth - 1) * qualities];
+  // Insertion sort by descending bound, the ladder is short.
+  for (int q = 0; q < qualities; ++q) {
+    double rebuffer = 0.0;
+    double level = Step(buffer_level, q, throughput, &rebuffer);
+    double b = Evaluate(prev_quality, q, rebuffer) +
+        next_layer[Bucket(level, buckets) * qualities + q];
+    int i = q;
+    for (; i > 0 && bound[i - 1] < b; --i) {
+      bound[i] = bound[i - 1];
+      order[i] = order[i - 1];
+    }
+    bound[i] = b;
+    order[i] = q;
+  }
+  return order;
+}
+
+bool MpcAbr::Pruned(double bound, double best)
+{
+  // The bound and the exact value are summed in a different order; only
+  // prune if the difference is more than rounding.
+  return bound < best - 1e-9 * (1.0 + std::fabs(best));
+}
+
+int MpcAbr::Bucket(double buffer_level, int buckets)
+{
+  double pos = std::ceil(buffer_level / kBufferQuantum);
+  if (pos <= 0.0) {
+    return 0;
+  }
+  // Beyond the last grid point the step does not change anymore, since it
+  // starts from at most buffer_size_ - segment_duration_.
+  return pos >= buckets - 1 ? buckets - 1 : (int)pos;
+}
+
+int MpcAbr::PlanBuckets()
+{
+  return std::max(2, (int)(buffer_size_ / kBufferQuantum) + 2);
+}
+
+void MpcAbr::PreUpdate(double pause, double walltime, double segment_size) {
 
   // segment_size is in bytes
   double throughput = 8.0 * segment_size / walltime;
@@ -153,7 +468,11 @@ void MpcAbr::PreUpdate(double pause, uint32_t walltime, double segment_size) {
   }
 
   if (buffer_level_ < 0.0) {
-    std::cerr << (startup ? "[startup] " : "[rebuffer] ") << (int)(-buffer_level_) << std::endl;
+    if (decision_log_) {
+      LogEvent(startup ? kAbrLogStartup : kAbrLogRebuffer, -buffer_level_, 0.0, 0.0, 0);
+    } else {
+      std::cerr << (startup ? "[startup] " : "[rebuffer] ") << (int)(-buffer_level_) << std::endl;
+    }
     buffer_level_ = 0.0;
   }
   startup = false;
@@ -161,12 +480,18 @@ void MpcAbr::PreUpdate(double pause, uint32_t walltime, double segment_size) {
   buffer_level_ += segment_duration_;
 }
 
-void MpcAbr::PostUpdate(double pause, uint32_t walltime) {
+void MpcAbr::PostUpdate(double pause, double walltime) {
   if (pause > 0.0) {
-    std::cerr << "[pause] " << (int)(pause) << std::endl;
     buffer_level_ -= pause;
   }
 
+  if (decision_log_) {
+    LogEvent(kAbrLogBuffer, buffer_level_, pause > 0.0 ? pause : 0.0, 0.0, 0);
+    return;
+  }
+  if (pause > 0.0) {
+    std::cerr << "[pause] " << (int)(pause) << std::endl;
+  }
   std::cerr << "[buffer] " << (int)(buffer_level_) << std::endl;
 }
 
@@ -1,8 +1,11 @@
 #ifndef MPC_ABR
 #define MPC_ABR
 
+#include <algorithm>
 #include <vector>
 #include <list>
+#include <memory>
+#include <string>
 #include <iostream>
 #include <cmath>
 
@@ -11,7 +14,7 @@
 // bitrate in kbps (equivalent to bits/ms)
 
 class BaseAbr;
-class Dispatcher;
+class MpcDecisionTable;
 
 class MpcAbr: public BaseAbr {
  public:
@@ -21,30 +24,118 @@ class MpcAbr: public BaseAbr {
          std::vector<double> bitrates);
 
   int GetQuality(double throughput, double* pause);
+  // Decision of the planner, by SearchQuality() or Plan(), whichever visits
+  // fewer states for the horizon and buffer (see UseSearch()).
+  int PlanQuality(double throughput, double buffer_level, int prev_quality);
+  // Exhaustive Search() over all ladder^horizon download sequences. Cheapest
+  // for short horizons.
+  int SearchQuality(double throughput, double buffer_level, int prev_quality);
+  // Same decision as SearchQuality(), by a branch and bound search whose
+  // bound is computed by dynamic programming over a buffer grid. The grid
+  // alone costs horizon * buffer / kBufferQuantum * ladder steps, so Plan()
+  // only pays off from horizon 4 or 5 on. Its time is not bounded: with a
+  // 13-rung ladder, a decision takes 0.2 ms on average at horizon 5 with a
+  // 20 s buffer, but 0.4 to 1 ms on average and single decisions of several
+  // ms at horizon 8 to 10 (see mpc_bench). Long horizons are not sub-ms.
+  int Plan(double throughput, double buffer_level, int prev_quality);
+  void SetSearchDepth(int depth);
+  // Answers GetQuality() from a precomputed decision table (FastMPC) instead
+  // of planning online. Returns false, and keeps planning online, if the file
+  // is missing or was generated for a different configuration.
+  bool LoadTable(const std::string& path);
   int GetPause();
-  int GetBuffer();
-  void SetBuffer(int lvl);
-  void PreUpdate(double pause, uint32_t walltime, double segment_size);
-  void PostUpdate(double pause, uint32_t walltime);
-  double accept(Dispatcher &dispatcher, DP type, int retry, const std::map<double, SSIMBasedQuality>& ssim_maps) override;
-  const std::vector<AbrLogLine>& GetLog();
+  double GetBuffer();
+  void SetBuffer(double lvl);
+  void PreUpdate(double pause, double walltime, double segment_size);
+  void PostUpdate(double pause, double walltime);
+  // Policy interface of Abr<MpcAbr, Estimator>.
+  AbrDecision Decide(const AbrInput& input, int retry, const SegmentQualities& qualities);
+  AbrDecision DecideStartup(const AbrInput& input, const SegmentQualities& qualities);
+  void StartInFlight(BolaAbandonEvaluator* in_flight,
+                     const SegmentQualities* qualities,
+                     const std::vector<double>& sizes_bits) {}
+  AbrDecision DecideInFlight(const BolaAbandonEvaluator& in_flight,
+                             double buffer_level, double throughput);
 
   int pause;
 
-  //private:
+  static constexpr int kSearchDepth = 5;
+
+ private:
+  // Builds from the planner and checks a table against the configuration.
+  friend class MpcDecisionTable;
+
   double buffer_level_;
   int last_quality_;
   double segment_duration_;
   std::vector<double> bitrates_;
-  std::vector<AbrLogLine> log_;
   double estimate_throughput_;
   double estimate_error_;
   std::list<double> past_errors_;
-  static constexpr int kSearchDepth = 5;
+  // Variance of the latest throughput estimate over its square, 0 if the
+  // estimator gave none.
+  double relative_variance_;
+  // Buffer (ms) a download must leave when it is done, see SafetyMargin().
+  // MPC plans as if it was not there.
+  double safety_margin_;
+  int search_depth_;
   static constexpr int kErrorWindow = 5;
+  static constexpr double kLambda = 1.0;
+  static constexpr double kMu = 3.0;
+  // With a variance from the estimator, MPC plans with the throughput that is
+  // only undershot with this probability instead of discounting by
+  // estimate_error_.
+  static constexpr double kPredictionQuantile = 0.2;
+  // Grid spacing (ms) of the buffer levels used between planning steps.
+  static constexpr double kBufferQuantum = 50;
+  // |throughput| discounted by its uncertainty.
+  double ConservativeThroughput(double throughput);
+  // |buffer_level| without the safety margin.
+  double PlanningBuffer(double buffer_level);
+  // Takes the variance and the transport stats of |input|.
+  void SetInput(const AbrInput& input);
   double Evaluate(int prev_quality, int quality, double rebuffer);
   double Search(int depth, double throughput, double buffer_level,
                 int prev_quality, int quality);
+  // True if Search() visits fewer sequences than Plan() has grid cells.
+  bool UseSearch();
+  // Downloads one segment of |quality| starting at |buffer_level|, returns the
+  // buffer level afterwards and adds the stall time to |rebuffer|.
+  double Step(double buffer_level, int quality, double throughput,
+              double* rebuffer);
+  // The two halves of Plan(): the bound only depends on the throughput and
+  // can be shared by many (buffer level, prev quality) pairs.
+  void PlanValues(double throughput);
+  // Also returns the value of the decision, as Search() computes it.
+  int PlanRoot(double throughput, double buffer_level, int prev_quality,
+               double* value);
+  // True if every first step but |quality| scores below |threshold|. Needs
+  // PlanValues() for |throughput|.
+  bool PlanBelow(double throughput, double buffer_level, int prev_quality,
+                 int quality, double threshold);
+  // Search() with pruning, see Plan().
+  double PlanSearch(int depth, double throughput, double buffer_level,
+                    int prev_quality, int quality);
+  // Qualities of the next step sorted by descending bound, with |depth|
+  // segments left. The bounds are in plan_order_bound_.
+  const int* PlanOrder(int depth, double throughput, double buffer_level,
+                       int prev_quality);
+  static bool Pruned(double bound, double best);
+  // Grid point at or above |buffer_level|.
+  int Bucket(double buffer_level, int buckets);
+  int PlanBuckets();
+
+  // Planner scratch space, reused between decisions to avoid allocation.
+  // Indexed [bucket * bitrates_.size() + quality], plan_bound_ has one such
+  // layer per remaining depth, plan_order_ one row per depth.
+  std::vector<int> step_bucket_;
+  std::vector<double> step_score_;
+  std::vector<double> plan_bound_;
+  std::vector<double> plan_base_;
+  std::vector<int> plan_order_;
+  std::vector<double> plan_order_bound_;
+
+  std::unique_ptr<MpcDecisionTable> table_;
 };
 
 #endif //MPC_ABR
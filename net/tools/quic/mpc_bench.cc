@@ -0,0 +1,100 @@
+// Microbenchmark for the MPC planner: compares the dynamic-programming
+// MpcAbr::Plan() with the exhaustive MpcAbr::Search() recursion, and times
+// MpcAbr::PlanQuality(), which picks one of the two as the client does.
+//
+// Build with ninja -C chrome/src/out/Release mpc_bench, then run
+//   ./mpc_bench [depth] [buffer_ms]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "net/tools/quic/abr.h"
+#include "net/tools/quic/mpc.h"
+
+namespace {
+
+// 13-rung ladder (kbps) similar to the VOXEL manifests.
+const double kLadder[] = {254,  507,  759,  1013, 1254, 1883, 3134,
+                          4952, 6013, 7504, 9020, 12030, 16020};
+const double kSegmentDuration = 4000;
+
+double ElapsedUs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int depth = argc > 1 ? std::atoi(argv[1]) : MpcAbr::kSearchDepth;
+  double buffer_size = argc > 2 ? std::atof(argv[2]) : 20000;
+
+  std::vector<double> bitrates(std::begin(kLadder), std::end(kLadder));
+  MpcAbr mpc(kSegmentDuration, buffer_size, bitrates);
+  mpc.SetSearchDepth(depth);
+
+  // Sweep over throughput, buffer level and previous quality.
+  struct Case { double tput; double buffer; int prev; };
+  std::vector<Case> cases;
+  for (double tput = 200; tput < 20000; tput *= 1.6) {
+    for (double buffer = 0; buffer <= buffer_size; buffer += buffer_size / 4) {
+      for (size_t prev = 0; prev < bitrates.size(); prev += 4) {
+        cases.push_back({tput, buffer, (int)prev});
+      }
+    }
+  }
+
+  std::vector<int> planned(cases.size());
+  double plan_max_us = 0.0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < cases.size(); ++i) {
+    auto decision_start = std::chrono::steady_clock::now();
+    planned[i] = mpc.Plan(cases[i].tput, cases[i].buffer, cases[i].prev);
+    plan_max_us = std::max(plan_max_us, ElapsedUs(decision_start));
+  }
+  double plan_us = ElapsedUs(start);
+
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < cases.size(); ++i) {
+    mpc.PlanQuality(cases[i].tput, cases[i].buffer, cases[i].prev);
+  }
+  double chosen_us = ElapsedUs(start);
+
+  std::cerr << "[mpc-bench] depth:" << depth << " buffer:" << buffer_size
+            << " ladder:" << bitrates.size() << " decisions:" << cases.size()
+            << std::endl;
+  std::cerr << "[mpc-bench] plan us/decision:" << plan_us / cases.size()
+            << " max:" << plan_max_us << std::endl;
+  std::cerr << "[mpc-bench] chosen us/decision:" << chosen_us / cases.size()
+            << std::endl;
+
+  // The exhaustive search grows with ladder^depth, skip it where it would
+  // run for minutes.
+  if (depth > 6) {
+    std::cerr << "[mpc-bench] search skipped for depth > 6" << std::endl;
+    return 0;
+  }
+
+  int mismatches = 0;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < cases.size(); ++i) {
+    int q = mpc.SearchQuality(cases[i].tput, cases[i].buffer, cases[i].prev);
+    if (q != planned[i]) {
+      ++mismatches;
+      std::cerr << "[mpc-bench] mismatch tput:" << cases[i].tput
+                << " buffer:" << cases[i].buffer << " prev:" << cases[i].prev
+                << " search:" << q << " plan:" << planned[i] << std::endl;
+    }
+  }
+  double search_us = ElapsedUs(start);
+
+  std::cerr << "[mpc-bench] search us/decision:" << search_us / cases.size()
+            << std::endl;
+  std::cerr << "[mpc-bench] speedup:" << search_us / plan_us
+            << " mismatches:" << mismatches << std::endl;
+  return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "net/tools/quic/abr.h"
+#include "net/tools/quic/mpc.h"
+#include "net/tools/quic/mpc_table.h"
+
+namespace {
+
+const char kMagic[4] = {'F', 'M', 'P', 'C'};
+
+template <typename T>
+bool WriteValue(FILE* f, const T& value) {
+  return fwrite(&value, sizeof(T), 1, f) == 1;
+}
+
+template <typename T>
+bool ReadValue(FILE* f, T* value) {
+  return fread(value, sizeof(T), 1, f) == 1;
+}
+
+template <typename T>
+bool WriteVector(FILE* f, const std::vector<T>& values) {
+  uint32_t n = values.size();
+  return WriteValue(f, n) &&
+      (n == 0 || fwrite(values.data(), sizeof(T), n, f) == n);
+}
+
+template <typename T>
+bool ReadVector(FILE* f, std::vector<T>* values) {
+  uint32_t n = 0;
+  if (!ReadValue(f, &n)) {
+    return false;
+  }
+  values->resize(n);
+  return n == 0 || fread(values->data(), sizeof(T), n, f) == n;
+}
+
+bool SameValue(double a, double b) {
+  return std::fabs(a - b) <= 1e-9 * std::max(1.0, std::fabs(a));
+}
+
+}  // namespace
+
+MpcDecisionTable::MpcDecisionTable()
+    : segment_duration_(0.0),
+      buffer_size_(0.0),
+      lambda_(0.0),
+      mu_(0.0),
+      horizon_(0),
+      buffer_bins_(0),
+      throughput_bins_(0),
+      throughput_min_(0.0),
+      throughput_max_(0.0)
+{
+}
+
+void MpcDecisionTable::Build(MpcAbr& mpc)
+{
+  segment_duration_ = mpc.segment_duration_;
+  buffer_size_ = mpc.buffer_size_;
+  lambda_ = MpcAbr::kLambda;
+  mu_ = MpcAbr::kMu;
+  horizon_ = mpc.search_depth_;
+  bitrates_ = mpc.bitrates_;
+
+  const uint32_t qualities = bitrates_.size();
+  // The grid reaches buffer_size_. Beyond it the first step of the planner
+  // clamps the buffer, so the decision does not change anymore.
+  buffer_bins_ = (uint32_t)std::ceil(buffer_size_ / kBufferStep) + 1;
+  throughput_bins_ = kThroughputBins;
+  // Cover well below the lowest and above the highest rung, the client plans
+  // online outside of this range.
+  throughput_min_ = bitrates_.front() / 4.0;
+  throughput_max_ = bitrates_.back() * 4.0;
+
+  // The value of every download sequence, and so of every first step, does
+  // not decrease with the buffer level or the throughput: more buffer or a
+  // faster download never stalls longer. In a cell of the lattice below, a
+  // first step thus scores at least its value at the lower corner and at
+  // most its value at the upper corner. If the decision at the lower corner
+  // beats all other steps at the upper corner, the planner chooses it
+  // everywhere in the lattice cell. A table cell holds a decision if all its
+  // lattice cells agree on one.
+  const uint32_t buffer_cells = buffer_bins_ - 1;
+  const uint32_t throughput_cells = throughput_bins_ - 1;
+  const uint32_t buffer_points = buffer_cells * kCellSamples + 1;
+  const uint32_t throughput_points = throughput_cells * kCellSamples + 1;
+  // Decision and its value at each lattice point of the previous throughput
+  // step, [v * qualities + p].
+  std::vector<uint8_t> lower_quality((size_t)buffer_points * qualities);
+  std::vector<double> lower_value((size_t)buffer_points * qualities);
+  // cells[(t * buffer_cells + b) * qualities + p]
+  std::vector<uint8_t> cells((size_t)throughput_cells * buffer_cells *
+                             qualities);
+  for (uint32_t w = 0; w < throughput_points; ++w) {
+    double throughput = ThroughputAt((double)w / kCellSamples);
+    mpc.PlanValues(throughput);
+    if (w > 0) {
+      const uint32_t t = (w - 1) / kCellSamples;
+      for (uint32_t v = 0; v + 1 < buffer_points; ++v) {
+        const uint32_t b = v / kCellSamples;
+        const bool first = (w - 1) % kCellSamples == 0 &&
+            v % kCellSamples == 0;
+        for (uint32_t p = 0; p < qualities; ++p) {
+          uint8_t* cell = &cells[((size_t)t * buffer_cells + b) * qualities +
+                                 p];
+          if (!first && *cell == kAmbiguousCell) {
+            continue;
+          }
+          const size_t lower = (size_t)v * qualities + p;
+          uint8_t q = lower_quality[lower];
+          // Values are sums in a fixed order, leave room for rounding.
+          double threshold = lower_value[lower] -
+              1e-9 * (1.0 + std::fabs(lower_value[lower]));
+          if (!mpc.PlanBelow(throughput, (v + 1) * kBufferStep / kCellSamples,
+                             p, q, threshold)) {
+            q = kAmbiguousCell;
+          }
+          *cell = first || *cell == q ? q : kAmbiguousCell;
+        }
+      }
+    }
+    for (uint32_t v = 0; v < buffer_points; ++v) {
+      for (uint32_t p = 0; p < qualities; ++p) {
+        const size_t point = (size_t)v * qualities + p;
+        lower_quality[point] = mpc.PlanRoot(
+            throughput, v * kBufferStep / kCellSamples, p,
+            &lower_value[point]);
+      }
+    }
+  }
+
+  row_offset_.clear();
+  run_end_.clear();
+  run_quality_.clear();
+  for (uint32_t b = 0; b < buffer_cells; ++b) {
+    for (uint32_t p = 0; p < qualities; ++p) {
+      row_offset_.push_back(run_quality_.size());
+      for (uint32_t t = 0; t < throughput_cells; ++t) {
+        uint8_t q = cells[((size_t)t * buffer_cells + b) * qualities + p];
+        if (run_quality_.size() == row_offset_.back() ||
+            run_quality_.back() != q) {
+          run_quality_.push_back(q);
+          run_end_.push_back(t + 1);
+        } else {
+          run_end_.back() = t + 1;
+        }
+      }
+    }
+  }
+  row_offset_.push_back(run_quality_.size());
+}
+
+bool MpcDecisionTable::Save(const std::string& path) const
+{
+  FILE* f = fopen(path.c_str(), "wb");
+  if (f == nullptr) {
+    return false;
+  }
+  const uint32_t version = kVersion;
+  bool ok = fwrite(kMagic, sizeof(kMagic), 1, f) == 1 &&
+      WriteValue(f, version) &&
+      WriteValue(f, segment_duration_) &&
+      WriteValue(f, buffer_size_) &&
+      WriteValue(f, lambda_) &&
+      WriteValue(f, mu_) &&
+      WriteValue(f, horizon_) &&
+      WriteVector(f, bitrates_) &&
+      WriteValue(f, buffer_bins_) &&
+      WriteValue(f, throughput_bins_) &&
+      WriteValue(f, throughput_min_) &&
+      WriteValue(f, throughput_max_) &&
+      WriteVector(f, row_offset_) &&
+      WriteVector(f, run_end_) &&
+      WriteVector(f, run_quality_);
+  return fclose(f) == 0 && ok;
+}
+
+bool MpcDecisionTable::Load(const std::string& path)
+{
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f == nullptr) {
+    return false;
+  }
+  char magic[sizeof(kMagic)];
+  uint32_t version = 0;
+  bool ok = fread(magic, sizeof(magic), 1, f) == 1 &&
+      memcmp(magic, kMagic, sizeof(kMagic)) == 0 &&
+      ReadValue(f, &version) && version == kVersion &&
+      ReadValue(f, &segment_duration_) &&
+      ReadValue(f, &buffer_size_) &&
+      ReadValue(f, &lambda_) &&
+      ReadValue(f, &mu_) &&
+      ReadValue(f, &horizon_) &&
+      ReadVector(f, &bitrates_) &&
+      ReadValue(f, &buffer_bins_) &&
+      ReadValue(f, &throughput_bins_) &&
+      ReadValue(f, &throughput_min_) &&
+      ReadValue(f, &throughput_max_) &&
+      ReadVector(f, &row_offset_) &&
+      ReadVector(f, &run_end_) &&
+      ReadVector(f, &run_quality_);
+  fclose(f);
+
+  // Reject truncated or inconsistent files instead of indexing out of range.
+  ok = ok && !bitrates_.empty() && buffer_bins_ > 1 && throughput_bins_ > 1 &&
+      throughput_min_ > 0.0 && throughput_max_ > throughput_min_ &&
+      row_offset_.size() == (size_t)(buffer_bins_ - 1) * bitrates_.size() + 1 &&
+      row_offset_.back() == run_quality_.size() &&
+      run_end_.size() == run_quality_.size();
+  for (size_t r = 0; ok && r + 1 < row_offset_.size(); ++r) {
+    ok = row_offset_[r] < row_offset_[r + 1] &&
+        run_end_[row_offset_[r + 1] - 1] == throughput_bins_ - 1;
+  }
+  for (size_t i = 0; ok && i < run_quality_.size(); ++i) {
+    ok = run_quality_[i] < bitrates_.size() ||
+        run_quality_[i] == kAmbiguousCell;
+  }
+  if (!ok) {
+    bitrates_.clear();
+    row_offset_.clear();
+    run_end_.clear();
+    run_quality_.clear();
+  }
+  return ok;
+}
+
+bool MpcDecisionTable::Matches(const MpcAbr& mpc) const
+{
+  if (bitrates_.size() != mpc.bitrates_.size() ||
+      horizon_ != mpc.search_depth_ ||
+      !SameValue(segment_duration_, mpc.segment_duration_) ||
+      !SameValue(buffer_size_, mpc.buffer_size_) ||
+      !SameValue(lambda_, MpcAbr::kLambda) ||
+      !SameValue(mu_, MpcAbr::kMu)) {
+    return false;
+  }
+  for (size_t i = 0; i < bitrates_.size(); ++i) {
+    if (!SameValue(bitrates_[i], mpc.bitrates_[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int MpcDecisionTable::Lookup(double buffer_level, int prev_quality,
+                             double throughput) const
+{
+  // Beyond the grid the decision was not checked. Above it the buffer is
+  // clamped by the planner's first step, so the last cell still holds.
+  if (!(buffer_level >= 0.0) || !(throughput >= throughput_min_) ||
+      !(throughput <= throughput_max_)) {
+    return kAmbiguous;
+  }
+  size_t row = (size_t)BufferCell(buffer_level) * bitrates_.size() +
+      prev_quality;
+  int quality = Decision(row, ThroughputCell(throughput));
+  return quality == kAmbiguousCell ? kAmbiguous : quality;
+}
+
+int MpcDecisionTable::Decision(size_t row, int throughput_cell) const
+{
+  uint32_t i = row_offset_[row];
+  while (run_end_[i] <= throughput_cell) {
+    ++i;
+  }
+  return run_quality_[i];
+}
+
+int MpcDecisionTable::BufferCell(double buffer_level) const
+{
+  double pos = buffer_level / kBufferStep;
+  return pos >= buffer_bins_ - 1 ? buffer_bins_ - 2 : (int)pos;
+}
+
+// Throughput grid points are spaced logarithmically between throughput_min_
+// and throughput_max_, which keeps the relative error constant over the
+// ladder.
+int MpcDecisionTable::ThroughputCell(double throughput) const
+{
+  double pos = std::log(throughput / throughput_min_) /
+      std::log(throughput_max_ / throughput_min_) * (throughput_bins_ - 1);
+  if (!(pos > 0.0)) {
+    return 0;
+  }
+  return pos >= throughput_bins_ - 1 ? throughput_bins_ - 2 : (int)pos;
+}
+
+double MpcDecisionTable::ThroughputAt(double pos) const
+{
+  return throughput_min_ * std::pow(throughput_max_ / throughput_min_,
+                                    pos / (throughput_bins_ - 1));
+}
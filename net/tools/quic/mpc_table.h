@@ -0,0 +1,82 @@
+#ifndef MPC_TABLE
+#define MPC_TABLE
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// time in ms
+// bitrate in kbps (equivalent to bits/ms)
+
+class MpcAbr;
+
+// Offline-precomputed MPC decisions (FastMPC). The table holds one decision
+// per cell of a (buffer level, already error-discounted throughput) grid and
+// previous quality. Along the throughput axis the cells are run-length
+// encoded, so a lookup walks at most one run per quality.
+//
+// The decision is not monotone in the buffer level or the throughput, and
+// flips in islands narrower than any grid. A cell only holds a decision if
+// the planner provably gives it everywhere in the cell (see Build()). Other
+// cells are ambiguous, and near a decision boundary the caller plans online
+// instead.
+class MpcDecisionTable {
+ public:
+  MpcDecisionTable();
+
+  // Fills the table from |mpc|'s planner and configuration.
+  void Build(MpcAbr& mpc);
+
+  bool Save(const std::string& path) const;
+  bool Load(const std::string& path);
+
+  // True if the table was generated for the configuration of |mpc|.
+  bool Matches(const MpcAbr& mpc) const;
+
+  // Returns kAmbiguous if the cell of the query is ambiguous.
+  int Lookup(double buffer_level, int prev_quality, double throughput) const;
+
+  static constexpr int kAmbiguous = -1;
+
+  size_t runs() const { return run_quality_.size(); }
+
+ private:
+  // Cell of the value, which must not be below the grid; values above it
+  // belong to the last cell.
+  int BufferCell(double buffer_level) const;
+  int ThroughputCell(double throughput) const;
+  // Throughput at |pos| grid steps above throughput_min_.
+  double ThroughputAt(double pos) const;
+  int Decision(size_t row, int throughput_cell) const;
+
+  static constexpr uint32_t kVersion = 3;
+  static constexpr double kBufferStep = 200;
+  static constexpr uint32_t kThroughputBins = 512;
+  // Lattice cells per cell edge; finer lattices leave fewer cells
+  // ambiguous.
+  static constexpr int kCellSamples = 4;
+  // Quality of an ambiguous run.
+  static constexpr uint8_t kAmbiguousCell = 0xff;
+
+  double segment_duration_;
+  double buffer_size_;
+  double lambda_;
+  double mu_;
+  int32_t horizon_;
+  std::vector<double> bitrates_;
+
+  // Grid points per axis; there is one cell less.
+  uint32_t buffer_bins_;
+  uint32_t throughput_bins_;
+  double throughput_min_;
+  double throughput_max_;
+
+  // Runs of row r are [row_offset_[r], row_offset_[r + 1]), with
+  // r = buffer_cell * bitrates_.size() + prev_quality. A run covers the
+  // throughput cells below run_end_.
+  std::vector<uint32_t> row_offset_;
+  std::vector<uint16_t> run_end_;
+  std::vector<uint8_t> run_quality_;
+};
+
+#endif //MPC_TABLE
@@ -0,0 +1,117 @@
+// Generates the FastMPC decision table loaded by quic_client --mpc_table.
+//
+// Build with ninja -C chrome/src/out/Release mpc_table_gen, then run
+//   ./mpc_table_gen <out> <segment_ms> <buffer_ms> <horizon> <kbps,kbps,...>
+// with the ladder of the MPD (ascending bandwidths in kbps) and the same
+// --abr_buf and --mpc_horizon values the client uses. Fails, and writes
+// nothing, if the table disagrees with the planner at any spot check.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "net/tools/quic/abr.h"
+#include "net/tools/quic/mpc.h"
+#include "net/tools/quic/mpc_table.h"
+
+namespace {
+
+// Spot checks at random points, in addition to the sweep.
+const int kRandomQueries = 20000;
+
+struct Query {
+  double tput;
+  double buffer;
+  int prev;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 6) {
+    std::cerr << "usage: " << argv[0]
+              << " <out> <segment_ms> <buffer_ms> <horizon> <kbps,kbps,...>"
+              << std::endl;
+    return 1;
+  }
+  std::string out = argv[1];
+  double segment_duration = std::atof(argv[2]);
+  double buffer_size = std::atof(argv[3]);
+  int horizon = std::atoi(argv[4]);
+
+  std::vector<double> bitrates;
+  std::istringstream iss(argv[5]);
+  std::string rate;
+  while (std::getline(iss, rate, ',')) {
+    bitrates.push_back(std::atof(rate.c_str()));
+  }
+  if (bitrates.size() < 2 || segment_duration <= 0 || buffer_size <= 0 ||
+      horizon < 1) {
+    std::cerr << "invalid configuration" << std::endl;
+    return 1;
+  }
+
+  MpcAbr mpc(segment_duration, buffer_size, bitrates);
+  mpc.SetSearchDepth(horizon);
+
+  auto start = std::chrono::steady_clock::now();
+  MpcDecisionTable table;
+  table.Build(mpc);
+  auto build_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+  // Spot-check the table against the online planner, on a sweep and at
+  // random points off the table grid. Ambiguous lookups are planned online by
+  // the client, so only answered lookups can be wrong.
+  std::vector<Query> queries;
+  for (double tput = bitrates.front() / 2; tput < bitrates.back() * 2;
+       tput *= 1.37) {
+    for (double buffer = 0; buffer <= buffer_size; buffer += 730) {
+      for (size_t prev = 0; prev < bitrates.size(); ++prev) {
+        queries.push_back({tput, buffer, (int)prev});
+      }
+    }
+  }
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> log_tput(
+      std::log(bitrates.front() / 2), std::log(bitrates.back() * 2));
+  std::uniform_real_distribution<double> buffer_level(0, buffer_size);
+  for (int i = 0; i < kRandomQueries; ++i) {
+    queries.push_back({std::exp(log_tput(rng)), buffer_level(rng),
+                       (int)(rng() % bitrates.size())});
+  }
+
+  int ambiguous = 0;
+  int mismatches = 0;
+  for (const Query& query : queries) {
+    int quality = table.Lookup(query.buffer, query.prev, query.tput);
+    if (quality == MpcDecisionTable::kAmbiguous) {
+      ++ambiguous;
+    } else if (quality != mpc.Plan(query.tput, query.buffer, query.prev)) {
+      ++mismatches;
+      std::cerr << "[mpc-table] mismatch tput:" << query.tput
+                << " buffer:" << query.buffer << " prev:" << query.prev
+                << " table:" << quality << std::endl;
+    }
+  }
+
+  std::cerr << "[mpc-table] " << out << " runs:" << table.runs()
+            << " build:" << build_ms << "ms"
+            << " ambiguous:" << ambiguous << "/" << queries.size()
+            << " mismatches:" << mismatches << "/" << queries.size()
+            << std::endl;
+  // A table which answers differently than the planner is not written.
+  if (mismatches > 0) {
+    return 1;
+  }
+  if (!table.Save(out)) {
+    std::cerr << "cannot write " << out << std::endl;
+    return 1;
+  }
+  return 0;
+}
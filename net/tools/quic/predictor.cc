@@ -0,0 +1,139 @@
+#include "net/tools/quic/predictor.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Smallest bandwidth (kbps) a sample may report, keeps log() finite.
+const double kMinThroughput = 1.0;
+
+const double kPi = 3.14159265358979323846;
+
+}  // namespace
+
+KalmanPredictor::KalmanPredictor()
+    : KalmanPredictor(kProcessNoise, kMeasurementNoise)
+{
+}
+
+KalmanPredictor::KalmanPredictor(double process_noise, double measurement_noise)
+    : process_noise_(process_noise),
+      initial_measurement_noise_(measurement_noise),
+      measurement_noise_(measurement_noise),
+      log_mean_(0.0),
+      log_variance_(0.0),
+      innovation_deviation_(0.0),
+      samples_(0)
+{
+}
+
+void KalmanPredictor::Reset()
+{
+  measurement_noise_ = initial_measurement_noise_;
+  log_mean_ = 0.0;
+  log_variance_ = 0.0;
+  innovation_deviation_ = 0.0;
+  samples_ = 0;
+}
+
+void KalmanPredictor::Update(double throughput, double elapsed)
+{
+  const double z = std::log(std::max(throughput, kMinThroughput));
+  if (samples_ == 0) {
+    // Nothing to predict from yet, the first sample is all there is.
+    log_mean_ = z;
+    log_variance_ = measurement_noise_;
+    // Expected |innovation| of a sample with twice the measurement noise.
+    innovation_deviation_ = std::sqrt(2 / kPi * 2 * measurement_noise_);
+    ++samples_;
+    return;
+  }
+  // Predict: the bandwidth drifted for |elapsed| ms.
+  log_variance_ += process_noise_ * std::max(elapsed, 0.0) / 1000.0;
+  const double innovation = z - log_mean_;
+  // Links differ in how noisy they are, so the measurement noise is what the
+  // innovations show beyond the predicted variance. Their mean absolute value
+  // is used since outages would dominate the squares.
+  innovation_deviation_ += kNoiseAdaptation * (std::fabs(innovation) - innovation_deviation_);
+  const double innovation_variance = kPi / 2 * innovation_deviation_ * innovation_deviation_;
+  const double min_noise = kMinMeasurementNoise;
+  measurement_noise_ = std::max(min_noise, innovation_variance - log_variance_);
+  // Correct.
+  const double gain = log_variance_ / (log_variance_ + measurement_noise_);
+  log_mean_ += gain * innovation;
+  log_variance_ *= 1.0 - gain;
+  ++samples_;
+}
+
+double KalmanPredictor::Mean() const
+{
+  if (samples_ == 0) {
+    return 0.0;
+  }
+  return std::exp(log_mean_ + PredictedLogVariance() / 2);
+}
+
+double KalmanPredictor::Variance() const
+{
+  if (samples_ == 0) {
+    return 0.0;
+  }
+  const double v = PredictedLogVariance();
+  return (std::exp(v) - 1.0) * std::exp(2 * log_mean_ + v);
+}
+
+double KalmanPredictor::Quantile(double p) const
+{
+  if (samples_ == 0) {
+    return 0.0;
+  }
+  return std::exp(log_mean_ + NormalQuantile(p) * std::sqrt(PredictedLogVariance()));
+}
+
+double NormalQuantile(double p)
+{
+  // Acklam's rational approximation, relative error below 1.2e-9.
+  static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                             -2.759285104469687e+02, 1.383577518672690e+02,
+                             -3.066479806614716e+01, 2.506628277459239e+00};
+  static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                             -1.556989798598866e+02, 6.680131188771972e+01,
+                             -1.328068155288572e+01};
+  static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                             -2.400758277161838e+00, -2.549732539343734e+00,
+                             4.374664141464968e+00, 2.938163982698783e+00};
+  static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01,
+                             2.445134137142996e+00, 3.754408661907416e+00};
+  const double kLow = 0.02425;
+
+  if (p <= 0.0) {
+    return -INFINITY;
+  }
+  if (p >= 1.0) {
+    return INFINITY;
+  }
+  if (p < kLow) {
+    double q = std::sqrt(-2 * std::log(p));
+    return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+           ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+  }
+  if (p > 1 - kLow) {
+    return -NormalQuantile(1 - p);
+  }
+  double q = p - 0.5;
+  double r = q * q;
+  return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+         (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+double ThroughputQuantile(double throughput, double relative_variance,
+                          double p)
+{
+  if (relative_variance <= 0.0 || throughput <= 0.0) {
+    return throughput;
+  }
+  // Log-normal with mean |throughput|: sigma^2 = ln(1 + var / mean^2).
+  const double v = std::log1p(relative_variance);
+  return throughput * std::exp(-v / 2 + NormalQuantile(p) * std::sqrt(v));
+}
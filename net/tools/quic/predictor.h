@@ -0,0 +1,66 @@
+#ifndef THROUGHPUT_PREDICTOR
+#define THROUGHPUT_PREDICTOR
+
+// time in ms
+// bitrate in kbps (equivalent to bits/ms)
+
+// Kalman filter over the logarithm of the available bandwidth. The bandwidth
+// is modelled as a random walk in log space, whose variance grows with the
+// time between samples, and every throughput sample as the bandwidth times
+// log-normal noise. In log space both are linear, so the plain Kalman update
+// is exact and no unscented transform is needed; mean and variance in kbps
+// follow from the log-normal distribution. The measurement noise is learned
+// from the innovations.
+class KalmanPredictor {
+ public:
+  KalmanPredictor();
+  KalmanPredictor(double process_noise, double measurement_noise);
+
+  // Adds a throughput sample measured |elapsed| ms after the previous one.
+  void Update(double throughput, double elapsed);
+  void Reset();
+  bool empty() const { return samples_ == 0; }
+
+  // Predicted throughput (kbps) of the next sample and its variance
+  // (kbps^2).
+  double Mean() const;
+  double Variance() const;
+  // Bandwidth that is only undershot with probability |p|, e.g. 0.2 for a
+  // conservative estimate.
+  double Quantile(double p) const;
+
+  // Variance (per second) of the log bandwidth random walk.
+  static constexpr double kProcessNoise = 0.02;
+  // Variance of the log ratio between a sample and the bandwidth, before it
+  // is learned from the samples.
+  static constexpr double kMeasurementNoise = 0.05;
+  static constexpr double kMinMeasurementNoise = 0.005;
+  // Weight of the latest innovation in the measurement noise estimate.
+  static constexpr double kNoiseAdaptation = 0.1;
+
+ private:
+  // Variance of the log of the next sample.
+  double PredictedLogVariance() const {
+    return log_variance_ + measurement_noise_;
+  }
+
+  double process_noise_;
+  double initial_measurement_noise_;
+  double measurement_noise_;
+  double log_mean_;
+  double log_variance_;
+  // Running average of the absolute innovations.
+  double innovation_deviation_;
+  unsigned samples_;
+};
+
+// Standard normal quantile.
+double NormalQuantile(double p);
+
+// Quantile |p| of the bandwidth if |throughput| is the mean of a log-normal
+// bandwidth whose variance is |relative_variance| times the squared
+// mean. Returns |throughput| unchanged if |relative_variance| is 0.
+double ThroughputQuantile(double throughput, double relative_variance,
+                          double p);
+
+#endif //THROUGHPUT_PREDICTOR
@@ -0,0 +1,153 @@
+// Replays bandwidth traces through the Kalman throughput predictor and reports
+// how well its mean and quantile predict the next segment's throughput,
+// next to the error-discounted harmonic mean that MPC uses by default.
+//
+// Build with ninja -C chrome/src/out/Release predictor_eval, then run
+//   ./predictor_eval [segment_ms] [quantile] bandwidth-traces/*.sum
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "net/tools/quic/predictor.h"
+
+namespace {
+
+// Same window as MpcAbr::kErrorWindow and TransportHarmonic.
+const size_t kWindow = 5;
+
+// Reads a trace of "<second> <bytes during that second>" lines and averages
+// it over |segment_ms| windows, returning one throughput (kbps) per window.
+bool ReadTrace(const std::string& path, double segment_ms,
+               std::vector<double>* samples) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  const int seconds_per_sample = std::max(1, (int)(segment_ms / 1000));
+  double second;
+  double bytes;
+  double sum = 0;
+  int count = 0;
+  while (file >> second >> bytes) {
+    sum += bytes;
+    if (++count == seconds_per_sample) {
+      // bytes / s * 8 / 1000 === kbps
+      samples->push_back(sum * 8 / 1000 / count);
+      sum = 0;
+      count = 0;
+    }
+  }
+  return true;
+}
+
+struct Score {
+  size_t predictions = 0;
+  // |ln(predicted / actual)|, outages would dominate relative errors.
+  double log_error = 0;
+  // The next sample was at least the conservative estimate.
+  size_t covered = 0;
+  // How far the conservative estimate stays below the next sample.
+  double shortfall = 0;
+
+  void Add(double predicted, double conservative, double actual) {
+    ++predictions;
+    log_error += std::fabs(std::log(predicted / actual));
+    if (actual >= conservative) {
+      ++covered;
+      shortfall += (actual - conservative) / actual;
+    }
+  }
+  void Print(const char* name) const {
+    std::cerr << " " << name << "-logerr:" << log_error / predictions
+              << " " << name << "-cover:" << (double)covered / predictions
+              << " " << name << "-slack:" << shortfall / std::max<size_t>(covered, 1);
+  }
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int first_trace = 1;
+  double segment_ms = 4000;
+  double quantile = 0.2;
+  if (argc > 1 && std::atof(argv[1]) > 0) {
+    segment_ms = std::atof(argv[1]);
+    ++first_trace;
+    if (argc > 2 && std::atof(argv[2]) > 0) {
+      quantile = std::atof(argv[2]);
+      ++first_trace;
+    }
+  }
+  if (first_trace >= argc) {
+    std::cerr << "usage: " << argv[0] << " [segment_ms] [quantile] <trace>..."
+              << std::endl;
+    return 1;
+  }
+
+  std::cerr << "[predictor-eval] segment:" << segment_ms
+            << " quantile:" << quantile
+            << " target-cover:" << 1 - quantile << std::endl;
+
+  int failed = 0;
+  for (int i = first_trace; i < argc; ++i) {
+    std::vector<double> samples;
+    if (!ReadTrace(argv[i], segment_ms, &samples)) {
+      std::cerr << "cannot read " << argv[i] << std::endl;
+      failed = 1;
+      continue;
+    }
+
+    KalmanPredictor kalman;
+    std::deque<double> window;
+    std::deque<double> errors;
+    double harmonic = 0;
+    Score kalman_score;
+    Score harmonic_score;
+    for (double actual : samples) {
+      if (actual <= 0) {
+        // Outage, nothing is downloaded and nothing measured.
+        continue;
+      }
+      if (!kalman.empty()) {
+        kalman_score.Add(kalman.Mean(), kalman.Quantile(quantile), actual);
+      }
+      if (!window.empty()) {
+        // As in MpcAbr: discounted by the max relative error of the last
+        // predictions.
+        double max_error = errors.empty() ? 0 : *std::max_element(errors.begin(), errors.end());
+        harmonic_score.Add(harmonic, harmonic / (1 + max_error), actual);
+        errors.push_back(std::fabs(harmonic - actual) / actual);
+        if (errors.size() > kWindow) {
+          errors.pop_front();
+        }
+      }
+
+      kalman.Update(actual, segment_ms);
+      window.push_back(actual);
+      if (window.size() > kWindow) {
+        window.pop_front();
+      }
+      double reciprocal = 0;
+      for (double tp : window) {
+        reciprocal += 1 / tp;
+      }
+      harmonic = window.size() / reciprocal;
+    }
+
+    std::string name = argv[i];
+    name = name.substr(name.find_last_of('/') + 1);
+    std::cerr << "[predictor-eval] " << name << " n:" << samples.size();
+    if (kalman_score.predictions > 0) {
+      kalman_score.Print("kalman");
+      harmonic_score.Print("harmonic");
+    }
+    std::cerr << std::endl;
+  }
+  return failed;
+}
@@ -65,6 +65,7 @@
 #include "net/http/transport_security_state.h"
 #include "net/quic/crypto/proof_verifier_chromium.h"
 #include "net/spdy/spdy_http_utils.h"
+#include "net/third_party/quic/core/quic_connection_stats.h"
 #include "net/third_party/quic/core/quic_error_codes.h"
 #include "net/third_party/quic/core/quic_packets.h"
 #include "net/third_party/quic/core/quic_server_id.h"
@@ -84,6 +85,10 @@
 #include "bola.h"
 #include "mpc.h"
 #include "tput.h"
+#include "predictor.h"
+#include "segment_writer.h"
+#include "session_prior.h"
+#include "timestamping_network_helper.h"
 
 using net::CertVerifier;
 using net::CTVerifier;
@@ -135,10 +140,55 @@ std::string FLAGS_abr = "bola";
 
 bool FLAGS_fine = false;
 
+// Throughput estimator used by the ABR. Empty uses the ABR's own estimator,
+// "train" the receiver side delivery rate of TransportPacketTrain, "kalman"
+// the KalmanPredictor of TransportKalman, whose variance mpc and bola use to
+// plan conservatively.
+std::string FLAGS_estimator = "";
+
+// Number of segments the MPC planner looks ahead.
+int32_t FLAGS_mpc_horizon = MpcAbr::kSearchDepth;
+
+// Precomputed FastMPC decision table (see mpc_table_gen). If empty, missing
+// or built for a different configuration, mpc plans online.
+std::string FLAGS_mpc_table = "";
+
+// Binary decision log (see abr_log_reader). If empty, decisions and buffer
+// events are printed to stderr.
+std::string FLAGS_abr_log = "";
+
+// Number of segments whose quality is decided, and whose reliable part is
+// requested, while the current segment is still downloading. 0 downloads
+// strictly one request at a time.
+int32_t FLAGS_pipeline = 0;
+
+// If true, the reliable and the required unreliable part of a segment are
+// requested together instead of one after the other.
+bool FLAGS_concurrent = false;
+
+// Time (ms) between abandonment checks of an in-flight download.
+int32_t FLAGS_abandon_interval = quic::kAbandonCheckInterval;
+
+// If true, the client blocks in the message loop while it waits for a
+// download and services the connection during ABR pauses instead of sleeping.
+bool FLAGS_block = false;
+
+// If true, the counters of the connection are printed before it closes.
+bool FLAGS_connection_stats = false;
+
+// If set, every segment is written to <dir>/<n>.seg (0 is the init segment)
+// instead of stdout.
+std::string FLAGS_segment_dir = "";
+
+// Estimator state per server (see SessionPriorStore), saved at the end of the
+// session. If a recent one exists for the server, the estimator starts from it
+// and the ABR chooses the first segment instead of the lowest quality.
+std::string FLAGS_prior_file = "";
+
 //constexpr double kTargetSSIM = 0.88;
 
-// Contains one entry (map) per segment.
-std::vector<std::map<double, SSIMBasedQuality>> ssim_map;
+// Contains one quality table per segment.
+std::vector<SegmentQualities> segment_qualities;
 std::vector<double> avg_ssims;
 
 class FakeProofVerifier : public quic::ProofVerifier {
@@ -184,15 +234,15 @@ class Transport : public TransportInterface {
       client_->SetFine(fine);
     }
 
-    uint32_t GetTime(bool unrel) override {
+    int64_t GetTime(bool unrel) override {
       return client_->GetTime(unrel);
     }
 
-    uint32_t GetRealTime(bool unrel) override {
+    int64_t GetRealTime(bool unrel) override {
       return client_->GetRealTime(unrel);
     }
 
-    uint32_t GetTime() override {
+    int64_t GetTime() override {
       return client_->GetTime();
     }
 
@@ -200,23 +250,27 @@ class Transport : public TransportInterface {
       return client_->GetSegmentSize(unrel);
     }
 
+    TransportStats GetTransportStats() override {
+      return client_->GetTransportStats();
+    }
+
   protected:
     net::QuicSimpleClient* client_;
     bool fine_;
 };
 
-class TransportBola : public Transport {
+class TransportBola final : public Transport {
  public:
   TransportBola(net::QuicSimpleClient* client, bool fine) : Transport(client, fine) {}
 
   double AddThroughput() override {
-    uint32_t total_time = client_->GetSumTime(quic::sst_unrel);
+    int64_t total_time_us = client_->GetSumTime(quic::sst_unrel);
     double current_throughput = client_->GetSumThroughput(quic::sst_unrel).first;
     if (current_throughput == 0) {
       current_throughput = client_->GetSumThroughput(quic::sst_rel).first;
-      total_time = client_->GetSumTime(quic::sst_rel);
+      total_time_us = client_->GetSumTime(quic::sst_rel);
     }
-    ma.AddMeasurement(current_throughput, total_time);
+    ma.AddMeasurement(current_throughput, total_time_us / 1000.0);
 
     return ma.GetThroughput();
   }
@@ -224,25 +278,36 @@ class TransportBola : public Transport {
   double GetTput() override {
     return ma.GetThroughput();
   }
+
+  void WarmStart(const EstimatorPrior& prior) override {
+    ma.Seed(prior.ewma_slow, prior.ewma_fast);
+  }
+
+  void SavePrior(EstimatorPrior* prior) override {
+    Transport::SavePrior(prior);
+    prior->ewma_slow = ma.GetSlow();
+    prior->ewma_fast = ma.GetFast();
+  }
  private:
   MovingAverage ma;
 };
 
-class TransportSLST : public Transport {
+class TransportSLST final : public Transport {
  public:
   double alpha = 0;
 
   TransportSLST(net::QuicSimpleClient* client, bool fine) : Transport(client, fine) {}
 
   double AddThroughput() override {
-    uint32_t total_time = GetTime();
+    int64_t total_time_us = GetTime();
     double total_size = 0;
     if (fine_) {
       total_size = client_->GetReceivedSize();
     } else {
       total_size = client_->GetSegmentSize();
     }
-    double current_throughput = (total_size * 8) / total_time;
+    // bits / us * 1000 === kbps
+    double current_throughput = (total_size * 8 * 1000.0) / total_time_us;
     throughput = alpha * throughput + (1.0 - alpha) * current_throughput;
 
     return GetTput();
@@ -252,23 +317,28 @@ class TransportSLST : public Transport {
     return throughput;
   }
 
+  void WarmStart(const EstimatorPrior& prior) override {
+    throughput = prior.throughput;
+  }
+
  private:
   double throughput = 0.0;
 };
 
-class TransportHarmonic : public Transport {
+class TransportHarmonic final : public Transport {
  public:
   TransportHarmonic(net::QuicSimpleClient* client, bool fine) : Transport(client, fine) {}
 
   double AddThroughput() override {
-    uint32_t total_time = GetTime();
+    int64_t total_time_us = GetTime();
     double total_size = 0;
     if (fine_) {
       total_size = client_->GetReceivedSize();
     } else {
       total_size = client_->GetSegmentSize();
     }
-    double current_throughput = (total_size * 8) / total_time;
+    // bits / us * 1000 === kbps
+    double current_throughput = (total_size * 8 * 1000.0) / total_time_us;
     if (throughputs.size() >= kThroughputWindow) {
       throughputs.pop_front();
     }
@@ -294,11 +364,201 @@ class TransportHarmonic : public Transport {
     return throughputs.size() / reciprocal;
   }
 
+  void WarmStart(const EstimatorPrior& prior) override {
+    for (double tp : prior.samples) {
+      if (tp <= 0) {
+        continue;
+      }
+      if (throughputs.size() >= kThroughputWindow) {
+        throughputs.pop_front();
+      }
+      throughputs.push_back(tp);
+    }
+  }
+
+  void SavePrior(EstimatorPrior* prior) override {
+    Transport::SavePrior(prior);
+    prior->samples.assign(throughputs.begin(), throughputs.end());
+  }
+
  private:
   std::deque<double> throughputs;
   size_t kThroughputWindow = 5;
 };
 
+// Delivery rate estimator run at the receiver, in the spirit of BBR's
+// bandwidth sampler. The data frames of the last segment are ordered by
+// receipt time and cut into trains wherever nothing arrived for kIdleGapUs,
+// so that pauses and request round trips do not count. Every kSampleUs of a
+// train gives a rate sample; the estimate is the max over the samples of the
+// latest kFilterSegments segments.
+class TransportPacketTrain final : public Transport {
+ public:
+  TransportPacketTrain(net::QuicSimpleClient* client, bool fine) : Transport(client, fine) {}
+
+  double AddThroughput() override {
+    const std::vector<quic::FrameArrival>& arrivals = client_->segment_arrivals();
+    double segment_max = 0;
+    size_t samples = 0;
+    // First frame of the current sample, and the bytes that arrived after it.
+    size_t first = 0;
+    size_t bytes = 0;
+    for (size_t k = 1; k < arrivals.size(); ++k) {
+      if ((arrivals[k].qt - arrivals[k - 1].qt).ToMicroseconds() > kIdleGapUs) {
+        first = k;
+        bytes = 0;
+        continue;
+      }
+      bytes += arrivals[k].length;
+      int64_t span = (arrivals[k].qt - arrivals[first].qt).ToMicroseconds();
+      if (span >= kSampleUs) {
+        // bits / ms === kbps
+        segment_max = std::max(segment_max, (bytes * 8 * 1000.0) / span);
+        ++samples;
+        first = k;
+        bytes = 0;
+      }
+    }
+    if (samples == 0 && GetTime() > 0) {
+      // Too few frames for a sample, use the segment throughput.
+      segment_max = (client_->GetReceivedSize() * 8 * 1000.0) / GetTime();
+    }
+    if (segment_max > 0) {
+      if (segment_maxima.size() >= kFilterSegments) {
+        segment_maxima.pop_front();
+      }
+      segment_maxima.push_back(segment_max);
+    }
+
+    if (FLAGS_abr_log.empty()) {
+      std::cerr << "[train]"
+                << " frames:" << arrivals.size()
+                << " samples:" << samples
+                << " max:" << segment_max
+                << " tp:" << GetTput()
+                << std::endl;
+    }
+
+    return GetTput();
+  }
+
+  double GetTput() override {
+    if (segment_maxima.empty()) {
+      return 0;
+    }
+    return *std::max_element(segment_maxima.begin(), segment_maxima.end());
+  }
+
+  void WarmStart(const EstimatorPrior& prior) override {
+    for (double segment_max : prior.samples) {
+      if (segment_max <= 0) {
+        continue;
+      }
+      if (segment_maxima.size() >= kFilterSegments) {
+        segment_maxima.pop_front();
+      }
+      segment_maxima.push_back(segment_max);
+    }
+  }
+
+  void SavePrior(EstimatorPrior* prior) override {
+    Transport::SavePrior(prior);
+    prior->samples.assign(segment_maxima.begin(), segment_maxima.end());
+  }
+
+ private:
+  static constexpr int64_t kIdleGapUs = 50000;
+  static constexpr int64_t kSampleUs = 40000;
+  static constexpr size_t kFilterSegments = 3;
+
+  std::deque<double> segment_maxima;
+};
+
+// Segment throughput samples through a KalmanPredictor, which also gives the
+// variance of the estimate. MPC and BOLA use it to plan with a lower quantile
+// of the throughput.
+class TransportKalman final : public Transport {
+ public:
+  TransportKalman(net::QuicSimpleClient* client, bool fine) : Transport(client, fine) {}
+
+  double AddThroughput() override {
+    int64_t total_time_us = GetTime();
+    if (total_time_us <= 0) {
+      return GetTput();
+    }
+    double total_size = 0;
+    if (fine_) {
+      total_size = client_->GetReceivedSize();
+    } else {
+      total_size = client_->GetSegmentSize();
+    }
+    // bits / us * 1000 === kbps
+    double current_throughput = (total_size * 8 * 1000.0) / total_time_us;
+
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = predictor.empty() ? 0 :
+        std::chrono::duration_cast<std::chrono::microseconds>(now - last_sample).count() / 1000.0;
+    last_sample = now;
+    predictor.Update(current_throughput, elapsed);
+    AddSample(current_throughput, elapsed);
+
+    if (FLAGS_abr_log.empty()) {
+      std::cerr << "[kalman]"
+                << " sample:" << current_throughput
+                << " mean:" << predictor.Mean()
+                << " sd:" << std::sqrt(predictor.Variance())
+                << std::endl;
+    }
+
+    return GetTput();
+  }
+
+  double GetTput() override {
+    return predictor.Mean();
+  }
+
+  double GetTputVariance() override {
+    return predictor.Variance();
+  }
+
+  void WarmStart(const EstimatorPrior& prior) override {
+    // Replayed as they were measured, so the measurement noise is learned
+    // again too.
+    for (double tp : prior.samples) {
+      predictor.Update(tp, prior.sample_interval);
+      AddSample(tp, prior.sample_interval);
+    }
+    last_sample = std::chrono::steady_clock::now();
+  }
+
+  void SavePrior(EstimatorPrior* prior) override {
+    Transport::SavePrior(prior);
+    prior->samples.assign(samples.begin(), samples.end());
+    prior->sample_interval = intervals > 0 ? interval_sum / intervals : 0;
+  }
+
+ private:
+  void AddSample(double tp, double elapsed) {
+    if (samples.size() >= kPriorSamples) {
+      samples.pop_front();
+    }
+    samples.push_back(tp);
+    if (elapsed > 0) {
+      interval_sum += elapsed;
+      ++intervals;
+    }
+  }
+
+  // Samples kept for the next session.
+  static constexpr size_t kPriorSamples = 10;
+
+  KalmanPredictor predictor;
+  std::chrono::steady_clock::time_point last_sample;
+  std::deque<double> samples;
+  double interval_sum = 0;
+  size_t intervals = 0;
+};
+
 typedef struct {
   int to_st;
   int to_len;
@@ -306,6 +566,17 @@ typedef struct {
   int from_len;
 } frame_order;
 
+// A segment decided ahead of time (--pipeline). stream_id is 0 until its
+// reliable part has been requested.
+typedef struct {
+  uint32_t segment_no;
+  int quality;
+  double ssim;
+  SSIMBasedQuality ssim_q;
+  double pause;
+  quic::QuicStreamId stream_id;
+} pipelined_segment;
+
 
 void append_frame_order(std::string range, int offset, std::vector<frame_order> *fo) {
   int st, en, len;
@@ -341,10 +612,22 @@ void check_404(const SpdyHeaderBlock &shb, bool keep = true) {
     exit(-1);
 }
 
-void fill_segment_body(string &segment_body, const string &response_body, const std::vector<frame_order> &frames_order) {
+// Where the response body bytes of |frames_order| go in the segment of
+// |segment_size| bytes, for writing them there straight from the stream.
+// Ranges that do not lie within the segment are dropped.
+std::vector<quic::BodyScatter> body_scatter(const std::vector<frame_order> &frames_order, size_t segment_size) {
+  std::vector<quic::BodyScatter> scatter;
+  scatter.reserve(frames_order.size());
   for (auto it : frames_order) {
-    segment_body.replace(it.to_st, it.to_len, response_body, it.from_st, it.from_len);
+    if (it.to_st < 0 || it.from_st < 0 || it.from_len <= 0 ||
+        (size_t) it.to_st + it.from_len > segment_size) {
+      std::cerr << "[scatter] dropped " << it.to_st << "," << it.from_len
+                << " outside of " << segment_size << std::endl;
+      continue;
+    }
+    scatter.push_back({(size_t) it.to_st, (size_t) it.from_st, (size_t) it.from_len});
   }
+  return scatter;
 }
 
 void generate_loss_information(std::map<quic::QuicStreamOffset, quic::FrameTiming> response_timings, int offset,
@@ -394,49 +677,49 @@ void generate_loss_information(std::map<quic::QuicStreamOffset, quic::FrameTimin
   }
 }
 
-int fill_holes(std::string &hole_range, Abr* abr, SpdyHeaderBlock &header_block, int loss_size, net::QuicSimpleClient *client, std::string &segment_body, int segment_start, int segment_duration) {
+// Returns the time (ms) spent on filling holes.
+double fill_holes(std::string &hole_range, AbrInterface* abr, SpdyHeaderBlock &header_block, int loss_size, net::QuicSimpleClient *client, std::string &segment_body, int segment_start, int segment_duration, int buffer_ahead) {
   std::string loss_report;
-  int used_time = 0;
-  int remaining_pause = abr->GetBuffer() + segment_duration - (abr->instance()->buffer_size_ - segment_duration) - used_time;
-  while (!hole_range.empty() && remaining_pause > quic::kSafetyMargin) {
+  int64_t used_time_us = 0;
+  int64_t remaining_pause_us = (int64_t) ((abr->GetBuffer() - buffer_ahead + segment_duration - (abr->buffer_size() - segment_duration)) * 1000);
+  while (!hole_range.empty() && remaining_pause_us > SafetyMargin(client->GetTransportStats()) * 1000) {
     std::cerr << "[hole-fill-request] " << hole_range << std::endl;
     std::cerr << "[hole-fill-request] " << loss_size << std::endl;
     header_block[":range"] = string("multibytes=") + hole_range;
-    std::string response_body;
+    std::vector<frame_order> frames_order;
+    append_frame_order(hole_range, segment_start, &frames_order);
+    std::vector<quic::BodyScatter> scatter = body_scatter(frames_order, segment_body.size());
 
     // We only initialize fields that are required by the deadline request.
     quic::DownloadConfig dc = {"deadline",
                                loss_size,
                                loss_size,
-                               remaining_pause,
+                               remaining_pause_us,
                                0 /*quality*/,
                                {} /*bitrates*/,
-                               abr->instance(),
+                               abr,
                                client /*client*/,
                                false /*not reliable*/,
                                0 /*segment_duration*/,
                                0, /*segment_no*/
                                nullptr, /* adaptationSet* */
-                               nullptr, /* ssim_map */
+                               nullptr, /* qualities */
                                false /*ret__kept*/,
                                0 /*ret__quality*/,
-                               0 /*ret__ssim*/,
-                               0 /*ret__pause*/};
+                               0 /*ret__option*/,
+                               0 /*ret__pause*/,
+                               &segment_body[0] /*body_destination*/,
+                               segment_body.size() /*body_destination_length*/,
+                               &scatter /*body_scatter*/};
 
     client->SendRequestAndWaitForResponse(header_block, /*request_body*/"", /*fin=*/true, /*unrel*/true, &dc);
     check_404(client->latest_response_header_block(), dc.ret__kept);
 
     auto response_timings = client->latest_response_timings();
-    response_body = client->latest_response_body();
     const quic::SubSegmentTiming &segment_timing_unrel = client->latest_segment_timing(true);
-    uint32_t pre_resize_body_size = response_body.size();
-    int tail_loss_len = loss_size - response_body.size();
-    if (response_body.size() < (size_t) loss_size) {
-      response_body.resize(loss_size);
-    }
-    std::vector<frame_order> frames_order;
-    append_frame_order(hole_range, segment_start, &frames_order);
-    fill_segment_body(segment_body, response_body, frames_order);
+    // Bytes missing at the end stay as they were in the segment.
+    uint32_t pre_resize_body_size = client->latest_response_body_size();
+    int tail_loss_len = loss_size - pre_resize_body_size;
     auto have_loss = loss_size - segment_timing_unrel.received_size_;
     if (have_loss) {
       if (tail_loss_len > 0) {
@@ -453,21 +736,102 @@ int fill_holes(std::string &hole_range, Abr* abr, SpdyHeaderBlock &header_block,
       loss_report.clear();
       loss_size = 0;
     }
-    int dl_time = client->GetRealTime(quic::sst_unrel);
-    used_time += dl_time;
-    remaining_pause -= dl_time;
+    int64_t dl_time_us = client->GetRealTime(quic::sst_unrel);
+    used_time_us += dl_time_us;
+    remaining_pause_us -= dl_time_us;
     std::cerr << "[hole-fill]"
               << " fill:" << segment_timing_unrel.received_size_
               << " loss:" << loss_size
-              << " dl:" << dl_time
-              << " rp:" << remaining_pause
+              << " dl:" << dl_time_us / 1000.0
+              << " rp:" << remaining_pause_us / 1000.0
               << std::endl;
   }
   hole_range.clear();
   if (!loss_report.empty()) {
     std::cerr << loss_report << std::endl;
   }
-  return used_time;
+  return used_time_us / 1000.0;
+}
+
+// Buffer (ms) the ABR already counts for the segments in |pipeline|, which
+// are not downloaded yet.
+int buffer_ahead(const std::deque<pipelined_segment> &pipeline, int segment_duration) {
+  return pipeline.size() * segment_duration;
+}
+
+// Decides the segment after the last one in |pipeline| (or after |current|)
+// while |current| is still downloading and, unless the ABR wants to pause
+// first, requests its reliable part right away. Does nothing if the pipeline
+// is full, stalled behind such a pause, or nothing was measured since the last
+// decision.
+void extend_pipeline(std::deque<pipelined_segment> *pipeline, uint32_t current, uint32_t num_segments,
+                     AbrInterface* abr, bool use_qualities, std::map<uint32_t, repr> &adaptationSet,
+                     const std::vector<double> &bitrates, const SpdyHeaderBlock &header_block,
+                     net::QuicSimpleClient *client) {
+  if ((int32_t) pipeline->size() >= FLAGS_pipeline) {
+    return;
+  }
+  if (client->GetSumTime() == 0) {
+    return;
+  }
+  if (!pipeline->empty() && pipeline->back().stream_id == 0) {
+    return;
+  }
+  uint32_t segment_no = pipeline->empty() ? current + 1 : pipeline->back().segment_no + 1;
+  if (segment_no >= num_segments) {
+    return;
+  }
+
+  pipelined_segment next;
+  next.segment_no = segment_no;
+  next.ssim = 0.0;
+  next.ssim_q = {};
+  next.stream_id = 0;
+  if (use_qualities) {
+    AbrDecision decision = abr->GetDecision(/*retry=*/0, segment_qualities[segment_no - 1]);
+    next.ssim_q = segment_qualities[segment_no - 1].at(decision.option);
+    next.ssim = segment_qualities[segment_no - 1].ssim[decision.option];
+    next.quality = decision.quality;
+    next.pause = decision.pause;
+  } else {
+    AbrDecision decision = abr->GetDecision(/*retry=*/0, {});
+    next.quality = decision.quality;
+    next.pause = decision.pause;
+  }
+  // The estimator has consumed everything measured so far; requests that
+  // finish from now on count towards the next decision only.
+  client->ResetAllTimings();
+
+  const segment &seg = adaptationSet[bitrates[next.quality]].segments[segment_no];
+  if (next.pause <= 0.0 && !seg.reliable_frames.empty()) {
+    SpdyHeaderBlock headers = header_block.Clone();
+    headers[":path"] = "/" + adaptationSet[bitrates[next.quality]].baseUrl;
+    headers[":range"] = string("multibytes=") + seg.reliable_frames;
+    next.stream_id = client->SendPrefetchRequest(headers, /*unrel*/false);
+  }
+  std::cerr << "[pipeline]"
+            << " #:" << segment_no
+            << " br:" << (uint32_t) bitrates[next.quality]
+            << " pause:" << (int) next.pause
+            << " sent:" << (next.stream_id != 0)
+            << std::endl;
+  pipeline->push_back(next);
+}
+
+// Drops the segments decided ahead of an abandoned one, since they were
+// decided for its quality and the buffer before it. Their requests are
+// cancelled so that the retry does not compete with them, and the ABR takes
+// back the buffer (and pause) it counted for them; they are decided again.
+void clear_pipeline(std::deque<pipelined_segment> *pipeline, AbrInterface* abr,
+                    int segment_duration, net::QuicSimpleClient *client) {
+  for (const pipelined_segment &next : *pipeline) {
+    if (next.stream_id != 0) {
+      client->CancelPrefetchRequest(next.stream_id);
+    }
+    abr->SetBuffer(abr->GetBuffer() - segment_duration + next.pause);
+    std::cerr << "[pipeline-drop] #:" << next.segment_no << std::endl;
+  }
+  pipeline->clear();
 }
 
 std::string get_subrange(const std::string &range, size_t count) {
@@ -530,12 +894,12 @@ int parse_feature_flag() {
   return 0;
 }
 
-void print_ssim_map(std::vector<std::map<double, SSIMBasedQuality>> map) {
+void print_segment_qualities(const std::vector<SegmentQualities>& tables) {
   uint32_t segment_count = 1;
-  for (auto &segment_ssim_map : map) {
+  for (auto &qualities : tables) {
     std::cerr << "segment: " << segment_count;
-    for (auto &entry : segment_ssim_map) {
-      std::cerr << " [" << entry.first << ":" << entry.second.required_frames << ":" << entry.second.quality << "]";
+    for (size_t o = 0; o < qualities.options(); ++o) {
+      std::cerr << " [" << qualities.ssim[o] << ":" << qualities.required_frames[o] << ":" << qualities.quality[o] << "]";
     }
     std::cerr << std::endl;
     segment_count++;
@@ -588,7 +952,18 @@ int main(int argc, char* argv[]) {
         "--disable-certificate-verification do not verify certificates\n"
         "--abr_buf=<ms>                     specify the amount (in ms) of buffer for the ABR to use\n"
         "--abr=<bola|bpp|mpc|tput> specify the ABR algorithm to use\n"
+        "--mpc_horizon=<n>                  specify the number of segments mpc plans ahead (default 5)\n"
+        "--mpc_table=<path>                 specify a decision table generated by mpc_table_gen for mpc\n"
+        "--abr_log=<path>                   write ABR decisions to a binary log instead of stderr\n"
+        "--pipeline=<n>                     request the reliable part of up to n segments ahead (default 0)\n"
+        "--concurrent                       request the reliable and unreliable part of a segment at once\n"
+        "--segment_dir=<dir>                write each segment to <dir>/<n>.seg instead of stdout\n"
+        "--prior_file=<path>                keep the estimator state per server in <path> to warm-start the next session\n"
+        "--block                            block in the event loop while waiting instead of polling and sleeping\n"
+        "--abandon_interval=<ms>            specify the time between abandonment checks of a download (default 50)\n"
+        "--connection_stats                 print the counters of the connection at the end\n"
         "--feature=<0-2>                    specify the features bpp should use (0:nobola,1:abort,2:keep)\n"
+        "--estimator=<train|kalman>         use the receiver side packet train estimator or the Kalman predictor for the ABR\n"
         "--fine                             if specified the transport layer provides a fine-grained signal for the throughput calculation\n";
     cerr << help_str;
     exit(0);
@@ -644,6 +1019,48 @@ int main(int argc, char* argv[]) {
       return 1;
     }
   }
+  if (line->HasSwitch("mpc_horizon")) {
+    if (!base::StringToInt(line->GetSwitchValueASCII("mpc_horizon"),
+                           &FLAGS_mpc_horizon) || FLAGS_mpc_horizon < 1) {
+      std::cerr << "--mpc_horizon must be a positive integer\n";
+      return 1;
+    }
+  }
+  if (line->HasSwitch("mpc_table")) {
+    FLAGS_mpc_table = line->GetSwitchValueASCII("mpc_table");
+  }
+  if (line->HasSwitch("abr_log")) {
+    FLAGS_abr_log = line->GetSwitchValueASCII("abr_log");
+  }
+  if (line->HasSwitch("pipeline")) {
+    if (!base::StringToInt(line->GetSwitchValueASCII("pipeline"),
+                           &FLAGS_pipeline) || FLAGS_pipeline < 0) {
+      std::cerr << "--pipeline must be a non-negative integer\n";
+      return 1;
+    }
+  }
+  if (line->HasSwitch("concurrent")) {
+    FLAGS_concurrent = true;
+  }
+  if (line->HasSwitch("segment_dir")) {
+    FLAGS_segment_dir = line->GetSwitchValueASCII("segment_dir");
+  }
+  if (line->HasSwitch("prior_file")) {
+    FLAGS_prior_file = line->GetSwitchValueASCII("prior_file");
+  }
+  if (line->HasSwitch("block")) {
+    FLAGS_block = true;
+  }
+  if (line->HasSwitch("connection_stats")) {
+    FLAGS_connection_stats = true;
+  }
+  if (line->HasSwitch("abandon_interval")) {
+    if (!base::StringToInt(line->GetSwitchValueASCII("abandon_interval"),
+                           &FLAGS_abandon_interval) || FLAGS_abandon_interval < 1) {
+      std::cerr << "--abandon_interval must be a positive integer\n";
+      return 1;
+    }
+  }
   if (line->HasSwitch("smooth")) {
     if (!base::StringToDouble(line->GetSwitchValueASCII("smooth"),
                            &FLAGS_smooth)) {
@@ -662,6 +1079,9 @@ int main(int argc, char* argv[]) {
   if (line->HasSwitch("fine")) {
     FLAGS_fine = true;
   }
+  if (line->HasSwitch("estimator")) {
+    FLAGS_estimator = line->GetSwitchValueASCII("estimator");
+  }
 
   VLOG(1) << "server host: " << FLAGS_host << " port: " << FLAGS_port
           << " body: " << FLAGS_body << " headers: " << FLAGS_headers
@@ -730,6 +1150,10 @@ int main(int argc, char* argv[]) {
                                server_id, versions, std::move(proof_verifier));
   client.set_initial_max_packet_length(
       FLAGS_initial_mtu != 0 ? FLAGS_initial_mtu : quic::kDefaultMaxPacketSize);
+  // Time stream frames by when the kernel received them, not by when this
+  // thread got around to reading the socket.
+  client.set_network_helper(
+      std::make_unique<TimestampingNetworkHelper>(&client));
   if (!client.Initialize()) {
     cerr << "Failed to initialize client." << endl;
     return 1;
@@ -779,6 +1203,9 @@ int main(int argc, char* argv[]) {
 
   // Make sure to store the response, for later output.
   client.set_store_response(true);
+  client.set_abandon_check_interval(
+      quic::QuicTime::Delta::FromMilliseconds(FLAGS_abandon_interval));
+  client.set_blocking_event_loop(FLAGS_block);
 
   // Print request and response details.
   if (!FLAGS_quiet) {
@@ -937,14 +1364,14 @@ int main(int argc, char* argv[]) {
 
           //current_repr_bw is used as a filler, will be replaced by proper q value, once we have parsed all qualities
           // adaptationSet contains initialization segment, which we do not want to count.
-          if (ssim_map.size() < curr_segment_no + 1) {
-            ssim_map.emplace_back();
-            if (ssim_map.size() != curr_segment_no + 1) {
-              std::cerr << "ERROR: ssim_map has unexpected size. (" << ssim_map.size() << " != " << curr_segment_no + 1 << ")\n";
+          if (segment_qualities.size() < curr_segment_no + 1) {
+            segment_qualities.emplace_back();
+            if (segment_qualities.size() != curr_segment_no + 1) {
+              std::cerr << "ERROR: segment_qualities has unexpected size. (" << segment_qualities.size() << " != " << curr_segment_no + 1 << ")\n";
               exit(1);
             }
           }
-          ssim_map[curr_segment_no][ssim] = {size + rel_size, rel_size, current_repr_bw, frames};
+          segment_qualities[curr_segment_no].Add(ssim, {size + rel_size, (size_t)rel_size, (int)current_repr_bw, frames});
         }
       }
 
@@ -972,17 +1399,16 @@ int main(int argc, char* argv[]) {
   std::cerr << std::endl;
 
   // hack: replace bitrates with q indizes
-  for (auto &segment_ssim_map : ssim_map) {
-    for (auto &ssim : segment_ssim_map) {
-      ssim.second.quality =
-          std::distance(bitrates.begin(), std::find(bitrates.begin(), bitrates.end(), ssim.second.quality));
+  for (auto &qualities : segment_qualities) {
+    for (auto &quality : qualities.quality) {
+      quality = std::distance(bitrates.begin(), std::find(bitrates.begin(), bitrates.end(), quality));
     }
   }
   uint32_t segment_count  = 1;
-  for (auto &segment_ssim_map : ssim_map) {
+  for (auto &qualities : segment_qualities) {
     std::map<int, bool> distinct_qualities;
-    for (auto &entry : segment_ssim_map) {
-      distinct_qualities[entry.second.quality] = true;
+    for (auto quality : qualities.quality) {
+      distinct_qualities[quality] = true;
     }
     if (distinct_qualities.size() != bitrates.size()) {
       std::cerr << "Warning: segment " << segment_count << " has missing quality entries: ("
@@ -992,24 +1418,35 @@ int main(int argc, char* argv[]) {
   }
   segment_count = 1;
   if (feature_map.find("no_drop") != feature_map.end()) {
-    for (auto &segment_ssim_map : ssim_map) {
-      std::vector<std::pair<double, SSIMBasedQuality>> temp_map(bitrates.size());
-      for ( auto it = segment_ssim_map.rbegin(); it != segment_ssim_map.rend(); it++) {
-        if (temp_map[it->second.quality].second.required_frames < it->second.required_frames) {
-          temp_map[it->second.quality] = {it->first, it->second};
+    for (auto &qualities : segment_qualities) {
+      // Keep the option with the most required frames per quality.
+      std::vector<int> keep(bitrates.size(), -1);
+      for (size_t o = 0; o < qualities.options(); ++o) {
+        int &k = keep[qualities.quality[o]];
+        if (k == -1 || qualities.required_frames[k] < qualities.required_frames[o] ||
+            (qualities.required_frames[k] == qualities.required_frames[o] &&
+             qualities.ssim[k] < qualities.ssim[o])) {
+          k = o;
         }
       }
-      segment_ssim_map.clear();
-      for (auto &temp_entry : temp_map) {
-        segment_ssim_map[temp_entry.first] = temp_entry.second;
+      SegmentQualities kept;
+      for (int k : keep) {
+        if (k != -1) {
+          kept.Add(qualities.ssim[k], qualities.at(k));
+        }
       }
-      if (segment_ssim_map.size() != bitrates.size()) {
+      qualities = kept;
+      if (qualities.options() != bitrates.size()) {
         std::cerr << "Warning: (no_drop) segment " << segment_count << " has missing quality entries: ("
-                  << segment_ssim_map.size() << " < " << bitrates.size() << ")" << std::endl;
+                  << qualities.options() << " < " << bitrates.size() << ")" << std::endl;
       }
       segment_count++;
     }
   }
+  // Options are scanned in ssim order by the ABRs, sort them once here.
+  for (auto &qualities : segment_qualities) {
+    qualities.Sort();
+  }
   std::reverse(avg_ssims.begin(), avg_ssims.end());
   std::cerr << "[avg-ssims]";
   for (auto avg : avg_ssims) {
@@ -1017,10 +1454,10 @@ int main(int argc, char* argv[]) {
   }
   std::cerr << std::endl;
 
-  auto &first_segment = ssim_map.front();
+  auto &first_segment = segment_qualities.front();
   std::cerr << "First segment: ";
-  for (auto &ssim : first_segment) {
-    std::cerr << " [" << ssim.first << ":" << ssim.second.required_frames << ":" << ssim.second.quality << "]";
+  for (size_t o = 0; o < first_segment.options(); ++o) {
+    std::cerr << " [" << first_segment.ssim[o] << ":" << first_segment.required_frames[o] << ":" << first_segment.quality[o] << "]";
   }
   std::cerr << "\n";
 
@@ -1032,49 +1469,121 @@ int main(int argc, char* argv[]) {
   /////////
   /// ABR
 
-  Abr abr;
+  AbrInterface* abr;
+  BaseAbr* policy;
 
-  BolaAbr *bola;
-  MpcAbr *mpc;
-  ThroughputAbr *tput;
+  BolaAbr *bola = nullptr;
+  MpcAbr *mpc = nullptr;
+  ThroughputAbr *tput = nullptr;
 
   TransportInterface* t;
   if (FLAGS_fine) {
     std::cerr << "[fine]" << std::endl;
   }
-  if (FLAGS_abr == "tput") {
-    TransportSLST *t_slst = new TransportSLST(&client, FLAGS_fine);
-    t_slst->alpha = FLAGS_smooth;
-    t = t_slst;
-    std::cerr << "[smooth] " << t_slst->alpha << std::endl;
-  } else if (FLAGS_abr == "bola" || FLAGS_abr == "bpp") {
-    TransportBola *t_b = new TransportBola(&client, FLAGS_fine);
-    t = t_b;
-  } else if (FLAGS_abr == "mpc") {
-    TransportHarmonic *t_h = new TransportHarmonic(&client, FLAGS_fine);
-    t = t_h;
-    std::cerr << "[harmonic]" << std::endl;
-  } else {
-    std::cerr << "Unknown abr selected!" << std::endl;
+  TransportPacketTrain* t_train = nullptr;
+  TransportKalman* t_kalman = nullptr;
+  if (FLAGS_estimator == "train") {
+    t_train = new TransportPacketTrain(&client, FLAGS_fine);
+    std::cerr << "[estimator] " << FLAGS_estimator << std::endl;
+  } else if (FLAGS_estimator == "kalman") {
+    t_kalman = new TransportKalman(&client, FLAGS_fine);
+    std::cerr << "[estimator] " << FLAGS_estimator << std::endl;
+  } else if (!FLAGS_estimator.empty()) {
+    std::cerr << "Unknown estimator selected!" << std::endl;
     exit(-1);
   }
-  abr.SetTransport(t);
-
-  if (FLAGS_abr == "bola" || FLAGS_abr == "bpp") {
-    bola = new BolaAbr(segment_duration, (double)(FLAGS_abr_buf), bitrates, avg_ssims);
-    abr.SetAbr(bola);
-  } else if (FLAGS_abr == "tput") {
+  if (FLAGS_abr == "tput") {
     tput = new ThroughputAbr(segment_duration,(double)(FLAGS_abr_buf), bitrates);
-    abr.SetAbr(tput);
+    if (t_train) {
+      t = t_train;
+      abr = new Abr<ThroughputAbr, TransportPacketTrain>(tput, t_train);
+    } else if (t_kalman) {
+      t = t_kalman;
+      abr = new Abr<ThroughputAbr, TransportKalman>(tput, t_kalman);
+    } else {
+      TransportSLST *t_slst = new TransportSLST(&client, FLAGS_fine);
+      t_slst->alpha = FLAGS_smooth;
+      t = t_slst;
+      std::cerr << "[smooth] " << t_slst->alpha << std::endl;
+      abr = new Abr<ThroughputAbr, TransportSLST>(tput, t_slst);
+    }
+    policy = tput;
+  } else if (FLAGS_abr == "bola" || FLAGS_abr == "bpp") {
+    bola = new BolaAbr(segment_duration, (double)(FLAGS_abr_buf), bitrates, avg_ssims);
+    if (t_train) {
+      t = t_train;
+      abr = new Abr<BolaAbr, TransportPacketTrain>(bola, t_train);
+    } else if (t_kalman) {
+      t = t_kalman;
+      abr = new Abr<BolaAbr, TransportKalman>(bola, t_kalman);
+    } else {
+      TransportBola *t_b = new TransportBola(&client, FLAGS_fine);
+      t = t_b;
+      abr = new Abr<BolaAbr, TransportBola>(bola, t_b);
+    }
+    policy = bola;
   } else if (FLAGS_abr == "mpc") {
     mpc = new MpcAbr(segment_duration, (double)(FLAGS_abr_buf), bitrates);
-    abr.SetAbr(mpc);
+    mpc->SetSearchDepth(FLAGS_mpc_horizon);
+    if (!FLAGS_mpc_table.empty())
+      mpc->LoadTable(FLAGS_mpc_table);
+    if (t_train) {
+      t = t_train;
+      abr = new Abr<MpcAbr, TransportPacketTrain>(mpc, t_train);
+    } else if (t_kalman) {
+      t = t_kalman;
+      abr = new Abr<MpcAbr, TransportKalman>(mpc, t_kalman);
+    } else {
+      TransportHarmonic *t_h = new TransportHarmonic(&client, FLAGS_fine);
+      t = t_h;
+      std::cerr << "[harmonic]" << std::endl;
+      abr = new Abr<MpcAbr, TransportHarmonic>(mpc, t_h);
+    }
+    policy = mpc;
   } else {
     std::cerr << "Unknown abr selected!" << std::endl;
     exit(-1);
   }
   std::cerr << "[abr] " << FLAGS_abr << std::endl;
 
+  AbrDecisionLog* decision_log = nullptr;
+  if (!FLAGS_abr_log.empty()) {
+    decision_log = new AbrDecisionLog();
+    if (!decision_log->Open(FLAGS_abr_log)) {
+      std::cerr << "Cannot open abr log " << FLAGS_abr_log << std::endl;
+      exit(-1);
+    }
+    policy->SetDecisionLog(decision_log);
+    std::cerr << "[abr-log] " << FLAGS_abr_log << std::endl;
+  }
+
+  SessionPriorStore priors;
+  const std::string prior_server = server_id.ToString();
+  bool warm_start = false;
+  if (!FLAGS_prior_file.empty()) {
+    priors.Load(FLAGS_prior_file);
+    EstimatorPrior prior;
+    int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if (priors.Find(prior_server, now, client.GetTransportStats().min_rtt, &prior)) {
+      t->WarmStart(prior);
+      warm_start = true;
+      std::cerr << "[prior] " << prior_server
+                << " tp:" << t->GetTput()
+                << " age:" << now - prior.saved
+                << " samples:" << prior.samples.size()
+                << std::endl;
+    } else {
+      std::cerr << "[prior] " << prior_server << " none" << std::endl;
+    }
+  }
+
+  // Output is written on its own thread, so that a slow pipe or disk never
+  // holds up the event loop.
+  SegmentWriter writer;
+  if (!writer.Start(fileno(stdout), FLAGS_segment_dir)) {
+    return 1;
+  }
+
   //download init segment first
   header_block[":path"] = "/" + adaptationSet[bitrates[0]].baseUrl;
   header_block[":range"] = string("bytes=") + adaptationSet[bitrates[0]].segments[0].mediaRange;
@@ -1089,8 +1598,7 @@ int main(int argc, char* argv[]) {
   check_404(client.latest_response_header_block());
   response_timings = client.latest_response_timings();
   response_body = client.latest_response_body();
-  total_written += std::fwrite(response_body.data(), sizeof response_body[0], response_body.size(), stdout);
-  fflush(stdout);
+  writer.Submit(0, &response_body);
 
   std::cerr << "[segment]"
             << " #:" << 0 
@@ -1106,7 +1614,7 @@ int main(int argc, char* argv[]) {
       << " s:" << std::chrono::duration_cast<std::chrono::milliseconds>(t_init_start - t_start).count()
       << " r:" << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - t_init_start).count()
       << " u:" << "0"
-      << " dlr:" << client.latest_segment_timing(false).time_
+      << " dlr:" << client.latest_segment_timing(false).time_us_ / 1000.0
       << " dlu:" << "0"
       << std::endl,
   std::cerr << "[throughput] mavg:0 r:" << client.latest_segment_timing(false).throughput_ << " u:0" << std::endl;
@@ -1119,6 +1627,7 @@ int main(int argc, char* argv[]) {
   int retry = 0;
   int bola_quality = 0;
   double bola_pause = 0;
+  int bpp_option = 0;
   double bpp_ssim = 0;
   string segment_body;
   int pause = 0;
@@ -1129,9 +1638,37 @@ int main(int argc, char* argv[]) {
   double ssim = 0.0;
   SSIMBasedQuality ssim_q;
   std::chrono::system_clock::time_point t_req_start;
+  bool use_qualities = FLAGS_abr == "bpp" || (FLAGS_abr == "bola" && feature_map.find("bola_enhanced") != feature_map.end());
+  std::deque<pipelined_segment> pipeline;
+  if (FLAGS_pipeline > 0) {
+    std::cerr << "[pipeline] " << FLAGS_pipeline << std::endl;
+  }
+  if (FLAGS_concurrent) {
+    std::cerr << "[concurrent]" << std::endl;
+  }
+  if (FLAGS_block) {
+    std::cerr << "[block]" << std::endl;
+  }
   for (uint32_t i = 1; i < num_segments; ++i) {
-    //set quality of first segment fix to lowest
-    if (i == 1) {
+    quic::QuicStreamId prefetched = 0;
+    bool pipelined = false;
+    //set quality of first segment fix to lowest, unless the estimator was
+    //warm-started from a previous session
+    if (i == 1 && !retry && warm_start) {
+      if (use_qualities) {
+        AbrDecision decision = abr->GetStartupDecision(segment_qualities[0]);
+        ssim_q = segment_qualities[0].at(decision.option);
+        ssim = segment_qualities[0].ssim[decision.option];
+        q = decision.quality;
+        pause = decision.pause;
+      }
+      else {
+        AbrDecision decision = abr->GetStartupDecision({});
+        q = decision.quality;
+        pause = decision.pause;
+      }
+    }
+    else if (i == 1 && !retry) {
       q = 0;
     } 
     else if (retry) {
@@ -1148,26 +1685,45 @@ int main(int argc, char* argv[]) {
                   << std::endl;
 
         pause = bola_pause;
-        ssim_q = ssim_map[i -1].at(bpp_ssim);
+        ssim_q = segment_qualities[i - 1].at(bpp_option);
+        bpp_ssim = segment_qualities[i - 1].ssim[bpp_option];
         q = ssim_q.quality;
       } else {
         std::cerr << "ERROR: This abr should not be able to retry: " << FLAGS_abr << std::endl;
         exit(1);
       }
     }
+    else if (!pipeline.empty() && pipeline.front().segment_no == i) {
+      // Decided, and maybe requested, while segment i - 1 was downloading.
+      q = pipeline.front().quality;
+      pause = pipeline.front().pause;
+      ssim = pipeline.front().ssim;
+      ssim_q = pipeline.front().ssim_q;
+      prefetched = pipeline.front().stream_id;
+      pipelined = true;
+      pipeline.pop_front();
+    }
     else {
-      if (FLAGS_abr == "bpp" || (FLAGS_abr == "bola" && feature_map.find("bola_enhanced") != feature_map.end())) {
-        ssim = abr.GetQuality(retry, ssim_map[i - 1]);
-        ssim_q = ssim_map[i -1].at(ssim);
-        q = ssim_q.quality;
+      if (use_qualities) {
+        AbrDecision decision = abr->GetDecision(retry, segment_qualities[i - 1]);
+        ssim_q = segment_qualities[i - 1].at(decision.option);
+        ssim = segment_qualities[i - 1].ssim[decision.option];
+        q = decision.quality;
+        pause = decision.pause;
       }
       else {
-        q = (int) abr.GetQuality(retry, {});
+        AbrDecision decision = abr->GetDecision(retry, {});
+        q = decision.quality;
+        pause = decision.pause;
       }
-      pause = abr.GetPause();
     }
 
-    usleep(pause * 1000);
+    if (FLAGS_block) {
+      // Keeps acking, and receiving pipelined requests, during the pause.
+      client.RunEventLoopFor(quic::QuicTime::Delta::FromMicroseconds(static_cast<int64_t>(pause * 1000)));
+    } else {
+      usleep(pause * 1000);
+    }
     std::cerr << std::endl
       << "[trying-segment]"
       << " #:" << i
@@ -1186,7 +1742,11 @@ int main(int argc, char* argv[]) {
     std::string reliable_frames = adaptationSet[bitrates[q]].segments[i].reliable_frames;
     std::string unreliable_frames = adaptationSet[bitrates[q]].segments[i].unreliable_frames;
 
-    client.ResetAllTimings();
+    // A pipelined decision already reset the timings; what was measured
+    // since then belongs to the next decision.
+    if (!pipelined) {
+      client.ResetAllTimings();
+    }
 
     segment_body.clear();
     segment_body.resize(adaptationSet[bitrates[q]].segments[i].size, '\0');
@@ -1230,49 +1790,101 @@ int main(int argc, char* argv[]) {
         << std::endl;
     }
 
+    quic::DownloadConfig rel_dc = {FLAGS_abr,
+                                   required_reliable_size,
+                                   reliable_fallback_size,
+                                   (int64_t) ((abr->GetBuffer() - buffer_ahead(pipeline, segment_duration)) * 1000),
+                                   q /* current quality level index */,
+                                   bitrates,
+                                   abr,
+                                   &client /*client*/,
+                                   true /*reliable*/,
+                                   segment_duration,
+                                   i, /*segment_no*/
+                                   &adaptationSet,
+                                   &segment_qualities[i - 1],
+                                   false /*ret__kept*/,
+                                   0 /*ret__quality*/,
+                                   0 /*ret__option*/,
+                                   0 /*ret__pause*/};
+    quic::DownloadConfig unrel_dc = rel_dc;
+    unrel_dc.size = required_unreliable_size;
+    unrel_dc.fallback_size = unreliable_fallback_size;
+    unrel_dc.reliable = false;
+
+    // Both parts are written by the stream straight to their place in
+    // segment_body.
+    std::vector<frame_order> rel_frames_order;
+    append_frame_order(reliable_frames, adaptationSet[bitrates[q]].segments[i].start, &rel_frames_order);
+    std::vector<quic::BodyScatter> rel_scatter = body_scatter(rel_frames_order, segment_body.size());
+    rel_dc.body_destination = &segment_body[0];
+    rel_dc.body_destination_length = segment_body.size();
+    rel_dc.body_scatter = &rel_scatter;
+    std::vector<frame_order> unrel_frames_order;
+    append_frame_order(required_unreliable_frames, adaptationSet[bitrates[q]].segments[i].start, &unrel_frames_order);
+    std::vector<quic::BodyScatter> unrel_scatter = body_scatter(unrel_frames_order, segment_body.size());
+    unrel_dc.body_destination = &segment_body[0];
+    unrel_dc.body_destination_length = segment_body.size();
+    unrel_dc.body_scatter = &unrel_scatter;
+
+    // With --concurrent both parts download side by side, each abandoned on
+    // its own; the responses are then handled as if they came one by one.
+    quic::QuicStreamId unrel_prefetched = 0;
+    if (FLAGS_concurrent && !reliable_frames.empty() && !required_unreliable_frames.empty()) {
+      if (!prefetched) {
+        header_block[":range"] = string("multibytes=") + reliable_frames;
+        prefetched = client.SendPrefetchRequest(header_block, /*unrel*/false);
+      }
+      header_block[":range"] = string("multibytes=") + required_unreliable_frames;
+      unrel_prefetched = client.SendPrefetchRequest(header_block, /*unrel*/true);
+      if (prefetched && unrel_prefetched) {
+        client.WaitForPrefetchedResponses({prefetched, unrel_prefetched}, {&rel_dc, &unrel_dc});
+      }
+    }
+
     if (!reliable_frames.empty()) {
       header_block[":range"] = string("multibytes=") + reliable_frames;
-      response_body.clear();
-
-      quic::DownloadConfig dc = {FLAGS_abr,
-                                 required_reliable_size,
-                                 reliable_fallback_size,
-                                 abr.GetBuffer(),
-                                 q /* current quality level index */,
-                                 bitrates,
-                                 abr.instance(),
-                                 &client /*client*/,
-                                 true /*reliable*/,
-                                 segment_duration,
-                                 i, /*segment_no*/
-                                 &adaptationSet,
-                                 &ssim_map[i - 1],
-                                 false /*ret__kept*/,
-                                 0 /*ret__quality*/,
-                                 0 /*ret__ssim*/,
-                                 0 /*ret__pause*/};
-
-      client.SendRequestAndWaitForResponse(header_block, /*request_body*/"", /*fin=*/true, /*unrel*/false, &dc);
+
+      quic::DownloadConfig &dc = rel_dc;
+
+      if (prefetched) {
+        client.WaitForPrefetchedResponse(prefetched, /*unrel*/false, &dc);
+      } else {
+        client.SendRequestAndWaitForResponse(header_block, /*request_body*/"", /*fin=*/true, /*unrel*/false, &dc);
+      }
       check_404(client.latest_response_header_block(), dc.ret__kept);
 
-      abr.SetBuffer(abr.GetBuffer() - t->GetRealTime(/*unrel*/false));
+      // A prefetched request only reports the time nobody waited for another
+      // request, so the buffer drains by wall-clock time in either case.
+      abr->SetBuffer(abr->GetBuffer() - t->GetRealTime(/*unrel*/false) / 1000.0);
       
       if (!dc.ret__kept) { // force retry of current segment
+        if (unrel_prefetched) {
+          // Cancelled along with the reliable part, but the time it ran on
+          // its own drained the buffer as well.
+          client.WaitForPrefetchedResponse(unrel_prefetched, /*unrel*/true, &unrel_dc);
+          abr->SetBuffer(abr->GetBuffer() - t->GetRealTime(/*unrel*/true) / 1000.0);
+        }
         // bpp will ignore the following two
         bola_quality = dc.ret__quality;
         bola_pause = dc.ret__pause;
-        bpp_ssim = dc.ret__ssim;
+        bpp_option = dc.ret__option;
 
+        clear_pipeline(&pipeline, abr, segment_duration, &client);
         retry += 1;
         --i; continue;
       }
 
       response_timings = client.latest_response_timings();
-      response_body = client.latest_response_body();
+    }
+
+    // Deciding ahead resets the timings, keep the reliable ones for the log.
+    quic::SubSegmentTiming rel_timing = client.latest_segment_timing(quic::sst_rel);
+    double rel_throughput = client.GetSumThroughput(quic::sst_rel).first;
+    quic::SegmentTiming rel_throughputs = client.all_latest_segment_timing(quic::sst_rel);
 
-      std::vector<frame_order> frames_order;
-      append_frame_order(reliable_frames, adaptationSet[bitrates[q]].segments[i].start, &frames_order);
-      fill_segment_body(segment_body, response_body, frames_order);
+    if (FLAGS_pipeline > 0) {
+      extend_pipeline(&pipeline, i, num_segments, abr, use_qualities, adaptationSet, bitrates, header_block, &client);
     }
 
     auto t_rel_stop = std::chrono::system_clock::now();
@@ -1281,51 +1893,34 @@ int main(int argc, char* argv[]) {
 
     if (!required_unreliable_frames.empty()) {
       header_block[":range"] = string("multibytes=") + required_unreliable_frames;
-      response_body.clear();
-
-      quic::DownloadConfig dc = {FLAGS_abr,
-                                 required_unreliable_size,
-                                 unreliable_fallback_size,
-                                 abr.GetBuffer(),
-                                 q /* current quality level index */,
-                                 bitrates,
-                                 abr.instance(),
-                                 &client /*client*/,
-                                 false /*not reliable*/,
-                                 segment_duration,
-                                 i, /*segment_no*/
-                                 &adaptationSet,
-                                 &ssim_map[i - 1],
-                                 false /*ret__kept*/,
-                                 0 /*ret__quality*/,
-                                 0 /*ret__ssim*/,
-                                 0 /*ret__pause*/};
-
-      client.SendRequestAndWaitForResponse(header_block, /*request_body*/"", /*fin=*/true, /*unrel*/true, &dc);
+
+      quic::DownloadConfig &dc = unrel_dc;
+
+      if (unrel_prefetched) {
+        client.WaitForPrefetchedResponse(unrel_prefetched, /*unrel*/true, &dc);
+      } else {
+        dc.buffer_occ_us = (int64_t) ((abr->GetBuffer() - buffer_ahead(pipeline, segment_duration)) * 1000);
+        client.SendRequestAndWaitForResponse(header_block, /*request_body*/"", /*fin=*/true, /*unrel*/true, &dc);
+      }
       check_404(client.latest_response_header_block(), dc.ret__kept);
 
-      abr.SetBuffer(abr.GetBuffer() - t->GetRealTime(/*unrel*/true));
+      abr->SetBuffer(abr->GetBuffer() - t->GetRealTime(/*unrel*/true) / 1000.0);
 
       if (!dc.ret__kept) { // force retry of current segment
         // bpp will ignore the following two
         bola_quality = dc.ret__quality;
         bola_pause = dc.ret__pause;
-        bpp_ssim = dc.ret__ssim;
+        bpp_option = dc.ret__option;
 
+        clear_pipeline(&pipeline, abr, segment_duration, &client);
         retry += 1;
           --i; continue;
       }
 
       response_timings = client.latest_response_timings();
-      response_body = client.latest_response_body();
-      uint32_t pre_resize_body_size = response_body.size();
-      int tail_loss_len = required_unreliable_size - response_body.size();
-      if (response_body.size() < required_unreliable_size) {
-        response_body.resize(required_reliable_size);
-      }
-      std::vector<frame_order> frames_order;
-      append_frame_order(required_unreliable_frames, adaptationSet[bitrates[q]].segments[i].start, &frames_order);
-      fill_segment_body(segment_body, response_body, frames_order);
+      // Bytes missing at the end stay as they were in the segment.
+      uint32_t pre_resize_body_size = client.latest_response_body_size();
+      int tail_loss_len = required_unreliable_size - pre_resize_body_size;
 
       t_unrel_stop = std::chrono::system_clock::now();
 
@@ -1336,13 +1931,13 @@ int main(int argc, char* argv[]) {
         }
         generate_loss_information(response_timings,
                                   adaptationSet[bitrates[q]].segments[i].start,
-                                  frames_order,
+                                  unrel_frames_order,
                                   hole_range,
                                   loss_report,
                                   loss_size);
-        if (abr.GetBuffer() + segment_duration - (abr.instance()->buffer_size_ - segment_duration) > quic::kSafetyMargin) {
-          int used_time = fill_holes(hole_range, &abr, header_block, loss_size, &client, segment_body, adaptationSet[bitrates[q]].segments[i].start, segment_duration);
-          abr.SetBuffer(abr.GetBuffer() - used_time);
+        if (abr->GetBuffer() - buffer_ahead(pipeline, segment_duration) + segment_duration - (abr->buffer_size() - segment_duration) > SafetyMargin(client.GetTransportStats())) {
+          double used_time = fill_holes(hole_range, abr, header_block, loss_size, &client, segment_body, adaptationSet[bitrates[q]].segments[i].start, segment_duration, buffer_ahead(pipeline, segment_duration));
+          abr->SetBuffer(abr->GetBuffer() - used_time);
         } else {
           std::cerr << loss_report << std::endl;
         }
@@ -1354,25 +1949,26 @@ int main(int argc, char* argv[]) {
     }
 
     if (!optional_unreliable_frames.empty()) {
-      if (abr.GetBuffer() + segment_duration - (abr.instance()->buffer_size_ - segment_duration) > quic::kSafetyMargin) {
+      if (abr->GetBuffer() - buffer_ahead(pipeline, segment_duration) + segment_duration - (abr->buffer_size() - segment_duration) > SafetyMargin(client.GetTransportStats())) {
         std::cerr << "[loading-optional]" << std::endl;
-        int used_time = fill_holes(optional_unreliable_frames,
-                                   &abr,
-                                   header_block,
-                                   optional_unreliable_size,
-                                   &client,
-                                   segment_body,
-                                   adaptationSet[bitrates[q]].segments[i].start,
-                                   segment_duration);
-        abr.SetBuffer(abr.GetBuffer() - used_time);
+        double used_time = fill_holes(optional_unreliable_frames,
+                                      abr,
+                                      header_block,
+                                      optional_unreliable_size,
+                                      &client,
+                                      segment_body,
+                                      adaptationSet[bitrates[q]].segments[i].start,
+                                      segment_duration,
+                                      buffer_ahead(pipeline, segment_duration));
+        abr->SetBuffer(abr->GetBuffer() - used_time);
       } else {
         std::cerr << "[skipping-optional] " << optional_unreliable_frames << std::endl;
       }
     }
 
 
-    total_written += std::fwrite(segment_body.data(), sizeof segment_body[0], segment_body.size(), stdout);
-    fflush(stdout);
+    // Hands segment_body over, and gets a written buffer back to fill next.
+    writer.Submit(i, &segment_body);
 
 
     std::cerr << "[segment]" 
@@ -1391,19 +1987,18 @@ int main(int argc, char* argv[]) {
       << " s:" << std::chrono::duration_cast<std::chrono::milliseconds>(t_req_start - t_start).count()
       << " r:" << std::chrono::duration_cast<std::chrono::milliseconds>(t_rel_stop - t_req_start).count()
       << " u:" << std::chrono::duration_cast<std::chrono::milliseconds>(t_unrel_stop - t_rel_stop).count()
-      << " dlr:" << client.latest_segment_timing(quic::sst_rel).time_
-      << " dlu:" << client.latest_segment_timing(quic::sst_unrel).time_
+      << " dlr:" << rel_timing.time_us_ / 1000.0
+      << " dlu:" << client.latest_segment_timing(quic::sst_unrel).time_us_ / 1000.0
       << std::endl;
 
     std::cerr << "[throughput]"
       << " mavg:"  << t->GetTput()
-      << " r:" << client.GetSumThroughput(quic::sst_rel).first
+      << " r:" << rel_throughput
       << " u:" << client.GetSumThroughput(quic::sst_unrel).first
       << std::endl;
 
     retry = 0;
 
-    auto rel_throughputs = client.all_latest_segment_timing(quic::sst_rel);
     auto unrel_throughputs = client.all_latest_segment_timing(quic::sst_unrel);
     if (!rel_throughputs.empty()) {
       std::cerr << "[rel-throughputs]";
@@ -1420,12 +2015,45 @@ int main(int argc, char* argv[]) {
       std::cerr << std::endl;
     }
 
+    // Deeper pipelines take another decision on the unreliable part and hole
+    // fills of this segment.
+    if (FLAGS_pipeline > 0) {
+      extend_pipeline(&pipeline, i, num_segments, abr, use_qualities, adaptationSet, bitrates, header_block, &client);
+    }
+  }
+
+  if (!FLAGS_prior_file.empty()) {
+    EstimatorPrior prior = {};
+    t->SavePrior(&prior);
+    TransportStats stats = client.GetTransportStats();
+    prior.srtt = stats.srtt;
+    prior.min_rtt = stats.min_rtt;
+    prior.saved = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if (prior.throughput > 0) {
+      priors.Set(prior_server, prior);
+      if (!priors.Save(FLAGS_prior_file)) {
+        std::cerr << "[prior] cannot write " << FLAGS_prior_file << std::endl;
+      }
+    }
+  }
+
+  if (FLAGS_connection_stats && client.session() != nullptr) {
+    std::cerr << "[connection] "
+              << client.session()->connection()->GetStats() << std::endl;
+  }
+
+  // Flush queued segments and the log tail before tearing down the ABR.
+  total_written = writer.Finish();
+  std::cerr << "[written] " << total_written << std::endl;
+  if (decision_log) {
+    decision_log->Close();
   }
 
   delete mpc;
   delete bola;
   delete tput;
   //FIXME memory leak of t
+  delete decision_log;
 
   std::cerr << "[done] Terminating" << std::endl;
 }
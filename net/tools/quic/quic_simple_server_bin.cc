@@ -11,18 +11,27 @@ extern const char *gitversion;
 
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <memory>
 
 #include "base/at_exit.h"
+#include "base/bind.h"
 #include "base/command_line.h"
 #include "base/logging.h"
 #include "base/message_loop/message_loop.h"
 #include "base/run_loop.h"
 #include "base/strings/string_number_conversions.h"
 #include "base/task/task_scheduler/task_scheduler.h"
+#include "base/timer/timer.h"
 #include "net/base/ip_address.h"
 #include "net/base/ip_endpoint.h"
 #include "net/quic/crypto/proof_source_chromium.h"
+#include "net/third_party/quic/core/quic_connection.h"
+#include "net/third_party/quic/core/quic_connection_stats.h"
+#include "net/third_party/quic/core/quic_dispatcher.h"
+#include "net/third_party/quic/core/quic_packet_creator.h"
 #include "net/third_party/quic/core/quic_packets.h"
+#include "net/third_party/quic/core/quic_session.h"
 #include "net/third_party/quic/tools/quic_memory_cache_backend.h"
 #include "net/third_party/quic/tools/quic_simple_server_backend.h"
 #include "net/tools/quic/quic_http_proxy_backend.h"
@@ -40,6 +49,66 @@ std::string FLAGS_quic_response_cache_dir = "";
 // backend server
 std::string FLAGS_quic_proxy_backend_url = "";
 
+// If true, the retransmission and packing counters of every connection are
+// printed when it closes.
+bool FLAGS_connection_stats = false;
+
+// Prints the counters of a connection that has closed, once, as a
+// [connection] line.
+class ConnectionStatsPrinter : public quic::QuicConnectionDebugVisitor {
+ public:
+  explicit ConnectionStatsPrinter(quic::QuicConnection* connection)
+      : connection_(connection), closed_(false) {}
+
+  void OnConnectionClosed(quic::QuicErrorCode error,
+                          const quic::QuicString& error_details,
+                          quic::ConnectionCloseSource source) override {
+    closed_ = true;
+    const quic::QuicConnectionStats& stats = connection_->GetStats();
+    std::cerr << "[connection] id:" << connection_->connection_id()
+              << " bytes_sent:" << stats.bytes_sent
+              << " bytes_retransmitted:" << stats.bytes_retransmitted
+              << " packets_retransmitted:" << stats.packets_retransmitted
+              << " mixed_retransmitted:" << stats.mixed_packets_retransmitted
+              << " unreliable_bytes_in_retransmitted:"
+              << stats.unreliable_bytes_in_retransmitted_packets
+              << " packets_split:" << stats.packets_split_by_reliability
+              << " unreliable_bytes_split:" << stats.unreliable_bytes_split
+              << std::endl;
+  }
+
+  bool closed() const { return closed_; }
+
+ private:
+  quic::QuicConnection* connection_;
+  bool closed_;
+};
+
+using ConnectionStatsPrinters =
+    std::map<quic::QuicConnectionId, std::unique_ptr<ConnectionStatsPrinter>>;
+
+// Gives every new connection of |dispatcher| a printer, and drops the
+// printers of connections that closed and left the dispatcher.
+void WatchConnections(quic::QuicDispatcher* dispatcher,
+                      ConnectionStatsPrinters* printers) {
+  const quic::QuicDispatcher::SessionMap& sessions = dispatcher->session_map();
+  for (auto it = printers->begin(); it != printers->end();) {
+    if (it->second->closed() && sessions.count(it->first) == 0) {
+      it = printers->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (const auto& session : sessions) {
+    std::unique_ptr<ConnectionStatsPrinter>& printer = (*printers)[session.first];
+    if (printer == nullptr) {
+      quic::QuicConnection* connection = session.second->connection();
+      printer.reset(new ConnectionStatsPrinter(connection));
+      connection->set_debug_visitor(printer.get());
+    }
+  }
+}
+
 std::unique_ptr<quic::ProofSource> CreateProofSource(
     const base::FilePath& cert_path,
     const base::FilePath& key_path) {
@@ -82,11 +151,39 @@ int main(int argc, char* argv[]) {
         "hostname \n"
         "                            For example, \"http://xyz.com:80\"\n"
         "--certificate_file=<file>   path to the certificate chain\n"
-        "--key_file=<file>           path to the pkcs8 private key\n";
+        "--key_file=<file>           path to the pkcs8 private key\n"
+        "--mix_reliability           pack reliable and unreliable stream "
+        "data into the same\n"
+        "                            packets, as before they were kept "
+        "apart\n"
+        "--max_frame_alignment_padding=<bytes>\n"
+        "                            most bytes a packet may leave unused to "
+        "end with a video\n"
+        "                            frame of an unreliable stream, 0 turns "
+        "the alignment off\n"
+        "--connection_stats          print the retransmission and packing "
+        "counters of every\n"
+        "                            connection when it closes\n";
     std::cout << help_str;
     exit(0);
   }
 
+  if (line->HasSwitch("mix_reliability")) {
+    FLAGS_quic_segregate_unreliable_frames = false;
+  }
+  if (line->HasSwitch("connection_stats")) {
+    FLAGS_connection_stats = true;
+  }
+  if (line->HasSwitch("max_frame_alignment_padding")) {
+    if (!base::StringToInt(
+            line->GetSwitchValueASCII("max_frame_alignment_padding"),
+            &FLAGS_quic_max_frame_alignment_padding) ||
+        FLAGS_quic_max_frame_alignment_padding < 0) {
+      LOG(ERROR) << "--max_frame_alignment_padding must be a byte count";
+      return 1;
+    }
+  }
+
   // Serve the HTTP response from backend: memory cache or http proxy
   std::unique_ptr<quic::QuicSimpleServerBackend> quic_simple_server_backend;
 
@@ -143,6 +240,9 @@ int main(int argc, char* argv[]) {
 
   net::IPAddress ip = net::IPAddress::IPv4AllZeros();
 
+  // Outlives the server, whose connections print through it.
+  ConnectionStatsPrinters printers;
+
   quic::QuicConfig config;
   net::QuicSimpleServer server(
       CreateProofSource(line->GetSwitchValuePath("certificate_file"),
@@ -163,6 +263,15 @@ int main(int argc, char* argv[]) {
   std::ofstream err("srv.err.log");
   std::cerr.rdbuf(err.rdbuf()); 
 
+  // The dispatcher has no hook for closing connections, so new ones are
+  // picked up shortly after they are created, long before they close.
+  base::RepeatingTimer connection_watcher;
+  if (FLAGS_connection_stats) {
+    connection_watcher.Start(
+        FROM_HERE, base::TimeDelta::FromMilliseconds(10),
+        base::BindRepeating(&WatchConnections, server.dispatcher(),
+                            &printers));
+  }
 
   base::RunLoop().Run();
 
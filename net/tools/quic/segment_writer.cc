@@ -0,0 +1,159 @@
+#include "net/tools/quic/segment_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+SegmentWriter::SegmentWriter()
+    : stopping_(false),
+      fd_(-1),
+      written_(0)
+{
+}
+
+SegmentWriter::~SegmentWriter()
+{
+  Finish();
+}
+
+bool SegmentWriter::Start(int fd, const std::string& segment_dir)
+{
+  if (!segment_dir.empty()) {
+    struct stat st;
+    if (stat(segment_dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+      std::cerr << "[writer] no such directory " << segment_dir << std::endl;
+      return false;
+    }
+  }
+  fd_ = fd;
+  segment_dir_ = segment_dir;
+  stopping_ = false;
+  writer_ = std::thread(&SegmentWriter::WriteLoop, this);
+  return true;
+}
+
+void SegmentWriter::Submit(uint32_t segment_no, std::string* segment)
+{
+  std::string next;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back({segment_no, std::move(*segment)});
+    if (!free_.empty()) {
+      next = std::move(free_.back());
+      free_.pop_back();
+    }
+  }
+  pending_cv_.notify_one();
+  segment->swap(next);
+}
+
+size_t SegmentWriter::Finish()
+{
+  if (!writer_.joinable()) {
+    return written_;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  pending_cv_.notify_one();
+  writer_.join();
+  return written_;
+}
+
+void SegmentWriter::WriteLoop()
+{
+  std::vector<PendingSegment> batch;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      pending_cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+      if (pending_.empty()) {
+        // Stopping, and everything is written.
+        return;
+      }
+      for (auto& segment : pending_) {
+        batch.push_back(std::move(segment));
+      }
+      pending_.clear();
+    }
+
+    WriteBatch(&batch);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& segment : batch) {
+      segment.data.clear();
+      free_.push_back(std::move(segment.data));
+    }
+    batch.clear();
+  }
+}
+
+void SegmentWriter::WriteBatch(std::vector<PendingSegment>* batch)
+{
+  if (!segment_dir_.empty()) {
+    for (const auto& segment : *batch) {
+      WriteFile(segment);
+    }
+    return;
+  }
+
+  std::vector<struct iovec> iov;
+  for (const auto& segment : *batch) {
+    if (!segment.data.empty()) {
+      iov.push_back({const_cast<char*>(segment.data.data()), segment.data.size()});
+    }
+  }
+  size_t first = 0;
+  while (first < iov.size()) {
+    int count = std::min(iov.size() - first, (size_t) IOV_MAX);
+    ssize_t n = writev(fd_, &iov[first], count);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      std::cerr << "[writer] write failed, dropping output" << std::endl;
+      return;
+    }
+    written_ += n;
+    // Skip what was written, the rest of a partly written buffer stays.
+    while (first < iov.size() && (size_t) n >= iov[first].iov_len) {
+      n -= iov[first].iov_len;
+      ++first;
+    }
+    if (first < iov.size()) {
+      iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + n;
+      iov[first].iov_len -= n;
+    }
+  }
+}
+
+void SegmentWriter::WriteFile(const PendingSegment& segment)
+{
+  std::string path = segment_dir_ + "/" + std::to_string(segment.segment_no) + ".seg";
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "[writer] cannot create " << path << std::endl;
+    return;
+  }
+  size_t done = 0;
+  while (done < segment.data.size()) {
+    ssize_t n = write(fd, segment.data.data() + done, segment.data.size() - done);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "[writer] cannot write " << path << std::endl;
+      break;
+    }
+    done += n;
+  }
+  written_ += done;
+  close(fd);
+}
@@ -0,0 +1,59 @@
+#ifndef SEGMENT_WRITER
+#define SEGMENT_WRITER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes downloaded segments off the network thread.
+//
+// Submit() hands a filled segment buffer over and swaps in an empty one that
+// was written before, so the client keeps filling one buffer while the
+// writer drains the other (more if output falls behind; the network thread
+// never waits for it). The writer thread takes all pending segments at once
+// and writes them with a single writev, or, with a segment directory, into
+// one file per segment.
+class SegmentWriter {
+ public:
+  SegmentWriter();
+  ~SegmentWriter();
+
+  // Writes to |fd|, or to <segment_dir>/<segment_no>.seg if |segment_dir|
+  // is not empty. Returns false if the directory does not exist.
+  bool Start(int fd, const std::string& segment_dir);
+  // Queues |*segment| and replaces it with an empty buffer.
+  void Submit(uint32_t segment_no, std::string* segment);
+  // Writes everything queued and stops the writer. Returns the bytes
+  // written in total.
+  size_t Finish();
+
+ private:
+  struct PendingSegment {
+    uint32_t segment_no;
+    std::string data;
+  };
+
+  void WriteLoop();
+  void WriteBatch(std::vector<PendingSegment>* batch);
+  void WriteFile(const PendingSegment& segment);
+
+  std::mutex mutex_;
+  std::condition_variable pending_cv_;
+  std::deque<PendingSegment> pending_;
+  // Written buffers, kept for their capacity.
+  std::vector<std::string> free_;
+  bool stopping_;
+  std::thread writer_;
+
+  // Owned by the writer thread while running.
+  int fd_;
+  std::string segment_dir_;
+  size_t written_;
+};
+
+#endif //SEGMENT_WRITER
@@ -0,0 +1,115 @@
+#include "net/tools/quic/session_prior.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+bool SessionPriorStore::Load(const std::string& path)
+{
+  priors_.clear();
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string server;
+    EstimatorPrior prior = {};
+    size_t samples = 0;
+    if (!(fields >> server >> prior.saved >> prior.throughput
+                 >> prior.throughput_variance >> prior.ewma_slow
+                 >> prior.ewma_fast >> prior.srtt >> prior.min_rtt
+                 >> prior.sample_interval >> samples) ||
+        samples > kMaxSamples) {
+      continue;
+    }
+    prior.samples.resize(samples);
+    for (double& sample : prior.samples) {
+      fields >> sample;
+    }
+    if (!fields) {
+      continue;
+    }
+    priors_[server] = prior;
+  }
+  return true;
+}
+
+bool SessionPriorStore::Save(const std::string& path) const
+{
+  const std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::trunc);
+    if (!file) {
+      return false;
+    }
+    file << std::setprecision(10);
+    for (const auto& entry : priors_) {
+      const EstimatorPrior& prior = entry.second;
+      file << entry.first
+           << " " << prior.saved
+           << " " << prior.throughput
+           << " " << prior.throughput_variance
+           << " " << prior.ewma_slow
+           << " " << prior.ewma_fast
+           << " " << prior.srtt
+           << " " << prior.min_rtt
+           << " " << prior.sample_interval
+           << " " << prior.samples.size();
+      for (double sample : prior.samples) {
+        file << " " << sample;
+      }
+      file << "\n";
+    }
+    file.flush();
+    if (!file) {
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+bool SessionPriorStore::Find(const std::string& server, int64_t now,
+                             double min_rtt, EstimatorPrior* prior) const
+{
+  auto it = priors_.find(server);
+  if (it == priors_.end()) {
+    return false;
+  }
+  const EstimatorPrior& found = it->second;
+  if (found.throughput <= 0.0 || now - found.saved > kMaxAge) {
+    return false;
+  }
+  // Only compared if both are known; a different network most likely has a
+  // different bandwidth too.
+  if (min_rtt > 0.0 && found.min_rtt > 0.0 &&
+      (min_rtt > kMaxRttRatio * found.min_rtt ||
+       found.min_rtt > kMaxRttRatio * min_rtt)) {
+    return false;
+  }
+  *prior = found;
+  return true;
+}
+
+void SessionPriorStore::Set(const std::string& server,
+                            const EstimatorPrior& prior)
+{
+  EstimatorPrior& entry = priors_[server];
+  entry = prior;
+  if (entry.samples.size() > kMaxSamples) {
+    entry.samples.erase(entry.samples.begin(),
+                        entry.samples.end() - kMaxSamples);
+  }
+  while (priors_.size() > kMaxServers) {
+    auto oldest = priors_.begin();
+    for (auto it = priors_.begin(); it != priors_.end(); ++it) {
+      if (it->second.saved < oldest->second.saved) {
+        oldest = it;
+      }
+    }
+    priors_.erase(oldest);
+  }
+}
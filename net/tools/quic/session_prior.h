@@ -0,0 +1,65 @@
+#ifndef SESSION_PRIOR
+#define SESSION_PRIOR
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// time in ms
+// bitrate in kbps (equivalent to bits/ms)
+
+// Estimator state saved at the end of a session, so that the next session
+// with the same server does not start cold.
+struct EstimatorPrior {
+  // Estimate and its variance (kbps^2, 0 if unknown) when the session ended.
+  double throughput;
+  double throughput_variance;
+  // Slow and fast average of a MovingAverage, 0 if the estimator has none.
+  double ewma_slow;
+  double ewma_fast;
+  // Latest throughput samples, oldest first, and the mean time between them
+  // (0 if unknown).
+  std::vector<double> samples;
+  double sample_interval;
+  // RTT of the path, 0 if unknown.
+  double srtt;
+  double min_rtt;
+  // Seconds since the epoch.
+  int64_t saved;
+};
+
+// Priors of the servers seen lately. They are kept in a small text file with
+// one line per server:
+//   <server> <saved> <throughput> <variance> <ewma slow> <ewma fast>
+//   <srtt> <min rtt> <sample interval> <#samples> <samples>...
+class SessionPriorStore {
+ public:
+  // Returns false if |path| cannot be read; the store is empty then.
+  // Malformed lines are skipped, the servers after them are still read.
+  bool Load(const std::string& path);
+  // Replaces |path| as a whole, so that a crash never leaves half a file.
+  bool Save(const std::string& path) const;
+
+  // Returns false if there is no prior for |server|, or it is too old at
+  // |now| (s), or |min_rtt| of the new connection suggests another network.
+  bool Find(const std::string& server, int64_t now, double min_rtt,
+            EstimatorPrior* prior) const;
+  // Drops the oldest server once there are more than kMaxServers.
+  void Set(const std::string& server, const EstimatorPrior& prior);
+
+  size_t size() const { return priors_.size(); }
+
+  // Age (s) after which a prior says little about the bandwidth.
+  static constexpr int64_t kMaxAge = 24 * 3600;
+  // Largest ratio between the saved and the current min RTT.
+  static constexpr double kMaxRttRatio = 2.0;
+  static constexpr size_t kMaxServers = 64;
+  static constexpr size_t kMaxSamples = 16;
+
+ private:
+  std::map<std::string, EstimatorPrior> priors_;
+};
+
+#endif //SESSION_PRIOR
@@ -0,0 +1,256 @@
+#include "timestamping_network_helper.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "base/logging.h"
+#include "base/message_loop/message_loop_current.h"
+#include "base/run_loop.h"
+#include "build/build_config.h"
+#include "net/third_party/quic/core/quic_connection.h"
+#include "net/third_party/quic/core/quic_constants.h"
+
+namespace {
+
+// Datagrams read per wakeup before the message loop gets to run alarms.
+const int kPacketsPerRead = 32;
+
+socklen_t SocketAddressLength(const sockaddr_storage& address) {
+  return address.ss_family == AF_INET6 ? sizeof(sockaddr_in6)
+                                       : sizeof(sockaddr_in);
+}
+
+}  // namespace
+
+TimestampingNetworkHelper::TimestampingNetworkHelper(
+    quic::QuicClientBase* client)
+    : client_(client), fd_(-1), read_watcher_(FROM_HERE), reading_(false) {}
+
+TimestampingNetworkHelper::~TimestampingNetworkHelper() {
+  CloseSocket();
+}
+
+void TimestampingNetworkHelper::RunEventLoop() {
+  StartReadingIfNotStarted();
+  base::RunLoop().RunUntilIdle();
+}
+
+bool TimestampingNetworkHelper::CreateUDPSocketAndBind(
+    quic::QuicSocketAddress server_address,
+    quic::QuicIpAddress bind_to_address,
+    int bind_to_port) {
+  CloseSocket();
+
+  const bool v4 = server_address.host().IsIPv4();
+  quic::QuicSocketAddress bind_address(
+      bind_to_address.IsInitialized()
+          ? bind_to_address
+          : (v4 ? quic::QuicIpAddress::Any4() : quic::QuicIpAddress::Any6()),
+      bind_to_port);
+
+  int fd = socket(v4 ? AF_INET : AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    PLOG(ERROR) << "socket() failed";
+    return false;
+  }
+  int buffer_size = quic::kDefaultSocketReceiveBuffer;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+#if defined(OS_LINUX)
+  int enable = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) !=
+      0) {
+    PLOG(WARNING) << "No kernel receive timestamps";
+  }
+#endif
+
+  sockaddr_storage address = bind_address.generic_address();
+  if (bind(fd, reinterpret_cast<sockaddr*>(&address),
+           SocketAddressLength(address)) != 0) {
+    PLOG(ERROR) << "bind() to " << bind_address.ToString() << " failed";
+    close(fd);
+    return false;
+  }
+  // Connected, so the kernel only queues datagrams of the server.
+  address = server_address.generic_address();
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address),
+              SocketAddressLength(address)) != 0) {
+    PLOG(ERROR) << "connect() to " << server_address.ToString() << " failed";
+    close(fd);
+    return false;
+  }
+  socklen_t address_length = sizeof(address);
+  if (getsockname(fd, reinterpret_cast<sockaddr*>(&address),
+                  &address_length) != 0) {
+    PLOG(ERROR) << "getsockname() failed";
+    close(fd);
+    return false;
+  }
+  client_address_ = quic::QuicSocketAddress(address);
+  fd_ = fd;
+  return true;
+}
+
+void TimestampingNetworkHelper::CleanUpAllUDPSockets() {
+  // The writer writes to the socket.
+  client_->reset_writer();
+  CloseSocket();
+}
+
+void TimestampingNetworkHelper::CloseSocket() {
+  if (fd_ < 0) {
+    return;
+  }
+  read_watcher_.StopWatchingFileDescriptor();
+  reading_ = false;
+  close(fd_);
+  fd_ = -1;
+}
+
+quic::QuicSocketAddress TimestampingNetworkHelper::GetLatestClientAddress()
+    const {
+  return client_address_;
+}
+
+quic::QuicPacketWriter* TimestampingNetworkHelper::CreateQuicPacketWriter() {
+  return new ConnectedSocketPacketWriter(fd_);
+}
+
+void TimestampingNetworkHelper::StartReadingIfNotStarted() {
+  if (reading_ || fd_ < 0) {
+    return;
+  }
+  reading_ = base::MessageLoopCurrentForIO::Get()->WatchFileDescriptor(
+      fd_, /*persistent=*/true, base::MessagePumpForIO::WATCH_READ,
+      &read_watcher_, this);
+  LOG_IF(ERROR, !reading_) << "Cannot watch the client socket";
+}
+
+void TimestampingNetworkHelper::OnFileCanReadWithoutBlocking(int fd) {
+  char buffer[quic::kMaxPacketSize];
+  for (int i = 0; i < kPacketsPerRead; ++i) {
+    if (!ReadPacket(buffer, sizeof(buffer))) {
+      return;
+    }
+  }
+}
+
+void TimestampingNetworkHelper::OnFileCanWriteWithoutBlocking(int fd) {
+  NOTREACHED();
+}
+
+bool TimestampingNetworkHelper::ReadPacket(char* buffer,
+                                           size_t buffer_length) {
+  iovec iov = {buffer, buffer_length};
+  sockaddr_storage peer;
+#if defined(OS_LINUX)
+  char control[CMSG_SPACE(sizeof(timespec))];
+#else
+  char control[1];
+#endif
+  msghdr message = {};
+  message.msg_name = &peer;
+  message.msg_namelen = sizeof(peer);
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  ssize_t length = recvmsg(fd_, &message, MSG_DONTWAIT);
+  if (length < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return false;
+    }
+    PLOG(ERROR) << "Reading the client socket failed";
+    client_->Disconnect();
+    return false;
+  }
+  if (message.msg_flags & MSG_TRUNC) {
+    // Larger than any QUIC packet; not ours.
+    return true;
+  }
+
+  quic::QuicWallTime stamp = quic::QuicWallTime::Zero();
+#if defined(OS_LINUX)
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&message, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+      const timespec* ts = reinterpret_cast<const timespec*>(CMSG_DATA(cmsg));
+      stamp = quic::QuicWallTime::FromUNIXMicroseconds(
+          static_cast<uint64_t>(ts->tv_sec) * 1000000 + ts->tv_nsec / 1000);
+    }
+  }
+#endif
+
+  quic::QuicReceivedPacket packet(buffer, length, ReceiptTime(stamp),
+                                  /*owns_buffer=*/false);
+  quic::QuicConnection* connection = client_->session()->connection();
+  connection->ProcessUdpPacket(client_address_, quic::QuicSocketAddress(peer),
+                               packet);
+  return connection->connected();
+}
+
+quic::QuicTime TimestampingNetworkHelper::ReceiptTime(
+    quic::QuicWallTime stamp) {
+  const quic::QuicClock* clock = client_->helper()->GetClock();
+  const quic::QuicTime now = clock->Now();
+  if (stamp.IsZero()) {
+    return now;
+  }
+  const quic::QuicWallTime wall_now = clock->WallNow();
+  if (wall_now.IsBefore(stamp)) {
+    return now;
+  }
+  return now - wall_now.AbsoluteDifference(stamp);
+}
+
+ConnectedSocketPacketWriter::ConnectedSocketPacketWriter(int fd) : fd_(fd) {}
+
+ConnectedSocketPacketWriter::~ConnectedSocketPacketWriter() {}
+
+quic::WriteResult ConnectedSocketPacketWriter::WritePacket(
+    const char* buffer,
+    size_t buf_len,
+    const quic::QuicIpAddress& self_address,
+    const quic::QuicSocketAddress& peer_address,
+    quic::PerPacketOptions* options) {
+  ssize_t rc = send(fd_, buffer, buf_len, 0);
+  if (rc < 0) {
+    return quic::WriteResult(quic::WRITE_STATUS_ERROR, errno);
+  }
+  return quic::WriteResult(quic::WRITE_STATUS_OK, rc);
+}
+
+bool ConnectedSocketPacketWriter::IsWriteBlockedDataBuffered() const {
+  return false;
+}
+
+bool ConnectedSocketPacketWriter::IsWriteBlocked() const {
+  return false;
+}
+
+void ConnectedSocketPacketWriter::SetWritable() {}
+
+quic::QuicByteCount ConnectedSocketPacketWriter::GetMaxPacketSize(
+    const quic::QuicSocketAddress& peer_address) const {
+  return quic::kMaxPacketSize;
+}
+
+bool ConnectedSocketPacketWriter::SupportsReleaseTime() const {
+  return false;
+}
+
+bool ConnectedSocketPacketWriter::IsBatchMode() const {
+  return false;
+}
+
+char* ConnectedSocketPacketWriter::GetNextWriteLocation() const {
+  return nullptr;
+}
+
+quic::WriteResult ConnectedSocketPacketWriter::Flush() {
+  return quic::WriteResult(quic::WRITE_STATUS_OK, 0);
+}
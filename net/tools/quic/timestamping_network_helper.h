@@ -0,0 +1,103 @@
+#ifndef TIMESTAMPING_NETWORK_HELPER
+#define TIMESTAMPING_NETWORK_HELPER
+
+#include "base/macros.h"
+#include "base/message_loop/message_pump_for_io.h"
+#include "net/third_party/quic/core/quic_packet_writer.h"
+#include "net/third_party/quic/core/quic_packets.h"
+#include "net/third_party/quic/platform/api/quic_socket_address.h"
+#include "net/third_party/quic/tools/quic_client_base.h"
+
+// Network helper of the client which owns its UDP socket, so that every
+// datagram is timed by when the kernel received it.
+//
+// Chromium's UDP socket reads with recvfrom(), which drops the control
+// messages. This helper enables SO_TIMESTAMPNS on its own socket and reads
+// with recvmsg(), taking each datagram's software receive stamp from its
+// own control message. The packet is handed to the connection with that
+// receipt time, which the sequencer's FrameTiming then carries. A busy
+// client thread no longer shifts frame arrivals, and a batch of datagrams
+// read at once keeps the times they arrived at.
+//
+// The stamp is wall clock. Only the datagram's age is taken from it,
+// against the wall clock read right after the datagram, and subtracted from
+// the connection's monotonic clock; a clock step moves only datagrams that
+// were queued across it, and never into the future. Datagrams without a
+// stamp are timed when they are read, as before.
+class TimestampingNetworkHelper
+    : public quic::QuicClientBase::NetworkHelper,
+      public base::MessagePumpForIO::FdWatcher {
+ public:
+  explicit TimestampingNetworkHelper(quic::QuicClientBase* client);
+  ~TimestampingNetworkHelper() override;
+
+  // quic::QuicClientBase::NetworkHelper
+  void RunEventLoop() override;
+  bool CreateUDPSocketAndBind(quic::QuicSocketAddress server_address,
+                              quic::QuicIpAddress bind_to_address,
+                              int bind_to_port) override;
+  void CleanUpAllUDPSockets() override;
+  quic::QuicSocketAddress GetLatestClientAddress() const override;
+  quic::QuicPacketWriter* CreateQuicPacketWriter() override;
+
+  // base::MessagePumpForIO::FdWatcher
+  void OnFileCanReadWithoutBlocking(int fd) override;
+  void OnFileCanWriteWithoutBlocking(int fd) override;
+
+ private:
+  // Stops watching and closes the socket, if there is one.
+  void CloseSocket();
+
+  // Watches the socket once the client runs the event loop, as Chromium's
+  // packet reader does; there is no session to hand packets to before.
+  void StartReadingIfNotStarted();
+
+  // Reads one datagram into |buffer| and hands it to the connection.
+  // Returns false once there is nothing left to read or the connection
+  // is gone.
+  bool ReadPacket(char* buffer, size_t buffer_length);
+
+  // Receipt time on the connection clock of a datagram stamped |stamp|
+  // by the kernel.
+  quic::QuicTime ReceiptTime(quic::QuicWallTime stamp);
+
+  quic::QuicClientBase* client_;
+  int fd_;
+  quic::QuicSocketAddress client_address_;
+  base::MessagePumpForIO::FdWatchController read_watcher_;
+  bool reading_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimestampingNetworkHelper);
+};
+
+// Writes to the connected socket of TimestampingNetworkHelper. The socket
+// blocks on writes, so the writer is never write blocked.
+class ConnectedSocketPacketWriter : public quic::QuicPacketWriter {
+ public:
+  // |fd| is not owned.
+  explicit ConnectedSocketPacketWriter(int fd);
+  ~ConnectedSocketPacketWriter() override;
+
+  // quic::QuicPacketWriter
+  quic::WriteResult WritePacket(const char* buffer,
+                                size_t buf_len,
+                                const quic::QuicIpAddress& self_address,
+                                const quic::QuicSocketAddress& peer_address,
+                                quic::PerPacketOptions* options) override;
+  bool IsWriteBlockedDataBuffered() const override;
+  bool IsWriteBlocked() const override;
+  void SetWritable() override;
+  quic::QuicByteCount GetMaxPacketSize(
+      const quic::QuicSocketAddress& peer_address) const override;
+  bool SupportsReleaseTime() const override;
+  bool IsBatchMode() const override;
+  char* GetNextWriteLocation() const override;
+  quic::WriteResult Flush() override;
+
+ private:
+  int fd_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConnectedSocketPacketWriter);
+};
+
+#endif
@@ -4,24 +4,6 @@
 ThroughputAbr::~ThroughputAbr() {
 }
 
-double ThroughputAbr::accept(Dispatcher &dispatcher, DP type, int value, const std::map<double, SSIMBasedQuality>& ssim_map) {
-  switch (type) {
-    case GQ:
-      return dispatcher.GetQuality(*this, value);
-    case GP:
-      return dispatcher.GetPause(*this);
-    case GB:
-      return dispatcher.GetBuffer(*this);
-    case SB:
-      dispatcher.SetBuffer(*this, value);
-      return 0.0;
-  default: 
-    std::cerr << "error requested method not available" << std::endl;
-    exit(-1);
-    return 0.0;
-  }
-}
-
 ThroughputAbr::ThroughputAbr(double segment_duration,
                              double buffer_size,
                              std::vector<double> bitrates)
@@ -38,12 +20,12 @@ int ThroughputAbr::GetPause()
   return pause;
 }
 
-int ThroughputAbr::GetBuffer()
+double ThroughputAbr::GetBuffer()
 {
   return buffer_level_;
 }
 
-void ThroughputAbr::SetBuffer(int lvl) {
+void ThroughputAbr::SetBuffer(double lvl) {
   buffer_level_ = lvl;
 }
 
@@ -56,27 +38,55 @@ int ThroughputAbr::GetQuality(double throughput, double* pause)
     *pause = 0.0;
   }
 
-  AbrLogLine log_line;
-  if (log_.empty()) {
-    log_line.playhead_time_ = -this->buffer_level_;
-  } else {
-    log_line.playhead_time_ = log_.back().playhead_time_ + segment_duration_ +
-      log_.back().buffer_level_ - this->buffer_level_;
-  }
-  log_line.buffer_level_ = this->buffer_level_;
-  log_line.throughput_ = throughput;
-  log_line.quality_ = quality;
-  log_line.bitrate_ = bitrates_[quality];
-  log_line.pause_ = *pause;
-  log_.push_back(log_line);
+  LogDecision(buffer_level_, segment_duration_, throughput, quality,
+              bitrates_[quality], *pause, /*retry=*/0);
 
   this->pause = *pause;
   return quality;
 }
 
-const std::vector<AbrLogLine>& ThroughputAbr::GetLog() 
+AbrDecision ThroughputAbr::Decide(const AbrInput& input, int retry,
+                                  const SegmentQualities& qualities)
+{
+  double pause = 0.0;
+
+  PreUpdate(pause, input.time);
+  int quality = GetQuality(input.throughput, &pause);
+  PostUpdate(pause, input.time);
+
+  AbrDecision decision;
+  decision.option = -1;
+  decision.quality = quality;
+  decision.pause = pause;
+  decision.expected_size = bitrates_[quality] * segment_duration_ / 8.0;
+  return decision;
+}
+
+AbrDecision ThroughputAbr::DecideStartup(const AbrInput& input,
+                                         const SegmentQualities& qualities)
+{
+  double pause = 0.0;
+  int quality = GetQuality(input.throughput, &pause);
+
+  AbrDecision decision;
+  decision.option = -1;
+  decision.quality = quality;
+  decision.pause = pause;
+  decision.expected_size = bitrates_[quality] * segment_duration_ / 8.0;
+  return decision;
+}
+
+AbrDecision ThroughputAbr::DecideInFlight(const BolaAbandonEvaluator& in_flight,
+                                          double buffer_level, double throughput)
 {
-  return log_;
+  int quality = QualityFromThroughput(throughput * kSafetyFactor);
+
+  AbrDecision decision;
+  decision.option = -1;
+  decision.quality = quality;
+  decision.pause = 0.0;
+  decision.expected_size = bitrates_[quality] * segment_duration_ / 8.0;
+  return decision;
 }
 
 int ThroughputAbr::QualityFromThroughput(double throughput)
@@ -89,10 +99,14 @@ int ThroughputAbr::QualityFromThroughput(double throughput)
   return bitrates_.size() - 1;
 }
 
-void ThroughputAbr::PreUpdate(double pause, uint32_t walltime) {
+void ThroughputAbr::PreUpdate(double pause, double walltime) {
 
   if (buffer_level_ < 0.0) {
-    std::cerr << (startup ? "[startup] " : "[rebuffer] ") << (int)(-buffer_level_) << std::endl;
+    if (decision_log_) {
+      LogEvent(startup ? kAbrLogStartup : kAbrLogRebuffer, -buffer_level_, 0.0, 0.0, 0);
+    } else {
+      std::cerr << (startup ? "[startup] " : "[rebuffer] ") << (int)(-buffer_level_) << std::endl;
+    }
     buffer_level_ = 0.0;
   }
   startup = false;
@@ -100,11 +114,17 @@ void ThroughputAbr::PreUpdate(double pause, uint32_t walltime) {
   buffer_level_ += segment_duration_;
 }
 
-void ThroughputAbr::PostUpdate(double pause, uint32_t walltime) {
-  if (pause > 0.0){
-    std::cerr << "[pause] " << (int)(pause) << std::endl;
+void ThroughputAbr::PostUpdate(double pause, double walltime) {
+  if (pause > 0.0) {
     buffer_level_ -= pause;
   }
 
+  if (decision_log_) {
+    LogEvent(kAbrLogBuffer, buffer_level_, pause > 0.0 ? pause : 0.0, 0.0, 0);
+    return;
+  }
+  if (pause > 0.0) {
+    std::cerr << "[pause] " << (int)(pause) << std::endl;
+  }
   std::cerr << "[buffer] " << (int)(buffer_level_) << std::endl;
 }
@@ -10,7 +10,6 @@
 // bitrate in kbps (equivalent to bits/ms)
 
 class BaseAbr;
-class Dispatcher;
 
 class ThroughputAbr: public BaseAbr {
  public:
@@ -21,12 +20,18 @@ class ThroughputAbr: public BaseAbr {
 
   int GetQuality(double throughput, double* pause);
   int GetPause();
-  int GetBuffer();
-  void SetBuffer(int lvl);
-  void PreUpdate(double pause, uint32_t);
-  void PostUpdate(double pause, uint32_t);
-  double accept(Dispatcher &dispatcher, DP type, int retry, const std::map<double, SSIMBasedQuality>& ssim_map) override;
-  const std::vector<AbrLogLine>& GetLog();
+  double GetBuffer();
+  void SetBuffer(double lvl);
+  void PreUpdate(double pause, double walltime);
+  void PostUpdate(double pause, double walltime);
+  // Policy interface of Abr<ThroughputAbr, Estimator>.
+  AbrDecision Decide(const AbrInput& input, int retry, const SegmentQualities& qualities);
+  AbrDecision DecideStartup(const AbrInput& input, const SegmentQualities& qualities);
+  void StartInFlight(BolaAbandonEvaluator* in_flight,
+                     const SegmentQualities* qualities,
+                     const std::vector<double>& sizes_bits) {}
+  AbrDecision DecideInFlight(const BolaAbandonEvaluator& in_flight,
+                             double buffer_level, double throughput);
 
   int pause;
 
@@ -34,7 +39,6 @@ class ThroughputAbr: public BaseAbr {
   double buffer_level_;
   double segment_duration_;
   std::vector<double> bitrates_;
-  std::vector<AbrLogLine> log_;
   static constexpr double kSafetyFactor = 0.9;
   int QualityFromThroughput(double throughput);
 };